@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) Chris Zankel. All rights reserved.
+# This code is subject to U.S. and other copyright laws and
+# intellectual property protections.
+#
+# The contents of this file are confidential and proprietary to Chris Zankel.
+#
+
+"""Benchmarks for the pygridstreamer binding layer.
+
+The benchmarks use the stand-in grid library in bench/standin, so they
+measure the binding rather than the streaming framework:
+
+    GRIDSTREAMER_STANDIN=1 python setup.py build_ext --inplace
+    python bench/bench.py --output results.json
+
+The module built in place at the top of the repository is found before any
+installed module.
+
+The results are written as JSON. Times are in nanoseconds per operation
+unless the unit says otherwise.
+"""
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import sys
+import threading
+import time
+import timeit
+
+# note: the module is built in place at the top of the repository
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                os.pardir))
+
+import pygridstreamer
+
+
+BENCHMARKS = []
+
+
+def benchmark(func):
+    BENCHMARKS.append(func)
+    return func
+
+
+def measure(stmt, number, repeat, setup="pass", globals=None):
+    """Return the time per call in ns of each repeat of stmt."""
+    times = timeit.repeat(stmt, setup=setup, number=number, repeat=repeat,
+                          globals=globals)
+    return [t / number * 1e9 for t in times]
+
+
+def summary(samples, unit="ns", **extra):
+    result = {
+        "unit": unit,
+        "value": min(samples),
+        "median": statistics.median(samples),
+        "samples": len(samples),
+    }
+    result.update(extra)
+    return result
+
+
+def percentile(sorted_samples, fraction):
+    index = min(len(sorted_samples) - 1, int(fraction * len(sorted_samples)))
+    return sorted_samples[index]
+
+
+def gain_channel(grid, name):
+    return grid.allocate_channel(name, "p: a=gain")
+
+
+@benchmark
+def parameter_get(args):
+    grid = pygridstreamer.Grid("bench")
+    param = gain_channel(grid, "c").lookup("p/a.gain")
+    return summary(measure("param.value", args.number, args.repeat,
+                           globals=locals()))
+
+
+@benchmark
+def parameter_get_uncached(args):
+    grid = pygridstreamer.Grid("bench")
+    channel = gain_channel(grid, "c")
+    param = channel.lookup("p/a.gain")
+    other = channel.lookup("p/a.gain")
+    # note: setting the value through another object invalidates the cache
+    set_time = min(measure("other.value = 1.0", args.number, args.repeat,
+                           globals=locals()))
+    samples = measure("other.value = 1.0; param.value", args.number,
+                      args.repeat, globals=locals())
+    return summary([s - set_time for s in samples])
+
+
+@benchmark
+def parameter_set(args):
+    grid = pygridstreamer.Grid("bench")
+    param = gain_channel(grid, "c").lookup("p/a.gain")
+    return summary(measure("param.value = 1.0", args.number, args.repeat,
+                           globals=locals()))
+
+
+@benchmark
+def parameter_set_tuple(args):
+    grid = pygridstreamer.Grid("bench")
+    param = gain_channel(grid, "c").lookup("p/a.window")
+    return summary(measure("param.value = (1, 2)", args.number, args.repeat,
+                           globals=locals()))
+
+
+@benchmark
+def parameter_lookup(args):
+    grid = pygridstreamer.Grid("bench")
+    gain_channel(grid, "c")
+    return summary(measure("grid['c/p/a.gain']", args.number, args.repeat,
+                           globals=locals()))
+
+
+def run_ticker(count, interval, handler):
+    """Run a ticker channel and wait until the handler received all ticks."""
+    grid = pygridstreamer.Grid("bench")
+    channel = grid.allocate_channel("c", "p: t=ticker")
+    channel.apply({"p/t.count": count, "p/t.interval": interval})
+    done = threading.Event()
+    received = [0]
+
+    def tick(index, timestamp):
+        handler(index, timestamp)
+        received[0] += 1
+        if received[0] == count:
+            done.set()
+
+    channel.lookup("p/t").on_tick.connect(tick)
+    start = time.perf_counter()
+    channel.run()
+    done.wait(60)
+    elapsed = time.perf_counter() - start
+    channel.stop()
+    return received[0], elapsed
+
+
+@benchmark
+def callback_throughput(args):
+    samples = []
+    for _ in range(args.repeat):
+        received, elapsed = run_ticker(args.events, 0, lambda i, t: None)
+        samples.append(received / elapsed)
+    return {
+        "unit": "events/s",
+        "value": max(samples),
+        "median": statistics.median(samples),
+        "samples": len(samples),
+        "events": args.events,
+    }
+
+
+@benchmark
+def callback_latency(args):
+    latencies = []
+
+    def handler(index, timestamp):
+        latencies.append((time.monotonic() - timestamp) * 1e9)
+
+    run_ticker(args.events // 10, 100, handler)
+    latencies.sort()
+    return {
+        "unit": "ns",
+        "value": percentile(latencies, 0.5),
+        "p90": percentile(latencies, 0.9),
+        "p99": percentile(latencies, 0.99),
+        "max": latencies[-1],
+        "samples": len(latencies),
+    }
+
+
+def topology(pipelines, cells):
+    return "; ".join("p%d: " % p + " ".join("c%d=gain" % c for c in range(cells))
+                     for p in range(pipelines))
+
+
+@benchmark
+def cells_traversal(args):
+    grid = pygridstreamer.Grid("bench")
+    channel = grid.allocate_channel("c", topology(16, 64))
+
+    def traverse():
+        return sum(len(pipeline.cells())
+                   for pipeline in channel.cells().values())
+
+    total = traverse()
+    samples = measure(traverse, max(1, args.number // 1000), args.repeat)
+    return summary(samples, cells=total)
+
+
+@benchmark
+def channel_allocate(args):
+    layout = topology(1, 4)
+    number = max(1, args.number // 100)
+    samples = []
+    for _ in range(args.repeat):
+        grid = pygridstreamer.Grid("bench")
+        names = ["c%d" % i for i in range(number)]
+        start = time.perf_counter()
+        for name in names:
+            grid.allocate_channel(name, layout)
+        samples.append((time.perf_counter() - start) / number * 1e9)
+    return summary(samples, cells=4)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--output", "-o", help="write the JSON results to a file")
+    parser.add_argument("--number", type=int, default=100000,
+                        help="number of calls per repeat")
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="number of repeats")
+    parser.add_argument("--events", type=int, default=100000,
+                        help="number of callback events")
+    parser.add_argument("--filter", default="",
+                        help="run only benchmarks containing this string")
+    args = parser.parse_args()
+
+    results = {}
+    for func in BENCHMARKS:
+        if args.filter in func.__name__:
+            results[func.__name__] = func(args)
+            print("%-24s %12.1f %s" % (func.__name__,
+                                       results[func.__name__]["value"],
+                                       results[func.__name__]["unit"]),
+                  file=sys.stderr)
+
+    report = {
+        "python": platform.python_version(),
+        "implementation": platform.python_implementation(),
+        "machine": platform.machine(),
+        "benchmarks": results,
+    }
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+
+if __name__ == "__main__":
+    main()
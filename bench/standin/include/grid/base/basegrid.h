@@ -0,0 +1,26 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer base grid.
+//
+
+#ifndef GRID_BASE_BASEGRID_H
+#define GRID_BASE_BASEGRID_H
+
+#include <grid/fw/grid.h>
+
+namespace grid {
+
+class BaseGrid : public Grid
+{
+};
+
+} // end of namespace grid
+
+#endif  // GRID_BASE_BASEGRID_H
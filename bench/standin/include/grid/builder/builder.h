@@ -0,0 +1,48 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer layout builder.
+//
+// Layout format (stand-in only):
+//   <pipeline>: <cell>=<type> <cell>=<type> ...; <pipeline>: ...
+//
+
+#ifndef GRID_BUILDER_BUILDER_H
+#define GRID_BUILDER_BUILDER_H
+
+#include <grid/fw/grid.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace grid {
+
+struct Layout
+{
+  struct Pipeline
+  {
+    std::string                                       name;
+    std::vector<std::pair<std::string, std::string>>  cells;
+  };
+  std::vector<Pipeline> pipelines;
+};
+
+
+class Builder
+{
+ public:
+  std::unique_ptr<Layout> Compile(const char* text, std::string& err);
+  bool UpdateChannel(Grid& grid, Channel& channel, const Layout& layout);
+};
+
+} // end of namespace grid
+
+#endif  // GRID_BUILDER_BUILDER_H
@@ -0,0 +1,74 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer callback.
+//
+
+#ifndef GRID_FW_CALLBACK_H
+#define GRID_FW_CALLBACK_H
+
+#include <grid/util/arguments.h>
+#include <grid/util/function.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace grid {
+
+class Callback;
+
+// Slot describes a connection to a callback; it disconnects when released.
+class Slot
+{
+ public:
+  Slot(Callback* callback, Function func, CloseFunction close, uintptr_t ctx)
+    : callback_(callback), func_(func), close_(close), context_(ctx) {}
+  ~Slot();
+
+ private:
+  friend class Callback;
+  Callback*     callback_;
+  Function      func_;
+  CloseFunction close_;
+  uintptr_t     context_;
+};
+
+
+class Callback
+{
+ public:
+  Callback(std::vector<unsigned long> signature)
+    : signature_(std::move(signature)) {}
+  ~Callback() { Close(); }
+
+  const unsigned long* Signature() const { return signature_.data(); }
+
+  std::unique_ptr<Slot> Connect(Function func, CloseFunction close, uintptr_t);
+  void Disconnect(Slot* slot);
+  void Close();
+
+  template <typename... Args>
+  void Call(Args... args)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto slot : slots_)
+      slot->func_(slot->context_, args...);
+  }
+
+ private:
+  std::vector<unsigned long>  signature_;
+  std::mutex                  mutex_;
+  std::list<Slot*>            slots_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_CALLBACK_H
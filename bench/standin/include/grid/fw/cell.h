@@ -0,0 +1,83 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer cell.
+//
+
+#ifndef GRID_FW_CELL_H
+#define GRID_FW_CELL_H
+
+#include <grid/fw/callback.h>
+#include <grid/fw/parameter.h>
+#include <grid/fw/registry.h>
+#include <grid/fw/state.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace grid {
+
+class Cluster;
+class Pipeline;
+
+class Cell
+{
+ public:
+  Cell(const std::string& type) : type_(type) {}
+  virtual ~Cell() {}
+
+  const std::string& Type() const             { return type_; }
+
+  virtual Pipeline* PipelineInterface()       { return nullptr; }
+  virtual Cluster* ClusterInterface()         { return nullptr; }
+
+  Registry<Parameter>& GetParameters()        { return parameters_; }
+  Registry<Callback>& GetCallbacks()          { return callbacks_; }
+
+  virtual bool SetState(State state)          { return true; }
+
+ protected:
+  std::string         type_;
+  Registry<Parameter> parameters_;
+  Registry<Callback>  callbacks_;
+};
+
+
+// CellFactory creates cells of a registered type.
+class CellFactory
+{
+ public:
+  CellFactory(const std::string& type,
+              std::function<std::shared_ptr<Cell>()> create)
+    : type_(type), create_(create) {}
+
+  const std::string& GetType() const          { return type_; }
+  std::shared_ptr<Cell> Create() const        { return create_(); }
+
+ private:
+  std::string                             type_;
+  std::function<std::shared_ptr<Cell>()>  create_;
+};
+
+
+class CellDirectory
+{
+ public:
+  typedef std::vector<CellFactory>::const_iterator Iterator;
+
+  static Iterator Begin();
+  static Iterator End();
+  static std::shared_ptr<Cell> Create(const std::string& type);
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_CELL_H
@@ -0,0 +1,47 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer channel.
+//
+
+#ifndef GRID_FW_CHANNEL_H
+#define GRID_FW_CHANNEL_H
+
+#include <grid/fw/pipeline.h>
+#include <grid/fw/state.h>
+
+#include <atomic>
+
+namespace grid {
+
+class Channel
+{
+ public:
+  void CreateLayout();
+  void AbortLayout();
+  bool CommitLayout();
+
+  Registry<Pipeline>& GetPipelines()          { return pipelines_; }
+
+  // Pipelines that are instantiated between CreateLayout and CommitLayout.
+  Registry<Pipeline>& GetPendingPipelines()   { return pending_; }
+
+  State GetState() const                      { return state_; }
+  bool SetState(State state);
+  bool SetStateCond(State curr, State next);
+
+ private:
+  Registry<Pipeline>  pipelines_;
+  Registry<Pipeline>  pending_;
+  std::atomic<State>  state_{kStateNull};
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_CHANNEL_H
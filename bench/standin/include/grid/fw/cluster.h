@@ -0,0 +1,34 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer cluster.
+//
+
+#ifndef GRID_FW_CLUSTER_H
+#define GRID_FW_CLUSTER_H
+
+#include <grid/fw/cell.h>
+
+namespace grid {
+
+class Cluster : public Cell
+{
+ public:
+  Cluster() : Cell("cluster") {}
+
+  Cluster* ClusterInterface() override        { return this; }
+  Registry<Cell>& GetCells()                  { return cells_; }
+
+ private:
+  Registry<Cell> cells_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_CLUSTER_H
@@ -0,0 +1,40 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer grid.
+//
+
+#ifndef GRID_FW_GRID_H
+#define GRID_FW_GRID_H
+
+#include <grid/fw/callback.h>
+#include <grid/fw/cell.h>
+#include <grid/fw/channel.h>
+#include <grid/fw/parameter.h>
+#include <grid/fw/registry.h>
+
+namespace grid {
+
+class Grid
+{
+ public:
+  virtual ~Grid() {}
+
+  virtual std::shared_ptr<Channel>* AllocateChannel(const std::string& name);
+  virtual void RemoveChannel(std::shared_ptr<Channel>* channel);
+
+  Registry<Channel>& GetChannels()            { return channels_; }
+
+ protected:
+  Registry<Channel> channels_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_GRID_H
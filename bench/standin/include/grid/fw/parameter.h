@@ -0,0 +1,47 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer parameter.
+//
+
+#ifndef GRID_FW_PARAMETER_H
+#define GRID_FW_PARAMETER_H
+
+#include <grid/util/arguments.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace grid {
+
+// Parameter keeps the values of a list of (trivially copyable) arguments.
+class Parameter
+{
+ public:
+  Parameter(std::vector<unsigned long> signature, const std::string& format);
+
+  const unsigned long* GetSignature() const   { return signature_.data(); }
+  const std::string& GetFormat() const        { return format_; }
+  size_t GetArgumentBufferSize() const        { return values_.size(); }
+
+  bool GetValues(void* args, size_t args_size) const;
+  bool CallUnsafe(void* ret, size_t ret_size, void* args, size_t args_size);
+  bool Scan(const std::string& str);
+
+ private:
+  std::vector<unsigned long>  signature_;
+  std::string                 format_;
+  mutable std::mutex          mutex_;
+  std::vector<char>           values_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_PARAMETER_H
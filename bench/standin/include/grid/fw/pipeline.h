@@ -0,0 +1,36 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer pipeline.
+//
+
+#ifndef GRID_FW_PIPELINE_H
+#define GRID_FW_PIPELINE_H
+
+#include <grid/fw/cell.h>
+
+namespace grid {
+
+class Pipeline : public Cell
+{
+ public:
+  Pipeline() : Cell("pipeline") {}
+
+  Pipeline* PipelineInterface() override      { return this; }
+  Registry<Cell>& GetCells()                  { return cells_; }
+
+  bool SetState(State state) override;
+
+ private:
+  Registry<Cell> cells_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_PIPELINE_H
@@ -0,0 +1,66 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer registry.
+//
+
+#ifndef GRID_FW_REGISTRY_H
+#define GRID_FW_REGISTRY_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace grid {
+
+// Registry keeps named objects in insertion-independent (sorted) order.
+template <typename T>
+class Registry
+{
+  typedef std::map<std::string, std::shared_ptr<T>> Map;
+
+ public:
+  class Iterator
+  {
+   public:
+    Iterator(typename Map::iterator it) : it_(it) {}
+
+    const std::string& Key() const                { return it_->first; }
+    std::shared_ptr<T>& operator*() const         { return it_->second; }
+    T* operator->() const                         { return it_->second.get(); }
+    Iterator& operator++()                        { ++it_; return *this; }
+    bool operator!=(const Iterator& other) const  { return it_ != other.it_; }
+    bool operator==(const Iterator& other) const  { return it_ == other.it_; }
+
+   private:
+    typename Map::iterator it_;
+  };
+
+  Iterator Begin()                                { return map_.begin(); }
+  Iterator End()                                  { return map_.end(); }
+  Iterator Find(const std::string& key)           { return map_.find(key); }
+  size_t Size() const                             { return map_.size(); }
+
+  std::shared_ptr<T>* Add(const std::string& key, std::shared_ptr<T> obj)
+  {
+    auto res = map_.emplace(key, std::move(obj));
+    return res.second ? &res.first->second : nullptr;
+  }
+
+  void Remove(const std::string& key)             { map_.erase(key); }
+  void Clear()                                    { map_.clear(); }
+  void Swap(Registry& other)                      { map_.swap(other.map_); }
+
+ private:
+  Map map_;
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_REGISTRY_H
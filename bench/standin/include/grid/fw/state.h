@@ -0,0 +1,33 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer states.
+//
+
+#ifndef GRID_FW_STATE_H
+#define GRID_FW_STATE_H
+
+namespace grid {
+
+enum State
+{
+  kStateInvalid = -1,
+  kStateNull = 0,
+  kStateReady,
+  kStateSet,
+  kStateFlushing,
+  kStateRunning,
+  kStatePaused,
+  kStateEnd,
+  kStateError,
+};
+
+} // end of namespace grid
+
+#endif  // GRID_FW_STATE_H
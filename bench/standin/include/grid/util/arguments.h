@@ -0,0 +1,80 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer argument traits.
+//
+
+#ifndef GRID_UTIL_ARGUMENTS_H
+#define GRID_UTIL_ARGUMENTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace grid {
+
+// Trait layout: | count (16+) | signed (1) | type (4) | align log2 (3) | size log2 (3) |
+const unsigned long kSizeMask   = 0x7;
+const unsigned long kAlignShift = 3;
+const unsigned long kAlignMask  = 0x7 << kAlignShift;
+const unsigned long kTypeShift  = 6;
+const unsigned long kTypeMask   = 0xf << kTypeShift;
+const unsigned long kSignShift  = 10;
+const unsigned long kCountShift = 16;
+const unsigned long kCountMask  = ~0xffffUL;
+
+enum
+{
+  kVoid = 0,
+  kInteger,
+  kBoolean,
+  kNumber,
+  kStdString,
+};
+
+constexpr unsigned long Log2(size_t v)
+{
+  return v <= 1 ? 0 : 1 + Log2(v / 2);
+}
+
+constexpr unsigned long MakeSig(int type, size_t size, size_t align, bool sgn)
+{
+  return (1UL << kCountShift) | ((unsigned long)sgn << kSignShift) |
+    ((unsigned long)type << kTypeShift) | (Log2(align) << kAlignShift) |
+    Log2(size);
+}
+
+template <typename T> struct TypeT;
+
+#define GRID_STUB_TYPE(T, type, sgn) \
+  template <> struct TypeT<T> \
+  { static const unsigned long Sig = MakeSig(type, sizeof(T), alignof(T), sgn); };
+
+GRID_STUB_TYPE(uint8_t,     kInteger,   false)
+GRID_STUB_TYPE(uint16_t,    kInteger,   false)
+GRID_STUB_TYPE(uint32_t,    kInteger,   false)
+GRID_STUB_TYPE(uint64_t,    kInteger,   false)
+GRID_STUB_TYPE(int8_t,      kInteger,   true)
+GRID_STUB_TYPE(int16_t,     kInteger,   true)
+GRID_STUB_TYPE(int32_t,     kInteger,   true)
+GRID_STUB_TYPE(int64_t,     kInteger,   true)
+GRID_STUB_TYPE(bool,        kBoolean,   false)
+GRID_STUB_TYPE(float,       kNumber,    true)
+GRID_STUB_TYPE(double,      kNumber,    true)
+GRID_STUB_TYPE(long double, kNumber,    true)
+GRID_STUB_TYPE(std::string, kStdString, false)
+
+#undef GRID_STUB_TYPE
+
+template <> struct TypeT<std::string&>
+{ static const unsigned long Sig = TypeT<std::string>::Sig; };
+
+} // end of namespace grid
+
+#endif  // GRID_UTIL_ARGUMENTS_H
@@ -0,0 +1,27 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in for the GridStreamer function helpers.
+//
+
+#ifndef GRID_UTIL_FUNCTION_H
+#define GRID_UTIL_FUNCTION_H
+
+#include <cstdint>
+
+namespace grid {
+
+class Slot;
+
+typedef void (*Function)(uintptr_t context...);
+typedef void (*CloseFunction)(const Slot& slot, uintptr_t context);
+
+} // end of namespace grid
+
+#endif  // GRID_UTIL_FUNCTION_H
@@ -0,0 +1,56 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in implementation of the GridStreamer callback.
+//
+
+#include <grid/fw/callback.h>
+
+namespace grid {
+
+Slot::~Slot()
+{
+  if (callback_ != nullptr)
+    callback_->Disconnect(this);
+}
+
+
+std::unique_ptr<Slot>
+Callback::Connect(Function func, CloseFunction close, uintptr_t context)
+{
+  std::unique_ptr<Slot> slot(new Slot(this, func, close, context));
+  std::lock_guard<std::mutex> lock(mutex_);
+  slots_.push_back(slot.get());
+  return slot;
+}
+
+
+void Callback::Disconnect(Slot* slot)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  slots_.remove(slot);
+}
+
+
+void Callback::Close()
+{
+  std::list<Slot*> slots;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots.swap(slots_);
+  }
+  for (auto slot : slots)
+  {
+    slot->callback_ = nullptr;
+    if (slot->close_ != nullptr)
+      slot->close_(*slot, slot->context_);
+  }
+}
+
+} // end of namespace grid
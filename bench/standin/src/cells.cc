@@ -0,0 +1,131 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in cell types: "gain" with a few scalar parameters and "ticker",
+// which fires its "Tick" callback "Count" times from a native thread when
+// the channel starts running, waiting "Interval" microseconds between ticks.
+// The callback passes the index of the tick and the time of the monotonic
+// clock in seconds, which is the clock of Python's time.monotonic().
+//
+
+#include <grid/fw/cell.h>
+
+#include <chrono>
+#include <thread>
+
+namespace grid {
+
+namespace {
+
+class GainCell : public Cell
+{
+ public:
+  GainCell() : Cell("gain")
+  {
+    parameters_.Add("Gain", std::make_shared<Parameter>(
+          std::vector<unsigned long>{ 1, TypeT<double>::Sig }, "%f"));
+    parameters_.Add("Bitrate", std::make_shared<Parameter>(
+          std::vector<unsigned long>{ 1, TypeT<uint32_t>::Sig }, "%u"));
+    parameters_.Add("Enabled", std::make_shared<Parameter>(
+          std::vector<unsigned long>{ 1, TypeT<bool>::Sig }, "%d"));
+    parameters_.Add("Window", std::make_shared<Parameter>(
+          std::vector<unsigned long>{ 2, TypeT<int32_t>::Sig,
+                                         TypeT<int32_t>::Sig }, "%d %d"));
+  }
+};
+
+
+class TickerCell : public Cell
+{
+ public:
+  TickerCell() : Cell("ticker")
+  {
+    count_ = std::make_shared<Parameter>(
+        std::vector<unsigned long>{ 1, TypeT<uint32_t>::Sig }, "%u");
+    parameters_.Add("Count", count_);
+    interval_ = std::make_shared<Parameter>(
+        std::vector<unsigned long>{ 1, TypeT<uint32_t>::Sig }, "%u");
+    parameters_.Add("Interval", interval_);
+    tick_ = std::make_shared<Callback>(
+        std::vector<unsigned long>{ 2, TypeT<uint32_t>::Sig,
+                                       TypeT<double>::Sig });
+    callbacks_.Add("Tick", tick_);
+  }
+
+  ~TickerCell()
+  {
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  bool SetState(State state) override
+  {
+    if (state != kStateRunning)
+    {
+      if (thread_.joinable())
+        thread_.join();
+      return true;
+    }
+
+    uint32_t count = 0;
+    uint32_t interval = 0;
+    count_->GetValues(&count, sizeof(count));
+    interval_->GetValues(&interval, sizeof(interval));
+    if (thread_.joinable())
+      thread_.join();
+    thread_ = std::thread([this, count, interval]() {
+      for (uint32_t i = 0; i < count; i++)
+      {
+        if (interval != 0 && i != 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(interval));
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        tick_->Call(i, std::chrono::duration<double>(now).count());
+      }
+    });
+    return true;
+  }
+
+ private:
+  std::shared_ptr<Parameter>  count_;
+  std::shared_ptr<Parameter>  interval_;
+  std::shared_ptr<Callback>   tick_;
+  std::thread                 thread_;
+};
+
+
+std::vector<CellFactory> factories =
+{
+  CellFactory("gain", []() { return std::make_shared<GainCell>(); }),
+  CellFactory("ticker", []() { return std::make_shared<TickerCell>(); }),
+};
+
+} // end of namespace
+
+
+CellDirectory::Iterator CellDirectory::Begin()
+{
+  return factories.begin();
+}
+
+
+CellDirectory::Iterator CellDirectory::End()
+{
+  return factories.end();
+}
+
+
+std::shared_ptr<Cell> CellDirectory::Create(const std::string& type)
+{
+  for (auto& factory : factories)
+    if (factory.GetType() == type)
+      return factory.Create();
+  return nullptr;
+}
+
+} // end of namespace grid
@@ -0,0 +1,145 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in implementation of the GridStreamer grid, channel, and builder.
+//
+
+#include <grid/builder/builder.h>
+#include <grid/fw/grid.h>
+#include <grid/fw/pipeline.h>
+
+#include <sstream>
+
+namespace grid {
+
+bool Pipeline::SetState(State state)
+{
+  for (auto it = cells_.Begin(); it != cells_.End(); ++it)
+    if (!it->SetState(state))
+      return false;
+  return true;
+}
+
+
+void Channel::CreateLayout()
+{
+  pending_.Clear();
+}
+
+
+void Channel::AbortLayout()
+{
+  pending_.Clear();
+}
+
+
+bool Channel::CommitLayout()
+{
+  SetState(kStateNull);
+  pipelines_.Swap(pending_);
+  pending_.Clear();
+  return true;
+}
+
+
+bool Channel::SetState(State state)
+{
+  for (auto it = pipelines_.Begin(); it != pipelines_.End(); ++it)
+    if (!it->SetState(state))
+      return false;
+  state_ = state;
+  return true;
+}
+
+
+bool Channel::SetStateCond(State curr, State next)
+{
+  if (state_ != curr)
+    return false;
+  return SetState(next);
+}
+
+
+std::shared_ptr<Channel>* Grid::AllocateChannel(const std::string& name)
+{
+  return channels_.Add(name, std::make_shared<Channel>());
+}
+
+
+void Grid::RemoveChannel(std::shared_ptr<Channel>* channel)
+{
+  for (auto it = channels_.Begin(); it != channels_.End(); ++it)
+    if (&*it == channel)
+    {
+      channels_.Remove(it.Key());
+      return;
+    }
+}
+
+
+std::unique_ptr<Layout> Builder::Compile(const char* text, std::string& err)
+{
+  std::unique_ptr<Layout> layout(new Layout);
+  std::istringstream in(text != nullptr ? text : "");
+  std::string decl;
+
+  while (std::getline(in, decl, ';'))
+  {
+    size_t colon = decl.find(':');
+    if (colon == std::string::npos)
+    {
+      if (decl.find_first_not_of(" \t\n") != std::string::npos)
+      {
+        err = "missing ':' in pipeline declaration";
+        return nullptr;
+      }
+      continue;
+    }
+
+    Layout::Pipeline pipeline;
+    std::istringstream names(decl.substr(0, colon));
+    names >> pipeline.name;
+
+    std::istringstream cells(decl.substr(colon + 1));
+    std::string cell;
+    while (cells >> cell)
+    {
+      size_t eq = cell.find('=');
+      if (eq == std::string::npos)
+      {
+        err = "missing '=' in cell declaration '" + cell + "'";
+        return nullptr;
+      }
+      pipeline.cells.emplace_back(cell.substr(0, eq), cell.substr(eq + 1));
+    }
+    layout->pipelines.push_back(std::move(pipeline));
+  }
+  return layout;
+}
+
+
+bool Builder::UpdateChannel(Grid&, Channel& channel, const Layout& layout)
+{
+  auto& pending = channel.GetPendingPipelines();
+  for (auto& decl : layout.pipelines)
+  {
+    auto pipeline = std::make_shared<Pipeline>();
+    for (auto& cell : decl.cells)
+    {
+      auto obj = CellDirectory::Create(cell.second);
+      if (obj == nullptr || pipeline->GetCells().Add(cell.first, obj) == nullptr)
+        return false;
+    }
+    if (pending.Add(decl.name, pipeline) == nullptr)
+      return false;
+  }
+  return true;
+}
+
+} // end of namespace grid
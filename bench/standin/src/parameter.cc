@@ -0,0 +1,98 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// Stand-in implementation of the GridStreamer parameter.
+//
+
+#include <grid/fw/parameter.h>
+
+#include <cstring>
+#include <sstream>
+
+namespace grid {
+
+Parameter::Parameter(std::vector<unsigned long> signature,
+                     const std::string& format)
+  : signature_(std::move(signature)), format_(format)
+{
+  size_t size = 0;
+  for (size_t i = 1; i <= signature_[0]; i++)
+  {
+    size_t align = 1 << ((signature_[i] & kAlignMask) >> kAlignShift);
+    size = (size + align - 1) & -align;
+    size += (signature_[i] >> kCountShift) * (1 << (signature_[i] & kSizeMask));
+  }
+  values_.resize(size);
+}
+
+
+bool Parameter::GetValues(void* args, size_t args_size) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (args_size < values_.size())
+    return false;
+  memcpy(args, values_.data(), values_.size());
+  return true;
+}
+
+
+bool Parameter::CallUnsafe(void*, size_t, void* args, size_t args_size)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (args_size < values_.size())
+    return false;
+  memcpy(values_.data(), args, values_.size());
+  return true;
+}
+
+
+bool Parameter::Scan(const std::string& str)
+{
+  std::vector<char> values(values_.size());
+  std::istringstream in(str);
+  uintptr_t ptr = (uintptr_t) values.data();
+
+  for (size_t i = 1; i <= signature_[0]; i++)
+  {
+    unsigned long trait = signature_[i];
+    size_t align = 1 << ((trait & kAlignMask) >> kAlignShift);
+    size_t size = 1 << (trait & kSizeMask);
+    ptr = (ptr + align - 1) & -align;
+
+    long double value;
+    if (!(in >> value))
+      return false;
+
+    if (trait == TypeT<float>::Sig)
+      *(float*)ptr = value;
+    else if (trait == TypeT<double>::Sig)
+      *(double*)ptr = value;
+    else if (trait == TypeT<long double>::Sig)
+      *(long double*)ptr = value;
+    else if (trait == TypeT<bool>::Sig)
+      *(bool*)ptr = value != 0;
+    else if (size == 1)
+      *(uint8_t*)ptr = (int64_t) value;
+    else if (size == 2)
+      *(uint16_t*)ptr = (int64_t) value;
+    else if (size == 4)
+      *(uint32_t*)ptr = (int64_t) value;
+    else if (size == 8)
+      *(uint64_t*)ptr = (int64_t) value;
+    else
+      return false;
+    ptr += size;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  values_.swap(values);
+  return true;
+}
+
+} // end of namespace grid
@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) Chris Zankel. All rights reserved.
+# This code is subject to U.S. and other copyright laws and
+# intellectual property protections.
+#
+# The contents of this file are confidential and proprietary to Chris Zankel.
+#
+
+"""Concurrent stress test for the pygridstreamer binding layer.
+
+Worker threads get, set and apply parameters of a shared channel, and connect
+and disconnect functions to callbacks, while ticker channels dispatch
+callback events from their own threads. The test fails if any operation
+raises, a parameter value is torn, or a callback event is lost:
+
+    GRIDSTREAMER_STANDIN=1 python setup.py build_ext --inplace
+    python bench/stress.py --threads 8 --duration 5
+
+On free-threaded Python (3.13t) the module runs without the GIL, and the CPU
+time exceeds the elapsed time when the threads run on multiple cores; the
+ratio is reported as "parallelism".
+"""
+
+import argparse
+import json
+import os
+import platform
+import sys
+import threading
+import time
+
+# note: the module is built in place at the top of the repository
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                os.pardir))
+
+import pygridstreamer
+
+
+def gil_enabled():
+    is_gil_enabled = getattr(sys, "_is_gil_enabled", None)
+    return is_gil_enabled() if is_gil_enabled is not None else True
+
+
+class Stress:
+
+    def __init__(self, args):
+        self.args = args
+        self.grid = pygridstreamer.Grid("stress")
+        self.channel = self.grid.allocate_channel("shared", "p: a=gain")
+        self.stop = threading.Event()
+        self.errors = []
+        self.operations = {}
+        self.lock = threading.Lock()
+
+    def fail(self, message):
+        with self.lock:
+            self.errors.append(message)
+        self.stop.set()
+
+    def count(self, name, number):
+        with self.lock:
+            self.operations[name] = self.operations.get(name, 0) + number
+
+    def parameters(self, index):
+        """Set and get the parameters of the shared channel; a window is
+        always written with equal values, so a torn value is detected."""
+        cell = self.channel.lookup("p/a")
+        gain = cell.gain
+        window = cell.window
+        number = 0
+        value = index * 1000
+        while not self.stop.is_set():
+            value += 1
+            gain.value = float(value)
+            window.value = (value, value)
+            self.channel.apply({"p/a.bitrate": value, "p/a.window": (-value, -value)})
+            first, second = window.value
+            if first != second:
+                self.fail("torn window value (%d, %d)" % (first, second))
+            if not isinstance(gain.value[0], float):
+                self.fail("invalid gain value %r" % (gain.value,))
+            self.grid["shared/p/a.bitrate"]
+            number += 6
+        self.count("parameters", number)
+
+    def connections(self, tickers):
+        """Connect and disconnect functions to the callbacks of the tickers
+        while they dispatch events."""
+        number = 0
+        func = lambda index, timestamp: None
+        while not self.stop.is_set():
+            for _, ticker, _ in tickers:
+                ticker.on_tick.connect(func)
+                ticker.on_tick.disconnect(func)
+                number += 2
+        self.count("connections", number)
+
+    def run(self):
+        args = self.args
+        count = max(1, int(args.duration * 1e6 / max(args.interval, 1)))
+
+        tickers = []
+        for i in range(args.tickers):
+            channel = self.grid.allocate_channel("ticker%d" % i, "p: t=ticker")
+            channel.apply({"p/t.count": count, "p/t.interval": args.interval})
+            ticker = channel.lookup("p/t")
+            received = []
+            ticker.on_tick.connect(lambda index, timestamp, r=received:
+                                   r.append(index))
+            tickers.append((channel, ticker, received))
+
+        threads = [threading.Thread(target=self.parameters, args=(i,))
+                   for i in range(args.threads)]
+        threads.append(threading.Thread(target=self.connections,
+                                        args=(tickers,)))
+
+        cpu = time.process_time()
+        start = time.perf_counter()
+        for channel, _, _ in tickers:
+            channel.run()
+        for thread in threads:
+            thread.start()
+
+        deadline = start + args.duration * 4 + 10
+        while (not self.stop.is_set() and time.perf_counter() < deadline and
+               any(len(received) < count for _, _, received in tickers)):
+            time.sleep(0.01)
+        self.stop.set()
+        for thread in threads:
+            thread.join()
+
+        elapsed = time.perf_counter() - start
+        cpu = time.process_time() - cpu
+        for channel, _, _ in tickers:
+            channel.stop()
+
+        events = 0
+        for i, (_, _, received) in enumerate(tickers):
+            events += len(received)
+            if sorted(received) != list(range(count)):
+                self.fail("ticker%d received %d of %d events" %
+                          (i, len(received), count))
+        self.count("callbacks", events)
+
+        return {
+            "python": platform.python_version(),
+            "gil_enabled": gil_enabled(),
+            "cpus": os.cpu_count(),
+            "threads": args.threads,
+            "tickers": args.tickers,
+            "elapsed": elapsed,
+            "parallelism": cpu / elapsed,
+            "operations": self.operations,
+            "errors": self.errors,
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--output", "-o", help="write the JSON results to a file")
+    parser.add_argument("--threads", type=int, default=os.cpu_count(),
+                        help="number of parameter threads")
+    parser.add_argument("--tickers", type=int, default=2,
+                        help="number of ticker channels")
+    parser.add_argument("--interval", type=int, default=50,
+                        help="interval of the tickers in microseconds")
+    parser.add_argument("--duration", type=float, default=2.0,
+                        help="duration of the ticks in seconds")
+    args = parser.parse_args()
+
+    report = Stress(args).run()
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    if report["errors"]:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,25 +1,54 @@
 from setuptools import setup, Extension
+import glob
 import os
 
 gridstreamer_destdir = os.environ.get("GRIDSTREAMER_DESTDIR", "/usr/local")
 
+# build against the stand-in grid library of the benchmarks instead of an
+# installed libgridstreamer
+gridstreamer_standin = os.environ.get("GRIDSTREAMER_STANDIN", "") not in ("", "0")
+
+if gridstreamer_standin:
+    grid_include_dirs = ["bench/standin/include"]
+    grid_library_dirs = []
+    grid_libraries = []
+    grid_sources = sorted(glob.glob("bench/standin/src/*.cc"))
+else:
+    grid_include_dirs = [gridstreamer_destdir + "/include"]
+    grid_library_dirs = [gridstreamer_destdir + "/lib"]
+    grid_libraries = ["gridstreamer"]
+    grid_sources = []
+
 setup(
     package_data={"pygridstreamer": ["lib/libpygridstreamer.so"]},
+    headers=["source/pygridstreamer.h"],
     ext_modules=[
         Extension(
             'pygridstreamer',
-            include_dirs=[gridstreamer_destdir + "/include", 'source'],
-            library_dirs = [gridstreamer_destdir + "/lib"],
-            libraries = ["gridstreamer"],
+            include_dirs=grid_include_dirs + ['source'],
+            library_dirs = grid_library_dirs,
+            libraries = grid_libraries,
             sources = [
                 'source/arguments.cc',
                 'source/callback.cc',
+                'source/capi.cc',
                 'source/cell.cc',
                 'source/channel.cc',
+                'source/checkpoint.cc',
                 'source/grid.cc',
                 'source/gridmodule.cc',
+                'source/latency.cc',
+                'source/layout.cc',
+                'source/memory.cc',
                 'source/parameter.cc',
-                ],
+                'source/placement.cc',
+                'source/pool.cc',
+                'source/profile.cc',
+                'source/scheduler.cc',
+                'source/shard.cc',
+                'source/stats.cc',
+                'source/trace.cc',
+                ] + grid_sources,
             extra_compile_args=["-std=c++17"],
             language = "c++")
         ]
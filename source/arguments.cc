@@ -11,6 +11,12 @@
 
 #include <Python.h>
 
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+
 
 // Helper function to read arguments from an argument buffer into a python tuple
 PyObject*
@@ -70,7 +76,7 @@ PyGridStreamerReadArguments(void* args_buf,
         case grid::TypeT<long double>::Sig:
           item = PyFloat_FromDouble(*(long double*)args_ptr); break;
         case grid::TypeT<std::string&>::Sig:
-          item = PyUnicode_FromString(((std::string&)args_ptr).c_str()); break;
+          item = PyUnicode_FromString(((std::string*)args_ptr)->c_str()); break;
         default: break;
       }
     }
@@ -89,7 +95,8 @@ PyGridStreamerReadArguments(void* args_buf,
 }
 
 
-// Helper function to write a python object to the current argument entry
+// Helper function to write a python object to the current argument entry;
+// returns 0 with an exception set if the object can't be converted.
 static int
 WriteSingleArgument(PyObject* item, uintptr_t& args_ptr, unsigned long trait)
 {
@@ -111,7 +118,6 @@ WriteSingleArgument(PyObject* item, uintptr_t& args_ptr, unsigned long trait)
       (type == grid::kStdString && PyUnicode_Check(item) == 0))
     return PyErr_BadArgument();
 
-  int ovfl = 0;
   switch (trait)
   {
    case grid::TypeT<uint8_t>::Sig:
@@ -121,7 +127,7 @@ WriteSingleArgument(PyObject* item, uintptr_t& args_ptr, unsigned long trait)
     case grid::TypeT<uint32_t>::Sig:
       *(uint32_t*)args_ptr = PyLong_AsUnsignedLong(item); break;
     case grid::TypeT<uint64_t>::Sig:
-      *(uint64_t*)args_ptr = PyLong_AsLongAndOverflow(item, &ovfl);
+      *(uint64_t*)args_ptr = PyLong_AsUnsignedLongLong(item); break;
     case grid::TypeT<int8_t>::Sig:
       *(int8_t*)args_ptr = PyLong_AsLong(item); break;
     case grid::TypeT<int16_t>::Sig:
@@ -142,14 +148,17 @@ WriteSingleArgument(PyObject* item, uintptr_t& args_ptr, unsigned long trait)
       {
         Py_ssize_t size;
         const char* str = PyUnicode_AsUTF8AndSize(item, &size);
+        if (str == NULL)
+          return 0;
         *(std::string*)args_ptr = std::string(str, size);
         break;
       }
     default: break;
   }
 
-  // FIXME: do something with ovfl
-  // FIXME: check if error occured during conversion
+  // note: the conversions return -1 and set an exception on overflow
+  if (PyErr_Occurred())
+    return 0;
 
   // update pointer (note, it's a reference)
   args_ptr += count * size;
@@ -158,7 +167,7 @@ WriteSingleArgument(PyObject* item, uintptr_t& args_ptr, unsigned long trait)
 
 
 // Helper function to write python arguments (tupe, list, string, object) to
-// an argument buffer.
+// an argument buffer. Returns 1, or 0 with an exception set on any failure.
 int PyGridStreamerWriteArguments(PyObject* args,
                                  void* args_buf,
                                  size_t args_sz,
@@ -174,7 +183,7 @@ int PyGridStreamerWriteArguments(PyObject* args,
     for (size_t i = 0; i < traits[0]; i++)
       if (WriteSingleArgument(
             PyTuple_GetItem(args, i), args_ptr, traits[i + 1]) != 1)
-        return -1;
+        return 0;
   }
   else if (PyList_Check(args))
   {
@@ -184,14 +193,384 @@ int PyGridStreamerWriteArguments(PyObject* args,
     for (size_t i = 0; i < traits[0]; i++)
       if (WriteSingleArgument(
             PyList_GetItem(args, i), args_ptr, traits[i + 1]) != 1)
-        return -1;
+        return 0;
   }
   else if (traits[0] == 1)
   {
-    return WriteSingleArgument(args, args_ptr, 1);
+    return WriteSingleArgument(args, args_ptr, traits[1]);
   }
   else
     return PyErr_BadArgument();
 
   return 1;
 }
+
+
+// Helper function to write a single number to an argument buffer without
+// going through Python objects.
+bool GridStreamerWriteNumber(double value,
+                             void* args_buf,
+                             size_t args_sz,
+                             const unsigned long* traits)
+{
+  if (traits[0] != 1)
+    return false;
+
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+  unsigned long trait = traits[1];
+  size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+  args_ptr = (args_ptr + align - 1) & -align;
+
+  switch (trait)
+  {
+    case grid::TypeT<uint8_t>::Sig:
+      *(uint8_t*)args_ptr = llround(value); break;
+    case grid::TypeT<uint16_t>::Sig:
+      *(uint16_t*)args_ptr = llround(value); break;
+    case grid::TypeT<uint32_t>::Sig:
+      *(uint32_t*)args_ptr = llround(value); break;
+    case grid::TypeT<uint64_t>::Sig:
+      *(uint64_t*)args_ptr = llround(value); break;
+    case grid::TypeT<int8_t>::Sig:
+      *(int8_t*)args_ptr = llround(value); break;
+    case grid::TypeT<int16_t>::Sig:
+      *(int16_t*)args_ptr = llround(value); break;
+    case grid::TypeT<int32_t>::Sig:
+      *(int32_t*)args_ptr = llround(value); break;
+    case grid::TypeT<int64_t>::Sig:
+      *(int64_t*)args_ptr = llround(value); break;
+    case grid::TypeT<float>::Sig:
+      *(float*)args_ptr = value; break;
+    case grid::TypeT<double>::Sig:
+      *(double*)args_ptr = value; break;
+    case grid::TypeT<long double>::Sig:
+      *(long double*)args_ptr = value; break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+
+// Helper function to append a string as a quoted JSON string.
+void GridStreamerAppendJSONString(std::string& json, const char* str, size_t len)
+{
+  json.push_back('"');
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\')
+    {
+      json.push_back('\\');
+      json.push_back(c);
+    }
+    else if (c < 0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      json.append(esc);
+    }
+    else
+      json.push_back(c);
+  }
+  json.push_back('"');
+}
+
+
+// Helper function to append a floating point number to a JSON string.
+static void AppendJSONNumber(std::string& json, double value)
+{
+  if (!std::isfinite(value))
+  {
+    json.append("null");
+    return;
+  }
+
+  char num[32];
+  snprintf(num, sizeof(num), "%.17g", value);
+  json.append(num);
+}
+
+
+// Helper function to append the arguments of an argument buffer as a JSON
+// array to a string.
+bool GridStreamerFormatArguments(std::string& json,
+                                 const void* args_buf,
+                                 size_t args_sz,
+                                 const unsigned long* traits)
+{
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+
+  json.push_back('[');
+  for (size_t i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (i > 1)
+      json.push_back(',');
+
+    // support only char arrays
+    if (count > 1)
+    {
+      unsigned long t =  (trait & ~grid::kCountMask) | (1 << grid::kCountShift);
+      if (t != grid::TypeT<uint8_t>::Sig)
+        return false;
+
+      const char* str = (const char*) args_ptr;
+      GridStreamerAppendJSONString(json, str, strnlen(str, count));
+    }
+    else
+    {
+      switch (trait)
+      {
+        case grid::TypeT<uint8_t>::Sig:
+          json.append(std::to_string(*(uint8_t*)args_ptr)); break;
+        case grid::TypeT<uint16_t>::Sig:
+          json.append(std::to_string(*(uint16_t*)args_ptr)); break;
+        case grid::TypeT<uint32_t>::Sig:
+          json.append(std::to_string(*(uint32_t*)args_ptr)); break;
+        case grid::TypeT<uint64_t>::Sig:
+          json.append(std::to_string(*(uint64_t*)args_ptr)); break;
+        case grid::TypeT<int8_t>::Sig:
+          json.append(std::to_string(*(int8_t*)args_ptr)); break;
+        case grid::TypeT<int16_t>::Sig:
+          json.append(std::to_string(*(int16_t*)args_ptr)); break;
+        case grid::TypeT<int32_t>::Sig:
+          json.append(std::to_string(*(int32_t*)args_ptr)); break;
+        case grid::TypeT<int64_t>::Sig:
+          json.append(std::to_string(*(int64_t*)args_ptr)); break;
+        case grid::TypeT<bool>::Sig:
+          json.append(*(bool*)args_ptr ? "true" : "false"); break;
+        case grid::TypeT<float>::Sig:
+          AppendJSONNumber(json, *(float*)args_ptr); break;
+        case grid::TypeT<double>::Sig:
+          AppendJSONNumber(json, *(double*)args_ptr); break;
+        case grid::TypeT<long double>::Sig:
+          AppendJSONNumber(json, *(long double*)args_ptr); break;
+        case grid::TypeT<std::string>::Sig:
+          {
+            const std::string& str = *(std::string*)args_ptr;
+            GridStreamerAppendJSONString(json, str.data(), str.size());
+            break;
+          }
+        default:
+          return false;
+      }
+    }
+
+    args_ptr += count * size;
+  }
+  json.push_back(']');
+
+  return true;
+}
+
+
+// Helper function to serialize the arguments of an argument buffer to a
+// byte string. Strings are stored with their length, all other arguments
+// as they are stored in the argument buffer.
+void GridStreamerSerializeArguments(std::string& out,
+                                    const void* args_buf,
+                                    size_t args_sz,
+                                    const unsigned long* traits)
+{
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+
+  for (size_t i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (trait == grid::TypeT<std::string>::Sig)
+    {
+      const std::string& str = *(std::string*)args_ptr;
+      uint32_t len = str.size();
+      out.append((const char*)&len, sizeof(len));
+      out.append(str);
+    }
+    else
+      out.append((const char*)args_ptr, count * size);
+
+    args_ptr += count * size;
+  }
+}
+
+
+// ReleaseArguments is a helper function to release the string arguments of
+// the first nargs arguments in an argument buffer.
+static void
+ReleaseArguments(void* args_buf, const unsigned long* traits, size_t nargs)
+{
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+
+  for (size_t i = 1; i <= nargs; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (trait == grid::TypeT<std::string>::Sig)
+      ((std::string*)args_ptr)->~basic_string();
+
+    args_ptr += count * size;
+  }
+}
+
+
+// Helper function to construct empty string arguments in an argument buffer,
+// so it can be written with PyGridStreamerWriteArguments.
+void GridStreamerConstructArguments(void* args_buf,
+                                    size_t args_sz,
+                                    const unsigned long* traits)
+{
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+
+  for (size_t i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (trait == grid::TypeT<std::string>::Sig)
+      new ((std::string*)args_ptr) std::string();
+
+    args_ptr += count * size;
+  }
+}
+
+
+// Helper function to release string arguments constructed in an argument
+// buffer.
+void GridStreamerReleaseArguments(void* args_buf,
+                                  size_t args_sz,
+                                  const unsigned long* traits)
+{
+  ReleaseArguments(args_buf, traits, traits[0]);
+}
+
+
+// Helper function to deserialize arguments serialized with
+// GridStreamerSerializeArguments to an argument buffer. String arguments
+// are constructed in the buffer and need to be released with
+// GridStreamerReleaseArguments.
+bool GridStreamerDeserializeArguments(const char*& ptr,
+                                      const char* end,
+                                      void* args_buf,
+                                      size_t args_sz,
+                                      const unsigned long* traits)
+{
+  uintptr_t args_ptr = (uintptr_t) args_buf;
+  size_t i;
+
+  for (i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (trait == grid::TypeT<std::string>::Sig)
+    {
+      uint32_t len;
+      if (end - ptr < (ptrdiff_t) sizeof(len))
+        break;
+      memcpy(&len, ptr, sizeof(len));
+      if ((size_t)(end - ptr - sizeof(len)) < len)
+        break;
+      new ((std::string*)args_ptr) std::string(ptr + sizeof(len), len);
+      ptr += sizeof(len) + len;
+    }
+    else
+    {
+      if ((size_t)(end - ptr) < count * size)
+        break;
+      memcpy((void*)args_ptr, ptr, count * size);
+      ptr += count * size;
+    }
+
+    args_ptr += count * size;
+  }
+
+  if (i > traits[0])
+    return true;
+
+  // release the strings constructed so far
+  ReleaseArguments(args_buf, traits, i - 1);
+  return false;
+}
+
+
+
+// Helper function to match the positional and keyword arguments of a
+// METH_FASTCALL | METH_KEYWORDS call to a NULL terminated keyword list. The
+// first required arguments must be given, any missing arguments are NULL.
+// The values are borrowed references.
+bool GridStreamerParseArguments(PyObject* const* args,
+                                Py_ssize_t nargs,
+                                PyObject* kwnames,
+                                const char* const* kwlist,
+                                Py_ssize_t required,
+                                PyObject** values)
+{
+  Py_ssize_t count = 0;
+  while (kwlist[count] != NULL)
+    values[count++] = NULL;
+
+  if (nargs > count)
+  {
+    PyErr_Format(PyExc_TypeError,
+                 "takes at most %zd arguments (%zd given)", count, nargs);
+    return false;
+  }
+
+  for (Py_ssize_t i = 0; i < nargs; i++)
+    values[i] = args[i];
+
+  Py_ssize_t nkwargs = kwnames != NULL ? PyTuple_GET_SIZE(kwnames) : 0;
+  for (Py_ssize_t i = 0; i < nkwargs; i++)
+  {
+    PyObject* key = PyTuple_GET_ITEM(kwnames, i);
+    Py_ssize_t j = 0;
+    while (j < count && PyUnicode_CompareWithASCIIString(key, kwlist[j]) != 0)
+      j++;
+
+    if (j == count)
+    {
+      PyErr_Format(PyExc_TypeError,
+                   "'%U' is an invalid keyword argument", key);
+      return false;
+    }
+    if (values[j] != NULL)
+    {
+      PyErr_Format(PyExc_TypeError,
+                   "argument '%s' given by name and position", kwlist[j]);
+      return false;
+    }
+    values[j] = args[nargs + i];
+  }
+
+  for (Py_ssize_t i = 0; i < required; i++)
+  {
+    if (values[i] == NULL)
+    {
+      PyErr_Format(PyExc_TypeError,
+                   "missing required argument '%s'", kwlist[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
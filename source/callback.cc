@@ -15,6 +15,7 @@
 
 #include <algorithm>
 #include <cstdarg>
+#include <mutex>
 
 extern "C" {
 
@@ -48,9 +49,24 @@ PyCallbackInit(PyCallback* self)
 //
 static void PyCallbackDealloc(PyCallback* self)
 {
+  PyTypeObject* type = Py_TYPE(self);
+
+  // note: disconnecting waits for running callbacks, which need the GIL
+  Py_BEGIN_ALLOW_THREADS
+  self->slot.reset();
+  Py_END_ALLOW_THREADS
+
+  for (auto func : self->functions)
+    Py_DECREF(func);
+
   Py_XDECREF(self->name);
   self->callback.reset();
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  self->profile.reset();
+  self->memory.reset();
+  self->functions.~list();
+  self->lock.~mutex();
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -62,19 +78,20 @@ static void PyCallbackDealloc(PyCallback* self)
 static void OnClose(const grid::Slot& slot, uintptr_t context)
 {
   PyCallback* self = (PyCallback*) context;
-  self->callback.reset();
-  self->active = false;
-
-  PyGILState_STATE gstate;
-  gstate = PyGILState_Ensure();
+  std::list<PyObject*> functions;
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    self->callback.reset();
+    self->active = false;
+    functions.swap(self->functions);
+  }
 
-  for (std::list<PyObject*>::iterator it = self->functions.begin();
-       it != self->functions.end();
-       ++it)
-    Py_DECREF(*it);
+  if (functions.empty())
+    return;
 
-  self->functions.clear();
-  PyGILState_Release(gstate);
+  InterpreterLock lock(self->interp);
+  for (auto func : functions)
+    Py_DECREF(func);
 }
 
 
@@ -91,14 +108,55 @@ void OnCallback(uintptr_t context...)
   va_start(args, context);
 
   PyCallback* self = (PyCallback*) context;
+  self->received.fetch_add(1, std::memory_order_relaxed);
+  StatsCount(kStatsCallbackReceived);
+  TraceInstant("CallbackReceived");
+  ProfileScope profile(self->profile.get());
+
+  std::shared_ptr<grid::Callback> cb;
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    if (!self->functions.empty())
+      cb = self->callback;
+  }
+
+  if (cb == nullptr)
+  {
+    self->dropped.fetch_add(1, std::memory_order_relaxed);
+    StatsCount(kStatsCallbackDropped);
+    va_end(args);
+    return;
+  }
 
-  auto cb = self->callback;
   const unsigned long* traits = cb->Signature();
 
-  // -- start of Python GIL --
+  // note: the event holds its arguments until it is dispatched
+  ChannelMemory* memory = self->memory.get();
+  uint64_t bytes = 0;
+  for (size_t i = 1; memory != NULL && i <= traits[0]; i++)
+  {
+    unsigned int count = traits[i] >> grid::kCountShift;
+    bytes += std::max(count, 1U) * (1UL << (traits[i] & grid::kSizeMask));
+  }
+
+  if (memory != NULL && !memory->Reserve(bytes))
+  {
+    self->dropped.fetch_add(1, std::memory_order_relaxed);
+    StatsCount(kStatsCallbackDropped);
+    va_end(args);
+    return;
+  }
 
-  PyGILState_STATE gstate;
-  gstate = PyGILState_Ensure();
+  uint64_t start = StatsNow();
+
+  // -- start of Python GIL --
+  InterpreterLock lock(self->interp);
+  StatsRecord(kStatsGILWait, StatsNow() - start);
+  if (TraceEnabled())
+    TraceRecord('X', "GILWait", start, StatsNow() - start, NULL);
+  TraceSpan span("Callback", PyUnicode_AsUTF8(self->name));
+  profile.Dispatch();
+  std::list<PyObject*> functions;
 
   PyObject* tuple = PyTuple_New(traits[0]);
 
@@ -157,23 +215,43 @@ void OnCallback(uintptr_t context...)
     }
 
     if (item == NULL)
+    {
+      PyErr_Print();
+      self->dropped.fetch_add(1, std::memory_order_relaxed);
+      StatsCount(kStatsCallbackDropped);
       goto out;
+    }
 
     PyTuple_SET_ITEM(tuple, i - 1, item);
   }
 
-  for (auto& func : self->functions)
-    if (PyObject_CallObject(func, tuple))
+  // note: functions can be connected or disconnected while they are called
+  {
+    std::lock_guard<std::mutex> functions_lock(self->lock);
+    functions = self->functions;
+    for (auto func : functions)
+      Py_INCREF(func);
+  }
+
+  for (auto func : functions)
+  {
+    start = StatsNow();
+    if (!PyObject_CallObject(func, tuple))
       PyErr_Print();
+    StatsRecord(kStatsHandler, StatsNow() - start);
+    Py_DECREF(func);
+  }
+
+  self->dispatched.fetch_add(1, std::memory_order_relaxed);
+  StatsCount(kStatsCallbackDispatched);
 
 out:
   Py_XDECREF(tuple);
-
-  PyGILState_Release(gstate);
+  va_end(args);
+  if (memory != NULL)
+    memory->Release(bytes);
 
   // -- end of Python GIL --
-
-  va_end(args);
 }
 
 
@@ -188,18 +266,30 @@ static PyObject* PyCallbackConnect(PyCallback* self, PyObject* func)
     return NULL;
   }
 
-  if (!self->active)
+  std::shared_ptr<grid::Callback> callback;
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    if (self->active)
+    {
+      Py_INCREF(func);
+      self->functions.push_back(func);
+      callback = self->callback;
+    }
+  }
+
+  if (callback == nullptr)
   {
     PyErr_SetString(PyExc_AttributeError, "Callback closed");
     return NULL;
   }
 
+  // note: connecting waits for running callbacks, which need the GIL
   // TODO: move to initialization
-  if (self->slot == nullptr)
-    self->slot = self->callback->Connect(OnCallback, OnClose, (uintptr_t)self);
-
-  Py_INCREF(func);
-  self->functions.push_back(func);
+  Py_BEGIN_ALLOW_THREADS
+  std::call_once(self->connected, [&]() {
+      self->slot = callback->Connect(OnCallback, OnClose, (uintptr_t)self);
+  });
+  Py_END_ALLOW_THREADS
 
   Py_RETURN_TRUE;
 }
@@ -209,28 +299,48 @@ static PyObject* PyCallbackConnect(PyCallback* self, PyObject* func)
 // PyCallbackDisconnect disconnects the specified :
 //
 
-static int PyCallbackDisconnect(PyCallback* self, PyObject* func)
+static PyObject* PyCallbackDisconnect(PyCallback* self, PyObject* func)
 {
   if (!PyCallable_Check(func))
   {
     PyErr_SetString(PyExc_AttributeError, "Invalid arguments");
-    return 0;
+    return NULL;
   }
 
-  auto funcs = self->functions;
-  auto it = std::find(funcs.begin(), funcs.end(), func);
-  if (it != funcs.end())
+  PyObject* function = NULL;
   {
-    Py_DECREF(*it);
-    funcs.erase(it);
+    std::lock_guard<std::mutex> lock(self->lock);
+
+    auto& funcs = self->functions;
+    auto it = std::find(funcs.begin(), funcs.end(), func);
+    if (it != funcs.end())
+    {
+      function = *it;
+      funcs.erase(it);
+    }
   }
-  else
+
+  if (function == NULL)
   {
     PyErr_SetString(PyExc_AttributeError,"function not registered");
-    return 0;
+    return NULL;
   }
 
-  return 1;
+  Py_DECREF(function);
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyCallbackStatsGet returns the number of events received by the callback,
+// and how many of them were dispatched to functions or dropped.
+//
+static PyObject* PyCallbackStatsGet(PyCallback* self)
+{
+  return Py_BuildValue("{sKsKsK}",
+      "received", (unsigned long long) self->received.load(),
+      "dispatched", (unsigned long long) self->dispatched.load(),
+      "dropped", (unsigned long long) self->dropped.load());
 }
 
 
@@ -260,11 +370,22 @@ static PyObject* PyCallbackValueGet(PyCallback* self)
 }
 
 
+#endif
+
+
 //
 // Define callback attributes
 //
 static PyGetSetDef pycallback_getsets[] =
 {
+  {
+    "stats",
+    (getter) PyCallbackStatsGet,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+#if 0
   {
     "value",
     (getter) PyCallbackValueGet,
@@ -272,11 +393,11 @@ static PyGetSetDef pycallback_getsets[] =
     NULL,
     NULL
   },
+#endif
   {
     NULL  /* Sentinel */
   }
 };
-#endif
 
 
 static PyMethodDef pycallback_methods[] =
@@ -299,26 +420,30 @@ static PyMethodDef pycallback_methods[] =
 }; 
 
 
+static PyType_Slot pycallback_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyCallbackDealloc },
+  { Py_tp_repr, (void*) PyCallbackStr },
+  { Py_tp_str, (void*) PyCallbackStr },
+  { Py_tp_doc, (void*) PyDoc_STR("Callback describe a callback") },
+  { Py_tp_getset, pycallback_getsets },
+  { Py_tp_methods, pycallback_methods },
+  { Py_tp_init, (void*) PyCallbackInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
 //
 // Define the PyCallback type
 //
-PyTypeObject pycallback_type =
+PyType_Spec pycallback_spec =
 {
-  PyVarObject_HEAD_INIT(NULL, 0)
-  .tp_name = "gridstreamer.Callback",
-  .tp_basicsize = sizeof(PyCallback),
-  .tp_itemsize = 0,
-  .tp_dealloc = (destructor) PyCallbackDealloc,
-  .tp_repr = (reprfunc) PyCallbackStr,
-  .tp_str = (reprfunc) PyCallbackStr,
-  .tp_flags = Py_TPFLAGS_DEFAULT,
-  .tp_doc = PyDoc_STR("Callback describe a callback"),
-#if 0
-  .tp_getset = pycallback_getsets,
-#endif
-  .tp_methods = pycallback_methods,
-  .tp_init = (initproc) PyCallbackInit,
-  .tp_new = PyType_GenericNew,
+  .name = "gridstreamer.Callback",
+  .basicsize = sizeof(PyCallback),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pycallback_slots,
 };
 
 
@@ -0,0 +1,224 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+#include "pygridstreamer.h"
+
+#include <grid/fw/parameter.h>
+
+#include <Python.h>
+
+
+//
+// CheckType is a helper function to check that the object is an instance of
+// a type of the module.
+//
+static bool CheckType(PyObject* obj,
+                      PyTypeObject* GridStreamerState::*type,
+                      const char* name)
+{
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(obj));
+  if (state == NULL || !PyObject_TypeCheck(obj, state->*type))
+  {
+    PyErr_Clear();
+    PyErr_Format(PyExc_TypeError, "Expected a %s", name);
+    return false;
+  }
+  return true;
+}
+
+
+static bool GetGrid(PyObject* obj, std::shared_ptr<grid::Grid>* out)
+{
+  if (!CheckType(obj, &GridStreamerState::grid_type, "grid"))
+    return false;
+
+  *out = ((PyGrid*) obj)->grid;
+  return true;
+}
+
+
+static bool GetChannel(PyObject* obj, std::shared_ptr<grid::Channel>* out)
+{
+  if (!CheckType(obj, &GridStreamerState::channel_type, "channel"))
+    return false;
+
+  *out = ((PyChannel*) obj)->channel;
+  return true;
+}
+
+
+static bool GetCell(PyObject* obj, std::shared_ptr<grid::Cell>* out)
+{
+  if (!CheckType(obj, &GridStreamerState::cell_type, "cell"))
+    return false;
+
+  *out = ((PyCell*) obj)->cell;
+  return true;
+}
+
+
+static bool GetParameter(PyObject* obj, std::shared_ptr<grid::Parameter>* out)
+{
+  if (!CheckType(obj, &GridStreamerState::parameter_type, "parameter"))
+    return false;
+
+  *out = ((PyParameter*) obj)->parameter;
+  return true;
+}
+
+
+static bool GetCallback(PyObject* obj, std::shared_ptr<grid::Callback>* out)
+{
+  if (!CheckType(obj, &GridStreamerState::callback_type, "callback"))
+    return false;
+
+  PyCallback* pycallback = (PyCallback*) obj;
+  std::lock_guard<std::mutex> lock(pycallback->lock);
+  if (pycallback->callback == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "Callback closed");
+    return false;
+  }
+
+  *out = pycallback->callback;
+  return true;
+}
+
+
+//
+// FindChannelContext is a helper function to return the context of a channel
+// that has a layout.
+//
+static ChannelContext* FindChannelContext(PyObject* obj)
+{
+  if (!CheckType(obj, &GridStreamerState::channel_type, "channel"))
+    return NULL;
+
+  ChannelContext* context = ((PyChannel*) obj)->context.get();
+  if (context == NULL)
+    PyErr_SetString(PyExc_AttributeError, "Channel has no layout");
+  return context;
+}
+
+
+static bool FindCellByPath(PyObject* obj,
+                           const char* path,
+                           std::shared_ptr<grid::Cell>* out)
+{
+  ChannelContext* context = FindChannelContext(obj);
+  if (context == NULL)
+    return false;
+
+  *out = FindCell(*context, path);
+  if (*out == nullptr)
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", path);
+    return false;
+  }
+  return true;
+}
+
+
+static bool FindParameterByPath(PyObject* obj,
+                                const char* path,
+                                std::shared_ptr<grid::Parameter>* out)
+{
+  ChannelContext* context = FindChannelContext(obj);
+  if (context == NULL)
+    return false;
+
+  *out = FindParameter(*context, path);
+  if (*out == nullptr)
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", path);
+    return false;
+  }
+  return true;
+}
+
+
+static bool SetParameter(grid::Parameter* param, void* args_buf, size_t args_sz)
+{
+  if (!param->CallUnsafe(NULL, 0, args_buf, args_sz))
+    return false;
+
+  ParameterChanged(param);
+  return true;
+}
+
+
+//
+// WriteArguments returns false with an exception set if the arguments can't
+// be converted.
+//
+static bool WriteArguments(PyObject* args,
+                           void* args_buf,
+                           size_t args_sz,
+                           const unsigned long* traits)
+{
+  return PyGridStreamerWriteArguments(args, args_buf, args_sz, traits) == 1;
+}
+
+
+static PyGridStreamer_LatencyStage* GetLatencyStage(PyObject* obj,
+                                                    const char* name)
+{
+  ChannelContext* context = FindChannelContext(obj);
+  if (context == NULL)
+    return NULL;
+
+  return (PyGridStreamer_LatencyStage*) context->latency.GetStage(name);
+}
+
+
+static void RecordLatency(PyGridStreamer_LatencyStage* pystage,
+                          unsigned long long ns)
+{
+  LatencyStage* stage = (LatencyStage*) pystage;
+  stage->monitor->Record(*stage, ns);
+}
+
+
+static const PyGridStreamer_CAPI pygridstreamer_capi =
+{
+  .version = PYGRIDSTREAMER_API_VERSION,
+  .GetGrid = GetGrid,
+  .GetChannel = GetChannel,
+  .GetCell = GetCell,
+  .GetParameter = GetParameter,
+  .GetCallback = GetCallback,
+  .FindCell = FindCellByPath,
+  .FindParameter = FindParameterByPath,
+  .SetParameter = SetParameter,
+  .ParameterChanged = ParameterChanged,
+  .ReadArguments = PyGridStreamerReadArguments,
+  .WriteArguments = WriteArguments,
+  .WriteNumber = GridStreamerWriteNumber,
+  .GetLatencyStage = GetLatencyStage,
+  .RecordLatency = RecordLatency,
+};
+
+
+//
+// GridStreamerAddCAPI adds the C API capsule to the module.
+//
+bool GridStreamerAddCAPI(PyObject* module)
+{
+  PyObject* capsule = PyCapsule_New((void*) &pygridstreamer_capi,
+                                    PYGRIDSTREAMER_CAPSULE_NAME, NULL);
+  if (capsule == NULL)
+    return false;
+
+  if (PyModule_AddObject(module, "_C_API", capsule) != 0)
+  {
+    Py_DECREF(capsule);
+    return false;
+  }
+  return true;
+}
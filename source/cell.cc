@@ -13,6 +13,7 @@
 #include <grid/fw/pipeline.h>
 
 #include <Python.h>
+#include <structmember.h>
 
 extern "C" {
 
@@ -23,21 +24,22 @@ static bool PyCellAddParameters(PyCell* self)
 {
   bool ret = true;
   auto& params = self->cell->GetParameters();
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
 
   PyObject* dict = PyObject_GenericGetDict((PyObject*)self, NULL);
   for (auto param_it = params.Begin();
        ret && param_it != params.End();
        ++param_it)
   {
-    PyParameter* pyparameter =
-      (PyParameter*) PyType_GenericAlloc(&pyparameter_type, 0);
-
-    pyparameter->parameter = *param_it;
-
     std::string key = PythonifyName(param_it.Key());
-    pyparameter->name = PyUnicode_FromString(key.c_str());
-
-    ret = PyDict_SetItemString(dict, key.c_str(), (PyObject*) pyparameter) == 0;
+    PyParameter* pyparameter = PyParameterCreate(state, key, *param_it);
+    if (pyparameter == NULL)
+      ret = false;
+    else
+    {
+      ret = PyDict_SetItemString(dict, key.c_str(), (PyObject*) pyparameter) == 0;
+      Py_DECREF(pyparameter);
+    }
   }
 
   Py_DECREF(dict);
@@ -52,21 +54,34 @@ static bool PyCellAddCallbacks(PyCell* self)
 {
   bool ret = true;
   auto& callbacks = self->cell->GetCallbacks();
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
 
   PyObject* dict = PyObject_GenericGetDict((PyObject*)self, NULL);
   for (auto cb_it = callbacks.Begin(); ret && cb_it != callbacks.End(); ++cb_it)
   {
     PyCallback* pycallback =
-      (PyCallback*) PyType_GenericAlloc(&pycallback_type, 0);
+      (PyCallback*) PyType_GenericAlloc(state->callback_type, 0);
+    if (pycallback == NULL)
+    {
+      ret = false;
+      break;
+    }
+
+    new (&pycallback->connected) std::once_flag();
+    new (&pycallback->lock) std::mutex();
+    new (&pycallback->functions) std::list<PyObject*>();
 
     std::string key = std::string("on_") + PythonifyName(cb_it.Key());
     pycallback->name = PyUnicode_FromString(key.c_str());
 
     pycallback->callback = *cb_it;
+    pycallback->profile = GetCellProfile(self->cell);
+    pycallback->memory = FindCellMemory(self->cell);
     pycallback->active = true;
-    new (&pycallback->functions) std::list<PyObject*>();
+    pycallback->interp = PyInterpreterState_Get();
 
     ret = PyDict_SetItemString(dict, key.c_str(), (PyObject*) pycallback) == 0;
+    Py_DECREF(pycallback);
   }
 
   Py_DECREF(dict);
@@ -74,6 +89,32 @@ static bool PyCellAddCallbacks(PyCell* self)
 }
 
 
+//
+// PyCellCreate creates a new PyCell for the grid cell including its parameters
+// and callbacks.
+//
+PyCell* PyCellCreate(GridStreamerState* state,
+                     const std::string& name,
+                     const std::shared_ptr<grid::Cell>& cell)
+{
+  PyCell* pycell = (PyCell*) PyType_GenericAlloc(state->cell_type, 0);
+  if (pycell == NULL)
+    return NULL;
+
+  pycell->cell = cell;
+  pycell->name = PyUnicode_FromString(name.c_str());
+  pycell->type = PyUnicode_FromString(cell->Type().c_str());
+
+  if (!PyCellAddParameters(pycell) || !PyCellAddCallbacks(pycell))
+  {
+    Py_DECREF(pycell);
+    return NULL;
+  }
+
+  return pycell;
+}
+
+
 //
 // PyCellStr implements __str__ and returns the registered name of the Cell.
 //
@@ -102,9 +143,12 @@ PyCellInit(PyCell* self, PyObject* args, PyObject* kwargs)
 //
 static void PyCellDealloc(PyCell* self)
 {
+  PyTypeObject* type = Py_TYPE(self);
+
   Py_XDECREF(self->name);
   self->cell.reset();
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -153,30 +197,22 @@ PyObject* PyCellGetCells(PyCell* self)
   grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
     pipeline->GetCells() : cluster->GetCells();
 
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
   PyObject* dict = PyDict_New();
 
   for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
   {
-    PyCell* pycell = (PyCell*) PyType_GenericAlloc(&pycell_type, 0);
-    pycell->cell = *cell_it;
-
-    pycell->name = PyUnicode_FromString(cell_it.Key().c_str());
-    pycell->type = PyUnicode_FromString(cell_it->Type().c_str());
-
-    if (!PyCellAddParameters(pycell))
-    {
-      Py_DECREF(dict);
-      return NULL;
-    }
-
-    if (!PyCellAddCallbacks(pycell))
+    PyCell* pycell = PyCellCreate(state, cell_it.Key(), *cell_it);
+    if (pycell == NULL)
     {
       Py_DECREF(dict);
       return NULL;
     }
 
     const char* key = cell_it.Key().c_str();
-    if (PyDict_SetItemString(dict, key, (PyObject*) pycell) != 0)
+    int ret = PyDict_SetItemString(dict, key, (PyObject*) pycell);
+    Py_DECREF(pycell);
+    if (ret != 0)
     {
       Py_DECREF(dict);
       return NULL;
@@ -186,6 +222,43 @@ PyObject* PyCellGetCells(PyCell* self)
 }
 
 
+//
+// PyCellProfile returns the profiles of the cell and, for pipelines and
+// clusters, of the cells they contain as a list, optionally resetting them.
+//
+static PyObject* PyCellProfile(PyCell* self,
+                               PyObject* const* args,
+                               Py_ssize_t nargs,
+                               PyObject* kwnames)
+{
+  PyObject* pyreset;
+
+  static const char* kwlist[] = { "reset", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyreset))
+    return NULL;
+
+  if (self->cell == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "cell");
+    return NULL;
+  }
+
+  int reset = pyreset != NULL ? PyObject_IsTrue(pyreset) : 0;
+  if (reset < 0)
+    return NULL;
+
+  const char* name = PyUnicode_AsUTF8(self->name);
+  if (name == NULL)
+    return NULL;
+
+  PyObject* list = PyList_New(0);
+  if (list != NULL && !GridStreamerCellProfiles(list, name, self->cell, reset))
+    Py_CLEAR(list);
+
+  return list;
+}
+
+
 //
 // PyCellGetParameters returns a list of all parameters of the cell.
 //
@@ -221,6 +294,12 @@ static PyMethodDef pycell_methods[] =
     METH_NOARGS,
     "Return the cells of a pipeline or cluster"
   },
+  {
+    "profile",
+    (PyCFunction)(void(*)(void)) PyCellProfile,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the profiles of the cell and the cells it contains"
+  },
   {
     // TODO: move to member?
     "parameters",
@@ -234,22 +313,43 @@ static PyMethodDef pycell_methods[] =
 };
 
 
-PyTypeObject pycell_type =
+// note: heap types set the offset of the instance dictionary with a member
+static PyMemberDef pycell_members[] =
+{
+  {
+    "__dictoffset__",
+    T_PYSSIZET, offsetof(PyCell, dict),
+    READONLY,
+    NULL
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyType_Slot pycell_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyCellDealloc },
+  { Py_tp_repr, (void*) PyCellStr },
+  { Py_tp_str, (void*) PyCellStr },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "Cell is the basic unit describing a Cell, Cluster, or Pipeline") },
+  { Py_tp_methods, pycell_methods },
+  { Py_tp_members, pycell_members },
+  { Py_tp_init, (void*) PyCellInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
+PyType_Spec pycell_spec =
 {
-  PyVarObject_HEAD_INIT(NULL, 0)
-  .tp_name = "gridstreamer.Cell",
-  .tp_basicsize = sizeof(PyCell),
-  .tp_itemsize = 0,
-  .tp_dealloc = (destructor) PyCellDealloc,
-  .tp_repr = (reprfunc) PyCellStr,
-  .tp_str = (reprfunc) PyCellStr,
-  .tp_flags = Py_TPFLAGS_DEFAULT,
-  .tp_dictoffset = offsetof(PyCell,dict),
-  .tp_doc = PyDoc_STR(
-      "Cell is the basic unit describing a Cell, Cluster, or Pipeline"),
-  .tp_methods = pycell_methods,
-  .tp_init = (initproc) PyCellInit,
-  .tp_new = PyType_GenericNew,
+  .name = "gridstreamer.Cell",
+  .basicsize = sizeof(PyCell),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pycell_slots,
 };
 
 
@@ -9,218 +9,1475 @@
 #include "gridmodule.h"
 
 #include <grid/builder/builder.h>
+#include <grid/fw/cluster.h>
 #include <grid/fw/pipeline.h>
 
 #include <Python.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//
+// GridStreamerStateName returns the name of the state.
+//
+const char* GridStreamerStateName(grid::State state)
+{
+  if (state == grid::kStateInvalid)
+    return "invalid";
+  else if (state == grid::kStateNull)
+    return "null";
+  else if (state == grid::kStateReady)
+    return "ready";
+  else if (state == grid::kStateSet)
+    return "set";
+  else if (state == grid::kStateFlushing)
+    return "flushing";
+  else if (state == grid::kStateRunning)
+    return "running";
+  else if (state == grid::kStatePaused)
+    return "paused";
+  else if (state == grid::kStateEnd)
+    return "end";
+  else if (state == grid::kStateError)
+    return "error";
+
+  return "unknown";
+}
+
+
+//
+// GridStreamerStateFromName returns the state for the name of a state that
+// can be set, or kStateInvalid.
+//
+grid::State GridStreamerStateFromName(const char* name)
+{
+  if (!strcmp(name, "null"))
+    return grid::kStateNull;
+  else if (!strcmp(name, "ready"))
+    return grid::kStateReady;
+  else if (!strcmp(name, "set"))
+    return grid::kStateSet;
+  else if (!strcmp(name, "flushing"))
+    return grid::kStateFlushing;
+  else if (!strcmp(name, "running"))
+    return grid::kStateRunning;
+  else if (!strcmp(name, "paused"))
+    return grid::kStatePaused;
+
+  return grid::kStateInvalid;
+}
+
+
+//
+// IndexCells is a helper function to add a cell, its parameters, and any
+// cells of a pipeline or cluster to the index of the channel.
+//
+static void IndexCells(ChannelContext& context,
+                       const std::string& path,
+                       const std::shared_ptr<grid::Cell>& cell)
+{
+  context.cells[path] = cell;
+
+  auto& params = cell->GetParameters();
+  for (auto param_it = params.Begin(); param_it != params.End(); ++param_it)
+  {
+    context.parameters[path + '.' + param_it.Key()] = *param_it;
+    context.parameters[path + '.' + PythonifyName(param_it.Key())] = *param_it;
+  }
+
+  grid::Cluster*  cluster =  cell->ClusterInterface();
+  grid::Pipeline* pipeline = cell->PipelineInterface();
+  if (cluster == nullptr && pipeline == nullptr)
+    return;
+
+  grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
+    pipeline->GetCells() : cluster->GetCells();
+
+  for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
+    IndexCells(context, path + '/' + cell_it.Key(), *cell_it);
+}
+
+
+//
+// IndexChannel builds the index of all cells and parameters of the channel.
+// The context must be locked.
+//
+static void IndexChannel(ChannelContext& context)
+{
+  if (context.indexed)
+    return;
+
+  grid::Registry<grid::Pipeline>& pipelines = context.channel->GetPipelines();
+  for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+    IndexCells(context, pipe_it.Key(), *pipe_it);
+
+  context.indexed = true;
+}
+
+
+//
+// ClearIndex is a helper function to drop the index of the channel.
+//
+static void ClearIndex(ChannelContext& context)
+{
+  context.cells.clear();
+  context.parameters.clear();
+  context.indexed = false;
+}
+
+
+void SetChannelLayout(ChannelContext& context,
+                      const std::shared_ptr<grid::Layout>& layout,
+                      const std::string& text)
+{
+  std::lock_guard<std::mutex> lock(context.lock);
+  context.layout = layout;
+  context.text = text;
+  ClearIndex(context);
+  RegisterChannelMemory(context);
+}
+
+
+std::shared_ptr<grid::Layout>
+GetChannelLayout(ChannelContext& context, std::string* text)
+{
+  std::lock_guard<std::mutex> lock(context.lock);
+  if (text != NULL)
+    *text = context.text;
+  return context.layout;
+}
+
+
+std::shared_ptr<grid::Cell>
+FindCell(ChannelContext& context, const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(context.lock);
+  IndexChannel(context);
+  auto it = context.cells.find(path);
+  return it != context.cells.end() ? it->second : nullptr;
+}
+
+
+std::shared_ptr<grid::Parameter>
+FindParameter(ChannelContext& context, const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(context.lock);
+  IndexChannel(context);
+  auto it = context.parameters.find(path);
+  return it != context.parameters.end() ? it->second : nullptr;
+}
+
+
+//
+// RecordChannelStats records the duration of compiling the channel or setting
+// its state.
+//
+void
+RecordChannelStats(ChannelContext& context, StatsTimer timer, uint64_t start)
+{
+  uint64_t ns = StatsNow() - start;
+  StatsRecord(timer, ns);
+  if (timer == kStatsCompile)
+    context.compile_stats.Add(ns);
+  else
+    context.state_stats.Add(ns);
+}
+
+
+//
+// SetChannelState is a helper function to set the state of the channel, or
+// only if the channel is in the current state, and record the duration. The
+// GIL is released, because stopping the threads of the channel waits for
+// callbacks that acquire it.
+//
+static bool SetChannelState(PyChannel* self,
+                            grid::State state,
+                            grid::State curr = grid::kStateInvalid)
+{
+  std::string detail =
+    TraceStateDetail(PyUnicode_AsUTF8(self->name), *self->channel, state);
+  TraceSpan span("SetState", detail.c_str());
+
+  auto channel = self->channel;
+  auto context = self->context;
+  uint64_t start = StatsNow();
+  bool ret;
+
+  Py_BEGIN_ALLOW_THREADS
+  if (context == nullptr)
+    ret = curr == grid::kStateInvalid ?
+      channel->SetState(state) : channel->SetStateCond(curr, state);
+  else
+  {
+    PlacementScope placement(context->placement);
+    MemoryScope memory(*context->memory);
+    ret = curr == grid::kStateInvalid ?
+      channel->SetState(state) : channel->SetStateCond(curr, state);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (context != nullptr)
+    RecordChannelStats(*context, kStatsSetState, start);
+  return ret;
+}
+
+
 extern "C" {
 
 //
-// PyChannelCompile compiles a new layout to the channel releasing any current
-// layout.
+// PyChannelCompile compiles a new layout to the channel releasing any current
+// layout. The channel is left unchanged if the layout is the same as the
+// committed layout.
+//
+PyObject* PyChannelCompile(PyChannel* self, PyObject* pylayout)
+{
+  auto& channel = self->channel;
+  auto& context = self->context;
+  if (channel == NULL || context == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  Py_ssize_t len;
+  const char* text = PyUnicode_AsUTF8AndSize(pylayout, &len);
+  if (text == NULL)
+    return NULL;
+
+  uint64_t start = StatsNow();
+  grid::Builder builder;
+  std::string err;
+  std::shared_ptr<grid::Layout> layout;
+
+  Py_BEGIN_ALLOW_THREADS
+  layout = CompileLayout(std::string(text, len), err);
+  Py_END_ALLOW_THREADS
+
+  if (layout == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, err.c_str());
+    return NULL;
+  }
+
+  // note: compiled layouts are cached, so the same layout is the same object
+  if (layout == GetChannelLayout(*context))
+  {
+    RecordChannelStats(*context, kStatsCompile, start);
+    Py_RETURN_TRUE;
+  }
+
+  PyGrid* grid = (PyGrid*)self->grid;
+  const char* name = PyUnicode_AsUTF8(self->name);
+  bool updated = false;
+  bool committed = false;
+
+  Py_BEGIN_ALLOW_THREADS
+  {
+    std::lock_guard<std::mutex> lock(grid->context->lock);
+    PlacementScope placement(context->placement);
+    MemoryScope memory(*context->memory);
+
+    channel->CreateLayout();
+    {
+      TraceSpan span("UpdateChannel", name);
+      updated = builder.UpdateChannel(*grid->grid, *channel, *layout);
+    }
+    if (updated)
+    {
+      TraceSpan span("CommitLayout", name);
+      committed = channel->CommitLayout();
+    }
+    if (!committed)
+      channel->AbortLayout();
+  }
+  Py_END_ALLOW_THREADS
+
+  if (!updated)
+  {
+    // TODO: get error text from builder (not implemented yet)
+    PyErr_SetString(PyExc_SyntaxError, "layout format");
+    return NULL;
+  }
+
+  if (!committed)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Failed to commit layout");
+    return NULL;
+  }
+
+  SetChannelLayout(*context, layout, std::string(text, len));
+  RecordChannelStats(*context, kStatsCompile, start);
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyChannelGetLayout returns the committed layout of the channel.
+//
+static PyObject* PyChannelGetLayout(PyChannel* self)
+{
+  auto& context = self->context;
+  if (context == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  std::string text;
+  if (GetChannelLayout(*context, &text) == nullptr)
+    Py_RETURN_NONE;
+
+  return PyUnicode_FromStringAndSize(text.data(), text.size());
+}
+
+
+//
+// PyChannelGetCells returns a list of cells in the channel.
+// These could be pipelines or cells.
+//
+static PyObject* PyChannelGetCells(PyChannel* self)
+{
+  auto channel = self->channel;
+  if (channel == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  PyObject* dict = PyDict_New();
+  if (dict == NULL)
+    return NULL;
+
+  grid::Registry<grid::Pipeline>& pipelines = channel->GetPipelines();
+  for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+  {
+    PyCell* pycell = PyCellCreate(state, pipe_it.Key(), *pipe_it);
+    if (pycell == NULL)
+    {
+      Py_DECREF(dict);
+      return NULL;
+    }
+
+    const char* key = pipe_it.Key().c_str();
+    int ret = PyDict_SetItemString(dict, key, (PyObject*) pycell);
+    Py_DECREF(pycell);
+    if (ret != 0)
+    {
+      Py_DECREF(dict);
+      return NULL;
+    }
+  }
+
+  return dict;
+}
+
+
+//
+// PyChannelProfile returns the profiles of all cells of the channel as a list
+// of rows, optionally resetting them.
+//
+static PyObject* PyChannelProfile(PyChannel* self,
+                                  PyObject* const* args,
+                                  Py_ssize_t nargs,
+                                  PyObject* kwnames)
+{
+  PyObject* pyreset;
+
+  static const char* kwlist[] = { "reset", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyreset))
+    return NULL;
+
+  auto channel = self->channel;
+  if (channel == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  int reset = pyreset != NULL ? PyObject_IsTrue(pyreset) : 0;
+  if (reset < 0)
+    return NULL;
+
+  PyObject* list = PyList_New(0);
+  if (list == NULL)
+    return NULL;
+
+  grid::Registry<grid::Pipeline>& pipelines = channel->GetPipelines();
+  for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+  {
+    if (!GridStreamerCellProfiles(list, pipe_it.Key(), *pipe_it, reset))
+    {
+      Py_DECREF(list);
+      return NULL;
+    }
+  }
+
+  // note: the rows include the channel, so tables of channels can be joined
+  for (Py_ssize_t i = 0; i < PyList_GET_SIZE(list); i++)
+  {
+    if (PyDict_SetItemString(PyList_GET_ITEM(list, i), "channel",
+                             self->name) != 0)
+    {
+      Py_DECREF(list);
+      return NULL;
+    }
+  }
+
+  return list;
+}
+
+
+//
+// PyChannelLookup returns the cell ("pipeline/cell") or parameter
+// ("pipeline/cell.parameter") for the path or NULL with KeyError set.
+//
+PyObject* PyChannelLookup(PyChannel* self, const char* path)
+{
+  auto& context = self->context;
+  if (context == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  auto param = FindParameter(*context, path);
+  if (param != nullptr)
+  {
+    const char* name = strrchr(path, '.') + 1;
+    return (PyObject*) PyParameterCreate(state, name, param);
+  }
+
+  auto cell = FindCell(*context, path);
+  if (cell != nullptr)
+  {
+    const char* name = strrchr(path, '/');
+    return (PyObject*) PyCellCreate(state, name ? name + 1 : path, cell);
+  }
+
+  PyErr_Format(PyExc_KeyError, "'%s'", path);
+  return NULL;
+}
+
+
+//
+// PyChannelLookupPath implements lookup(path)
+//
+static PyObject* PyChannelLookupPath(PyChannel* self, PyObject* pypath)
+{
+  const char* path = PyUnicode_AsUTF8(pypath);
+  if (path == NULL)
+    return NULL;
+
+  return PyChannelLookup(self, path);
+}
+
+
+//
+// PyChannelApply sets multiple parameters of the channel as a single
+// transaction. All values are converted before any parameter is changed,
+// and the previous values are restored if setting any parameter fails.
+//
+static PyObject* PyChannelApply(PyChannel* self, PyObject* values)
+{
+  auto& context = self->context;
+  if (context == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  if (!PyDict_Check(values))
+  {
+    PyErr_SetString(PyExc_TypeError, "Expected a dictionary of parameters");
+    return NULL;
+  }
+
+  // Entry describes a single parameter change; scan is set for values that
+  // are passed as a formatted string. The string arguments of the args and
+  // prev buffers are constructed and released with the entry.
+  struct Entry
+  {
+    std::shared_ptr<grid::Parameter>  parameter;
+    std::vector<char>                 args;
+    std::vector<char>                 prev;
+    std::string                       scan;
+  };
+  std::vector<Entry> entries;
+  entries.reserve(PyDict_Size(values));
+
+  bool ret = true;
+  PyObject* key;
+  PyObject* value;
+  Py_ssize_t pos = 0;
+  while (ret && PyDict_Next(values, &pos, &key, &value))
+  {
+    const char* path = PyUnicode_AsUTF8(key);
+    if (path == NULL)
+    {
+      ret = false;
+      break;
+    }
+
+    auto param = FindParameter(*context, path);
+    if (param == nullptr)
+    {
+      PyErr_Format(PyExc_AttributeError, "Invalid parameter '%s'", path);
+      ret = false;
+      break;
+    }
+
+    size_t arg_buf_sz = param->GetArgumentBufferSize();
+    std::vector<char> prev(arg_buf_sz);
+    if (!param->GetValues(prev.data(), arg_buf_sz))
+    {
+      PyErr_Format(PyExc_TypeError, "Failed to get parameter '%s'", path);
+      ret = false;
+      break;
+    }
+
+    entries.emplace_back();
+    Entry& entry = entries.back();
+    entry.parameter = param;
+    entry.prev = std::move(prev);
+
+    const unsigned long* traits = param->GetSignature();
+    if (PyUnicode_Check(value) && traits[0] > 1)
+    {
+      Py_ssize_t len;
+      const char* str = PyUnicode_AsUTF8AndSize(value, &len);
+      if (str == NULL)
+        ret = false;
+      else
+        entry.scan = std::string(str, len);
+      continue;
+    }
+
+    entry.args.resize(arg_buf_sz);
+    GridStreamerConstructArguments(entry.args.data(), arg_buf_sz, traits);
+    ret = PyGridStreamerWriteArguments(value, entry.args.data(), arg_buf_sz,
+                                       traits);
+  }
+
+  // apply all changes without holding the GIL; callbacks triggered by the
+  // parameter changes can acquire it
+  size_t count = 0;
+  bool reverted = true;
+  if (ret)
+  {
+    Py_BEGIN_ALLOW_THREADS
+    for (; count < entries.size(); count++)
+    {
+      Entry& entry = entries[count];
+      bool set = entry.args.empty() ?
+        entry.parameter->Scan(entry.scan) :
+        entry.parameter->CallUnsafe(NULL, 0,
+                                    entry.args.data(), entry.args.size());
+      if (!set)
+        break;
+    }
+
+    if (count != entries.size())
+      for (size_t i = count; i-- > 0; )
+        reverted &= entries[i].parameter->CallUnsafe(NULL, 0,
+                                                     entries[i].prev.data(),
+                                                     entries[i].prev.size());
+    Py_END_ALLOW_THREADS
+
+    if (count != entries.size())
+    {
+      if (reverted)
+        PyErr_SetString(PyExc_TypeError, "Failed to set parameter, reverted");
+      else
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Failed to set parameter and to revert the changes");
+      ret = false;
+    }
+  }
+
+  for (auto& entry : entries)
+  {
+    const unsigned long* traits = entry.parameter->GetSignature();
+    GridStreamerReleaseArguments(entry.prev.data(), entry.prev.size(), traits);
+    if (!entry.args.empty())
+      GridStreamerReleaseArguments(entry.args.data(), entry.args.size(),
+                                   traits);
+  }
+
+  if (!ret && reverted)
+    return NULL;
+
+  // note: the values are unknown if reverting the changes failed
+  for (auto& entry : entries)
+    ParameterChanged(entry.parameter.get());
+
+  if (!ret)
+    return NULL;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// CopyParameters is a helper function to copy the values of all parameters
+// of the cells in the source index to the cells with the same path in the
+// destination index. It returns false with the path of the parameter in err
+// if the parameters of a cell don't match or a value can't be copied.
+//
+static bool CopyParameters(ChannelContext& dest,
+                           ChannelContext& src,
+                           std::string& err)
+{
+  std::lock(dest.lock, src.lock);
+  std::lock_guard<std::mutex> dest_lock(dest.lock, std::adopt_lock);
+  std::lock_guard<std::mutex> src_lock(src.lock, std::adopt_lock);
+
+  IndexChannel(dest);
+  IndexChannel(src);
+
+  for (auto& src_it : src.cells)
+  {
+    auto dest_it = dest.cells.find(src_it.first);
+    if (dest_it == dest.cells.end())
+      continue;
+
+    auto& src_params = src_it.second->GetParameters();
+    auto& dest_params = dest_it->second->GetParameters();
+    auto dest_param_it = dest_params.Begin();
+    for (auto param_it = src_params.Begin();
+         param_it != src_params.End();
+         ++param_it, ++dest_param_it)
+    {
+      err = src_it.first + '.' + param_it.Key();
+      if (dest_param_it == dest_params.End() ||
+          param_it.Key() != dest_param_it.Key())
+        return false;
+
+      std::vector<char> arg_buf(param_it->GetArgumentBufferSize());
+      if (!param_it->GetValues(arg_buf.data(), arg_buf.size()))
+        return false;
+
+      bool ret = dest_param_it->CallUnsafe(NULL, 0,
+                                           arg_buf.data(), arg_buf.size());
+      GridStreamerReleaseArguments(arg_buf.data(), arg_buf.size(),
+                                   param_it->GetSignature());
+      if (!ret)
+        return false;
+    }
+  }
+
+  err.clear();
+  return true;
+}
+
+
+//
+// PyChannelClone allocates a new channel with the committed layout of this
+// channel and copies all parameter values before applying any overrides.
+//
+static PyObject*
+PyChannelClone(PyChannel* self,
+               PyObject* const* args,
+               Py_ssize_t nargs,
+               PyObject* kwnames)
+{
+  PyObject* values[2];
+
+  // note: overrides is a borrowed reference
+  static const char* kwlist[] = { "name", "overrides", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  const char* name = PyUnicode_AsUTF8(values[0]);
+  if (name == NULL)
+    return NULL;
+
+  PyObject* overrides = values[1];
+  if (overrides != NULL && !PyDict_Check(overrides))
+  {
+    PyErr_SetString(PyExc_TypeError, "Overrides must be a dictionary");
+    return NULL;
+  }
+
+  auto& context = self->context;
+  std::string text;
+  auto layout = context != NULL ? GetChannelLayout(*context, &text) : nullptr;
+  if (layout == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "Channel has no layout");
+    return NULL;
+  }
+
+  if (strlen(name) == 0)
+  {
+    PyErr_SetString(PyExc_AttributeError, "Invalid name for the channel");
+    return NULL;
+  }
+
+  PyGrid* grid = self->grid;
+  auto lock = LockGridContext(*grid->context);
+  auto handle = grid->grid->AllocateChannel(name);
+  lock.unlock();
+  if (!handle)
+  {
+    PyErr_SetString(PyExc_AttributeError,
+                    "Channel with that name already exists");
+    return NULL;
+  }
+
+  std::shared_ptr<grid::Channel> channel = *handle;
+  auto clone = PyGridChannelContext(grid, name, channel);
+
+  grid::Builder builder;
+  bool committed = false;
+  bool copied = false;
+  std::string err;
+
+  Py_BEGIN_ALLOW_THREADS
+  {
+    std::lock_guard<std::mutex> lock(grid->context->lock);
+    PlacementScope placement(clone->placement);
+    MemoryScope memory(*clone->memory);
+
+    channel->CreateLayout();
+    {
+      TraceSpan span("UpdateChannel", name);
+      committed = builder.UpdateChannel(*grid->grid, *channel, *layout);
+    }
+    if (committed)
+    {
+      TraceSpan span("CommitLayout", name);
+      committed = channel->CommitLayout();
+    }
+    if (!committed)
+      channel->AbortLayout();
+  }
+
+  if (committed)
+  {
+    SetChannelLayout(*clone, layout, text);
+    copied = CopyParameters(*clone, *context, err);
+  }
+  Py_END_ALLOW_THREADS
+
+  PyChannel* pychannel = copied ?
+    (PyChannel*) PyType_GenericAlloc(Py_TYPE(self), 0) : NULL;
+  if (pychannel == NULL)
+  {
+    if (!committed)
+      PyErr_SetString(PyExc_RuntimeError, "Failed to build the channel");
+    else if (!copied)
+      PyErr_Format(PyExc_RuntimeError, "Failed to copy the parameter '%s'",
+                   err.c_str());
+    PyGridRemoveChannelContext(grid, name);
+    lock = LockGridContext(*grid->context);
+    grid->grid->RemoveChannel(handle);
+    return NULL;
+  }
+
+  Py_INCREF(grid);
+  pychannel->grid = grid;
+  pychannel->name = PyUnicode_FromString(name);
+  pychannel->channel = channel;
+  pychannel->context = clone;
+
+  if (overrides != NULL)
+  {
+    PyObject* ret = PyChannelApply(pychannel, overrides);
+    if (ret == NULL)
+    {
+      Py_DECREF(pychannel);
+      PyGridRemoveChannelContext(grid, name);
+      lock = LockGridContext(*grid->context);
+      grid->grid->RemoveChannel(handle);
+      return NULL;
+    }
+    Py_DECREF(ret);
+  }
+
+  return (PyObject*) pychannel;
+}
+
+
+//
+// PyChannelSetState sets the state of the channel.
+//
+static int PyChannelSetState(PyChannel* self, PyObject* pystate)
+{
+  const char* state = PyUnicode_AsUTF8AndSize(pystate, NULL);
+  if (state == NULL)
+    return -1;
+
+  grid::State next_state = GridStreamerStateFromName(state);
+  if (next_state != grid::kStateInvalid && !SetChannelState(self, next_state))
+    return -1;
+
+  return 0;
+}
+
+
+//
+// PyChannelOpen initializes and opens  the channel and sets the state to
+// "set" unless the state is already higher.
+//
+static PyObject* PyChannelOpen(PyChannel* self)
+{
+  bool ret = true;
+
+  grid::State curr_state = self->channel->GetState();
+  if (curr_state < grid::kStateSet)
+    ret = SetChannelState(self, grid::kStateSet, curr_state);
+
+  return PyBool_FromLong(ret);
+}
+
+
+//
+// PyChannelClose closes the channel.
+//
+static PyObject* PyChannelClose(PyChannel* self)
+{
+  return PyBool_FromLong(SetChannelState(self, grid::kStateNull));
+}
+
+
+//
+// PyChannelRun runs the channel (initializes it if not already initialized).
+//
+static PyObject* PyChannelRun(PyChannel* self)
+{
+  return PyBool_FromLong(SetChannelState(self, grid::kStateRunning));
+}
+
+
+//
+// PyChannelPause pauses a running channel (initializes and opens it if not
+// already in at least the state 'set')
+//
+static PyObject* PyChannelPause(PyChannel* self)
+{
+  return PyBool_FromLong(SetChannelState(self, grid::kStatePaused));
+}
+
+
+//
+// PyChannelFlush flushes a channel if running or initializes the channel if
+// uninitialized.
+//
+static PyObject* PyChannelFlush(PyChannel* self)
+{
+  return PyBool_FromLong(SetChannelState(self, grid::kStateFlushing));
+}
+
+
+//
+// PyChannelStop stops a channel unless it hasn't been anitialized.
+// Stopping a channel will drop any outstanding data.
+//
+static PyObject* PyChannelStop(PyChannel* self)
+{
+  bool ret = true;
+
+  grid::State curr_state = self->channel->GetState();
+  if (curr_state >= grid::kStateSet)
+    ret = SetChannelState(self, grid::kStateSet, curr_state);
+
+  return PyBool_FromLong(ret);
+}
+
+
+//
+// WaitChannelState is a helper function to wait until the channel is in the
+// state or in the error state, or failed by exceeding its memory budget, or
+// the timeout (in seconds, negative for none) expired. The grid doesn't
+// notify state changes, so the state is polled without the GIL, checking for
+// signals every 100ms. It returns the state of the channel, or kStateInvalid
+// if a signal handler raised an exception.
+//
+static grid::State WaitChannelState(grid::Channel& channel,
+                                    const ChannelMemory* memory,
+                                    grid::State state,
+                                    double timeout)
+{
+  using namespace std::chrono;
+
+  const auto kMaxDelay = microseconds(10000);
+  const auto kSignalInterval = milliseconds(100);
+
+  auto end = steady_clock::now() + duration_cast<steady_clock::duration>(
+      duration<double>(std::max(timeout, 0.0)));
+  auto delay = microseconds(50);
+  grid::State curr = channel.GetState();
+
+  while (curr != state && curr != grid::kStateError &&
+         (memory == NULL || !memory->Failed()))
+  {
+    auto now = steady_clock::now();
+    if (timeout >= 0 && now >= end)
+      break;
+
+    auto until = now + kSignalInterval;
+    if (timeout >= 0 && end < until)
+      until = end;
+
+    Py_BEGIN_ALLOW_THREADS
+    while ((curr = channel.GetState()) != state && curr != grid::kStateError &&
+           (memory == NULL || !memory->Failed()) &&
+           steady_clock::now() < until)
+    {
+      std::this_thread::sleep_for(delay);
+      delay = std::min(delay * 2, kMaxDelay);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (PyErr_CheckSignals() != 0)
+      return grid::kStateInvalid;
+  }
+
+  return curr;
+}
+
+
+//
+// ParseWaitArguments is a helper function to parse the state and timeout of
+// wait() and process().
+//
+static bool ParseWaitArguments(PyObject* pystate,
+                               PyObject* pytimeout,
+                               grid::State& state,
+                               double& timeout)
+{
+  state = grid::kStateEnd;
+  if (pystate != NULL)
+  {
+    const char* name = PyUnicode_AsUTF8(pystate);
+    if (name == NULL)
+      return false;
+
+    state = !strcmp(name, "end") ?
+      grid::kStateEnd : GridStreamerStateFromName(name);
+    if (state == grid::kStateInvalid)
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid state '%s'", name);
+      return false;
+    }
+  }
+
+  timeout = -1;
+  if (pytimeout != NULL && pytimeout != Py_None)
+  {
+    timeout = PyFloat_AsDouble(pytimeout);
+    if (timeout == -1.0 && PyErr_Occurred())
+      return false;
+    if (timeout < 0)
+    {
+      PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+//
+// ChannelMemoryFailed is a helper function to raise MemoryError if the channel
+// failed by exceeding its memory budget.
+//
+static bool ChannelMemoryFailed(PyChannel* self)
+{
+  if (self->context == nullptr || !self->context->memory->Failed())
+    return false;
+
+  PyErr_SetString(PyExc_MemoryError, "Channel exceeded its memory budget");
+  return true;
+}
+
+
+//
+// PyChannelWait waits until the channel is in the state ("end" by default),
+// and returns True, or False if the timeout expired. It raises an exception
+// if the channel is in the error state or exceeded its memory budget with
+// the "error" policy.
+//
+static PyObject* PyChannelWait(PyChannel* self,
+                               PyObject* const* args,
+                               Py_ssize_t nargs,
+                               PyObject* kwnames)
+{
+  PyObject* values[2];
+
+  static const char* kwlist[] = { "state", "timeout", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, values))
+    return NULL;
+
+  grid::State state;
+  double timeout;
+  if (!ParseWaitArguments(values[0], values[1], state, timeout))
+    return NULL;
+
+  ChannelMemory* memory =
+    self->context != nullptr ? self->context->memory.get() : NULL;
+  grid::State curr = WaitChannelState(*self->channel, memory, state, timeout);
+  if (curr == grid::kStateInvalid || ChannelMemoryFailed(self))
+    return NULL;
+
+  if (curr == grid::kStateError && state != grid::kStateError)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Channel is in the error state");
+    return NULL;
+  }
+
+  return PyBool_FromLong(curr == state);
+}
+
+
+//
+// PyChannelProcess runs the channel until it ends, such as for processing
+// files, or the timeout expired, and returns the final state and the elapsed
+// time in seconds.
+//
+static PyObject* PyChannelProcess(PyChannel* self,
+                                  PyObject* const* args,
+                                  Py_ssize_t nargs,
+                                  PyObject* kwnames)
+{
+  PyObject* pytimeout;
+
+  static const char* kwlist[] = { "timeout", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pytimeout))
+    return NULL;
+
+  grid::State state;
+  double timeout;
+  if (!ParseWaitArguments(NULL, pytimeout, state, timeout))
+    return NULL;
+
+  uint64_t start = StatsNow();
+  if (!SetChannelState(self, grid::kStateRunning))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Failed to run the channel");
+    return NULL;
+  }
+
+  ChannelMemory* memory =
+    self->context != nullptr ? self->context->memory.get() : NULL;
+  grid::State curr = WaitChannelState(*self->channel, memory, state, timeout);
+  if (curr == grid::kStateInvalid || ChannelMemoryFailed(self))
+    return NULL;
+
+  return Py_BuildValue("{sssd}",
+                       "state", GridStreamerStateName(curr),
+                       "elapsed", (StatsNow() - start) / 1e9);
+}
+
+
+//
+// PyChannelGetState returns the state of the channel.
 //
-PyObject* PyChannelCompile(PyChannel* self, PyObject* pylayout)
+static PyObject* PyChannelGetState(PyChannel* self)
 {
-  auto& channel = self->channel;
-  if (channel == NULL)
+  return PyUnicode_FromString(GridStreamerStateName(self->channel->GetState()));
+}
+
+
+//
+// PyChannelGetStats returns the histograms of the durations of compiling the
+// channel and setting its state.
+//
+static PyObject* PyChannelGetStats(PyChannel* self)
+{
+  if (self->context == nullptr)
   {
     PyErr_SetString(PyExc_AttributeError, "channel");
-    Py_RETURN_FALSE;
+    return NULL;
   }
 
-  grid::Builder builder;
-  std::string err;
-  std::unique_ptr<grid::Layout> layout =
-    builder.Compile(PyUnicode_AsUTF8(pylayout), err);
-  if (layout == NULL)
-  {
-    PyErr_SetString(PyExc_AttributeError, err.c_str());
-    Py_RETURN_FALSE;
-  }
+  return Py_BuildValue("{sNsN}",
+      "compile", StatsHistogramToDict(self->context->compile_stats),
+      "set_state", StatsHistogramToDict(self->context->state_stats));
+}
 
-  channel->CreateLayout();
 
-  PyGrid* grid = (PyGrid*)self->grid;
-  if (!builder.UpdateChannel(*grid->grid, *channel, *layout))
+//
+// PyChannelLatency returns the latency percentiles of the stages of the
+// channel, and optionally resets them.
+//
+static PyObject* PyChannelLatency(PyChannel* self,
+                                  PyObject* const* args,
+                                  Py_ssize_t nargs,
+                                  PyObject* kwnames)
+{
+  PyObject* pyreset;
+
+  static const char* kwlist[] = { "reset", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyreset))
+    return NULL;
+
+  if (self->context == nullptr)
   {
-    // TODO: get error text from builder (not implemented yet)
-    PyErr_SetString(PyExc_SyntaxError, "layout format");
-    channel->AbortLayout();
-    Py_RETURN_FALSE;
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
   }
 
-  if (!channel->CommitLayout())
+  int reset = pyreset != NULL ? PyObject_IsTrue(pyreset) : 0;
+  if (reset < 0)
+    return NULL;
+
+  return self->context->latency.ToDict(reset);
+}
+
+
+//
+// PyChannelRecordLatency records a latency in nanoseconds for a stage, for
+// example from the timestamp passed to a callback.
+//
+static PyObject* PyChannelRecordLatency(PyChannel* self,
+                                        PyObject* const* args,
+                                        Py_ssize_t nargs,
+                                        PyObject* kwnames)
+{
+  PyObject* values[2];
+
+  static const char* kwlist[] = { "stage", "ns", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 2, values))
+    return NULL;
+
+  if (self->context == nullptr)
   {
-    channel->AbortLayout();
-    Py_RETURN_FALSE;
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
   }
 
+  const char* name = PyUnicode_AsUTF8(values[0]);
+  if (name == NULL)
+    return NULL;
+
+  unsigned long long ns = PyLong_AsUnsignedLongLong(values[1]);
+  if (ns == (unsigned long long) -1 && PyErr_Occurred())
+    return NULL;
+
+  auto& latency = self->context->latency;
+  latency.Record(*latency.GetStage(name), ns);
+
   Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelGetCells returns a list of cells in the channel.
-// These could be pipelines or cells.
+// PyChannelSetLatencyThreshold sets the handler that is called with the stage
+// and latency when a latency exceeds the threshold in nanoseconds, at most
+// once per interval in seconds. A threshold of None removes the handler.
 //
-static PyObject* PyChannelGetCells(PyChannel* self)
+static PyObject* PyChannelSetLatencyThreshold(PyChannel* self,
+                                              PyObject* const* args,
+                                              Py_ssize_t nargs,
+                                              PyObject* kwnames)
 {
-  auto channel = self->channel;
-  if (channel == NULL)
+  PyObject* values[3];
+
+  static const char* kwlist[] = { "threshold", "handler", "interval", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  if (self->context == nullptr)
   {
     PyErr_SetString(PyExc_AttributeError, "channel");
     return NULL;
   }
 
-  PyObject* dict = PyDict_New();
-
-  grid::Registry<grid::Pipeline>& pipelines = channel->GetPipelines();
-  for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+  auto& latency = self->context->latency;
+  if (values[0] == Py_None)
   {
-    PyCell* pycell = (PyCell*) PyType_GenericAlloc(&pycell_type, 0);
-    pycell->cell = *pipe_it;
+    latency.SetThreshold(0, NULL, 0);
+    Py_RETURN_TRUE;
+  }
+
+  unsigned long long threshold = PyLong_AsUnsignedLongLong(values[0]);
+  if (threshold == (unsigned long long) -1 && PyErr_Occurred())
+    return NULL;
 
-    pycell->name = PyUnicode_FromString(pipe_it.Key().c_str());
-    pycell->type = PyUnicode_FromString(pipe_it->Type().c_str());
+  if (values[1] == NULL || !PyCallable_Check(values[1]))
+  {
+    PyErr_SetString(PyExc_TypeError, "handler must be callable");
+    return NULL;
+  }
 
-    if (PyDict_SetItemString(dict, pipe_it.Key().c_str(), (PyObject*) pycell) != 0)
+  double interval = 1.0;
+  if (values[2] != NULL)
+  {
+    interval = PyFloat_AsDouble(values[2]);
+    if (interval == -1.0 && PyErr_Occurred())
+      return NULL;
+    if (interval < 0)
     {
-      Py_DECREF(dict);
+      PyErr_SetString(PyExc_ValueError, "interval must not be negative");
       return NULL;
     }
   }
 
-  return dict;
+  latency.SetThreshold(threshold, values[1], interval * 1e9);
+  Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelSetState sets the state of the channel.
+// PyChannelMemory returns the memory of the channel and its budget, and
+// optionally resets the counters.
 //
-static int PyChannelSetState(PyChannel* self, PyObject* pystate)
+static PyObject* PyChannelMemory(PyChannel* self,
+                                 PyObject* const* args,
+                                 Py_ssize_t nargs,
+                                 PyObject* kwnames)
 {
-  const char* state = PyUnicode_AsUTF8AndSize(pystate, NULL);
-  if (state == NULL)
-    return -1;
+  PyObject* pyreset;
 
-  grid::State next_state = grid::kStateInvalid;
-  if (!strcmp(state, "null"))
-    next_state = grid::kStateNull;
-  else if (!strcmp(state, "ready"))
-    next_state = grid::kStateReady;
-  else if (!strcmp(state, "set"))
-    next_state = grid::kStateSet;
-  else if (!strcmp(state, "flushing"))
-    next_state = grid::kStateFlushing;
-  else if (!strcmp(state, "running"))
-    next_state = grid::kStateRunning;
-  else if (!strcmp(state, "paused"))
-    next_state = grid::kStatePaused;
-
-  if (next_state != grid::kStateInvalid && !self->channel->SetState(next_state))
-    return -1;
+  static const char* kwlist[] = { "reset", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyreset))
+    return NULL;
 
-  return 0;
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  int reset = pyreset != NULL ? PyObject_IsTrue(pyreset) : 0;
+  if (reset < 0)
+    return NULL;
+
+  return self->context->memory->ToDict(reset);
 }
 
 
 //
-// PyChannelOpen initializes and opens  the channel and sets the state to
-// "set" unless the state is already higher.
+// PyChannelSetMemoryBudget sets the memory budget of the channel in bytes and
+// the policy for callback events that would exceed it: "drop" them, wait
+// ("backpressure"), or fail the channel ("error"). The handler is called with
+// the bytes of the channel when the budget is exceeded. A budget of None
+// removes the budget.
 //
-static PyObject* PyChannelOpen(PyChannel* self)
+static PyObject* PyChannelSetMemoryBudget(PyChannel* self,
+                                          PyObject* const* args,
+                                          Py_ssize_t nargs,
+                                          PyObject* kwnames)
 {
-  bool ret = true;
+  PyObject* values[3];
 
-  grid::State curr_state = self->channel->GetState();
-  if (curr_state < grid::kStateSet)
-    ret = self->channel->SetStateCond(curr_state, grid::kStateSet);
+  static const char* kwlist[] = { "bytes", "policy", "handler", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
 
-  return PyBool_FromLong(ret);
-}
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
 
+  auto& memory = *self->context->memory;
+  if (values[0] == Py_None)
+  {
+    memory.SetBudget(0, kBudgetDrop, NULL);
+    Py_RETURN_TRUE;
+  }
 
-//
-// PyChannelClose closes the channel.
-//
-static PyObject* PyChannelClose(PyChannel* self)
-{
-  return PyBool_FromLong(self->channel->SetState(grid::kStateNull));
-}
+  unsigned long long budget = PyLong_AsUnsignedLongLong(values[0]);
+  if (budget == (unsigned long long) -1 && PyErr_Occurred())
+    return NULL;
+  if (budget == 0)
+  {
+    PyErr_SetString(PyExc_ValueError, "bytes must be positive");
+    return NULL;
+  }
 
+  BudgetPolicy policy = kBudgetDrop;
+  if (values[1] != NULL)
+  {
+    const char* name = PyUnicode_AsUTF8(values[1]);
+    if (name == NULL)
+      return NULL;
 
-//
-// PyChannelRun runs the channel (initializes it if not already initialized).
-//
-static PyObject* PyChannelRun(PyChannel* self)
-{
-  return PyBool_FromLong(self->channel->SetState(grid::kStateRunning));
+    if (!strcmp(name, "drop"))
+      policy = kBudgetDrop;
+    else if (!strcmp(name, "backpressure"))
+      policy = kBudgetBackpressure;
+    else if (!strcmp(name, "error"))
+      policy = kBudgetError;
+    else
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid policy '%s'", name);
+      return NULL;
+    }
+  }
+
+  PyObject* handler = values[2];
+  if (handler == Py_None)
+    handler = NULL;
+  if (handler != NULL && !PyCallable_Check(handler))
+  {
+    PyErr_SetString(PyExc_TypeError, "handler must be callable");
+    return NULL;
+  }
+
+  memory.SetBudget(budget, policy, handler);
+  Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelPause pauses a running channel (initializes and opens it if not
-// already in at least the state 'set')
+// PyChannelSetAffinity sets the CPUs for the threads of the channel, or any
+// CPU for None. It applies to the running threads and to the threads started
+// when setting the state of the channel.
 //
-static PyObject* PyChannelPause(PyChannel* self)
+static PyObject* PyChannelSetAffinity(PyChannel* self, PyObject* pycpus)
 {
-  return PyBool_FromLong(self->channel->SetState(grid::kStatePaused));
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  std::vector<int> cpus;
+  if (pycpus != Py_None)
+  {
+    PyObject* seq = PySequence_Fast(pycpus, "cpus must be a sequence");
+    if (seq == NULL)
+      return NULL;
+
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++)
+    {
+      long cpu = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+      if (cpu == -1 && PyErr_Occurred())
+      {
+        Py_DECREF(seq);
+        return NULL;
+      }
+      if (cpu < 0 || cpu >= CPU_SETSIZE)
+      {
+        PyErr_Format(PyExc_ValueError, "Invalid CPU %ld", cpu);
+        Py_DECREF(seq);
+        return NULL;
+      }
+      cpus.push_back(cpu);
+    }
+    Py_DECREF(seq);
+
+    if (cpus.empty())
+    {
+      PyErr_SetString(PyExc_ValueError, "cpus must not be empty");
+      return NULL;
+    }
+  }
+
+  int err = SetChannelAffinity(self->context->placement, cpus);
+  if (err != 0)
+  {
+    errno = err;
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+
+  Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelFlush flushes a channel if running or initializes the channel if
-// uninitialized.
+// PyChannelSetPriority sets the nice value for the threads of the channel,
+// or None to leave it unchanged. Lowering the value requires privileges.
 //
-static PyObject* PyChannelFlush(PyChannel* self)
+static PyObject* PyChannelSetPriority(PyChannel* self, PyObject* pynice)
 {
-  return PyBool_FromLong(self->channel->SetState(grid::kStateFlushing));
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
+
+  int nice = 0;
+  if (pynice != Py_None)
+  {
+    long value = PyLong_AsLong(pynice);
+    if (value == -1 && PyErr_Occurred())
+      return NULL;
+    if (value < -20 || value > 19)
+    {
+      PyErr_SetString(PyExc_ValueError, "nice must be between -20 and 19");
+      return NULL;
+    }
+    nice = value;
+  }
+
+  int err = SetChannelPriority(self->context->placement,
+                               pynice != Py_None ? &nice : NULL);
+  if (err != 0)
+  {
+    errno = err;
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+
+  Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelStop stops a channel unless it hasn't been anitialized.
-// Stopping a channel will drop any outstanding data.
+// PyChannelSetNUMANode sets the NUMA node for the memory and the threads of
+// the channel, or None for any node. The memory is allocated on the node when
+// the channel is compiled or its state is set.
 //
-static PyObject* PyChannelStop(PyChannel* self)
+static PyObject* PyChannelSetNUMANode(PyChannel* self, PyObject* pynode)
 {
-  bool ret = true;
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
 
-  grid::State curr_state = self->channel->GetState();
-  if (curr_state >= grid::kStateSet)
-    ret = self->channel->SetStateCond(curr_state, grid::kStateSet);
+  int node = -1;
+  if (pynode != Py_None)
+  {
+    long value = PyLong_AsLong(pynode);
+    if (value == -1 && PyErr_Occurred())
+      return NULL;
+    if (value < 0 || value > INT_MAX || !IsNUMANode(value))
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid NUMA node %ld", value);
+      return NULL;
+    }
+    node = value;
+  }
 
-  return PyBool_FromLong(ret);
+  int err = SetChannelNUMANode(self->context->placement, node);
+  if (err != 0)
+  {
+    errno = err;
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+
+  Py_RETURN_TRUE;
 }
 
 
 //
-// PyChannelGetState returns the state of the channel.
+// PyChannelGetPlacement returns the affinity and nice value of the channel,
+// and the effective placement of its threads.
 //
-static PyObject* PyChannelGetState(PyChannel* self)
+static PyObject* PyChannelGetPlacement(PyChannel* self)
 {
-  grid::State state = self->channel->GetState();
-
-  if (state == grid::kStateInvalid)
-    return PyUnicode_FromString("invalid");
-  else if (state == grid::kStateNull)
-    return PyUnicode_FromString("null");
-  else if (state == grid::kStateReady)
-    return PyUnicode_FromString("ready");
-  else if (state == grid::kStateSet)
-    return PyUnicode_FromString("set");
-  else if (state == grid::kStateFlushing)
-    return PyUnicode_FromString("flushing");
-  else if (state == grid::kStateRunning)
-    return PyUnicode_FromString("running");
-  else if (state == grid::kStatePaused)
-    return PyUnicode_FromString("paused");
-  else if (state == grid::kStateEnd)
-    return PyUnicode_FromString("end");
-  else if (state == grid::kStateError)
-    return PyUnicode_FromString("error");
+  if (self->context == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, "channel");
+    return NULL;
+  }
 
-  return PyUnicode_FromString("unknown");
+  return ChannelPlacementToDict(self->context->placement);
 }
 
 
@@ -253,9 +1510,14 @@ PyChannelInit(PyChannel* self, PyObject* args, PyObject* kwargs)
 //
 static void PyChannelDealloc(PyChannel* self)
 {
+  PyTypeObject* type = Py_TYPE(self);
+
   Py_XDECREF(self->name);
+  Py_XDECREF(self->grid);
   self->channel.reset();
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  self->context.reset();
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -264,6 +1526,13 @@ static void PyChannelDealloc(PyChannel* self)
 //
 static PyGetSetDef pychannel_getsets[] =
 {
+  {
+    "layout",
+    (getter) PyChannelGetLayout,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
   {
     "state",
     (getter) PyChannelGetState,
@@ -271,6 +1540,13 @@ static PyGetSetDef pychannel_getsets[] =
     NULL,
     NULL
   },
+  {
+    "stats",
+    (getter) PyChannelGetStats,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
   {
     NULL
   }
@@ -287,6 +1563,66 @@ static PyMethodDef pychannel_methods[] =
     METH_NOARGS,
     "Return all pipeline cells in the channel"
   },
+  {
+    "profile",
+    (PyCFunction)(void(*)(void)) PyChannelProfile,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the profiles of all cells in the channel"
+  },
+  {
+    "compile",
+    (PyCFunction) PyChannelCompile,
+    METH_O,
+    "Compile a new layout to the channel unless it is the current layout"
+  },
+  {
+    "clone",
+    (PyCFunction)(void(*)(void)) PyChannelClone,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Create a copy of the channel with the same layout and parameter values"
+  },
+  {
+    "lookup",
+    (PyCFunction) PyChannelLookupPath,
+    METH_O,
+    "Return the cell or parameter for a 'pipeline/cell.parameter' path"
+  },
+  {
+    "apply",
+    (PyCFunction) PyChannelApply,
+    METH_O,
+    "Set multiple parameters, keyed by 'pipeline/cell.parameter', at once"
+  },
+  {
+    "latency",
+    (PyCFunction)(void(*)(void)) PyChannelLatency,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the latency percentiles by stage, optionally resetting them"
+  },
+  {
+    "record_latency",
+    (PyCFunction)(void(*)(void)) PyChannelRecordLatency,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Record a latency in nanoseconds for a stage"
+  },
+  {
+    "set_latency_threshold",
+    (PyCFunction)(void(*)(void)) PyChannelSetLatencyThreshold,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Call a handler when a latency exceeds the threshold, at most once per interval"
+  },
+  {
+    "memory",
+    (PyCFunction)(void(*)(void)) PyChannelMemory,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the memory of the channel and its budget, optionally resetting them"
+  },
+  {
+    "set_memory_budget",
+    (PyCFunction)(void(*)(void)) PyChannelSetMemoryBudget,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Set the memory budget in bytes and the policy ('drop', 'backpressure', 'error')"
+  },
   {
     "open",
     (PyCFunction) PyChannelOpen,
@@ -323,27 +1659,70 @@ static PyMethodDef pychannel_methods[] =
     METH_NOARGS,
     "Stop the channel and drop any outstanding transports",
   },
+  {
+    "set_affinity",
+    (PyCFunction) PyChannelSetAffinity,
+    METH_O,
+    "Set the CPUs for the threads of the channel, or None for any CPU",
+  },
+  {
+    "set_priority",
+    (PyCFunction) PyChannelSetPriority,
+    METH_O,
+    "Set the nice value for the threads of the channel, or None",
+  },
+  {
+    "set_numa_node",
+    (PyCFunction) PyChannelSetNUMANode,
+    METH_O,
+    "Set the NUMA node for the memory and threads of the channel, or None",
+  },
+  {
+    "placement",
+    (PyCFunction) PyChannelGetPlacement,
+    METH_NOARGS,
+    "Return the placement and the effective placement of the threads",
+  },
+  {
+    "wait",
+    (PyCFunction)(void(*)(void)) PyChannelWait,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Wait until the channel is in the state ('end'), or the timeout expired",
+  },
+  {
+    "process",
+    (PyCFunction)(void(*)(void)) PyChannelProcess,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Run the channel until it ends and return the state and elapsed time",
+  },
   {
     NULL  /* Sentinel */
   }
 };
 
 
-PyTypeObject pychannel_type =
-{
-  PyVarObject_HEAD_INIT(NULL, 0)
-  .tp_name = "gridstreamer.Channel",
-  .tp_basicsize = sizeof(PyChannel),
-  .tp_itemsize = 0,
-  .tp_dealloc = (destructor) PyChannelDealloc,
-  .tp_repr = (reprfunc) PyChannelStr,
-  .tp_str = (reprfunc) PyChannelStr,
-  .tp_flags = Py_TPFLAGS_DEFAULT,
-  .tp_doc = PyDoc_STR("Channel is a contained system of pipelines and streams"),
-  .tp_methods = pychannel_methods,
-  .tp_getset = pychannel_getsets,
-  .tp_init = (initproc) PyChannelInit,
-  .tp_new = PyType_GenericNew,
+static PyType_Slot pychannel_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyChannelDealloc },
+  { Py_tp_repr, (void*) PyChannelStr },
+  { Py_tp_str, (void*) PyChannelStr },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "Channel is a contained system of pipelines and streams") },
+  { Py_tp_methods, pychannel_methods },
+  { Py_tp_getset, pychannel_getsets },
+  { Py_tp_init, (void*) PyChannelInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
+PyType_Spec pychannel_spec =
+{
+  .name = "gridstreamer.Channel",
+  .basicsize = sizeof(PyChannel),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pychannel_slots,
 };
 
 
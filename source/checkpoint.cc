@@ -0,0 +1,570 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/builder/builder.h>
+#include <grid/fw/cluster.h>
+#include <grid/fw/parameter.h>
+#include <grid/fw/pipeline.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <thread>
+
+
+//
+// Checkpoint file format (native byte order):
+//
+//   char[8]    magic "GSCHKPNT"
+//   uint32_t   version
+//   uint32_t   number of channels
+//   for each channel:
+//     string     name
+//     string     layout
+//     string     state ("null", "running", ...)
+//     uint32_t   number of parameters
+//     for each parameter:
+//       string     path ("pipeline/cell.parameter")
+//       string     signature (traits[0] + 1 unsigned longs)
+//       string     serialized arguments
+//
+// All strings are prefixed with their length as uint32_t.
+//
+static const char kCheckpointMagic[8] = { 'G','S','C','H','K','P','N','T' };
+static const uint32_t kCheckpointVersion = 1;
+
+
+namespace {
+
+// ParameterCheckpoint is the recorded value of a parameter.
+struct ParameterCheckpoint
+{
+  std::string   path;
+  std::string   signature;
+  std::string   value;
+};
+
+// ChannelCheckpoint is the recorded layout, state, and parameters of a channel.
+struct ChannelCheckpoint
+{
+  std::string                       name;
+  std::string                       layout;
+  std::string                       state;
+  std::vector<ParameterCheckpoint>  parameters;
+};
+
+} // end of namespace
+
+
+//
+// AppendString is a helper function to append a length-prefixed string.
+//
+static void AppendString(std::string& out, const std::string& str)
+{
+  uint32_t len = str.size();
+  out.append((const char*)&len, sizeof(len));
+  out.append(str);
+}
+
+
+//
+// ReadString is a helper function to read a length-prefixed string.
+//
+static bool ReadString(const char*& ptr, const char* end, std::string& str)
+{
+  uint32_t len;
+  if (end - ptr < (ptrdiff_t) sizeof(len))
+    return false;
+  memcpy(&len, ptr, sizeof(len));
+  ptr += sizeof(len);
+
+  if ((size_t)(end - ptr) < len)
+    return false;
+  str.assign(ptr, len);
+  ptr += len;
+  return true;
+}
+
+
+//
+// CheckpointCell is a helper function to record the parameters of a cell and
+// of any cells of a pipeline or cluster.
+//
+static void CheckpointCell(ChannelCheckpoint& checkpoint,
+                           const std::string& path,
+                           grid::Cell& cell)
+{
+  auto& params = cell.GetParameters();
+  for (auto param_it = params.Begin(); param_it != params.End(); ++param_it)
+  {
+    const unsigned long* traits = param_it->GetSignature();
+    size_t arg_buf_sz = param_it->GetArgumentBufferSize();
+    char arg_buf[arg_buf_sz];
+    if (!param_it->GetValues(arg_buf, arg_buf_sz))
+      continue;
+
+    ParameterCheckpoint param;
+    param.path = path + '.' + param_it.Key();
+    param.signature.assign((const char*)traits,
+                           (traits[0] + 1) * sizeof(unsigned long));
+    GridStreamerSerializeArguments(param.value, arg_buf, arg_buf_sz, traits);
+    checkpoint.parameters.push_back(std::move(param));
+  }
+
+  grid::Cluster*  cluster =  cell.ClusterInterface();
+  grid::Pipeline* pipeline = cell.PipelineInterface();
+  if (cluster == nullptr && pipeline == nullptr)
+    return;
+
+  grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
+    pipeline->GetCells() : cluster->GetCells();
+
+  for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
+    CheckpointCell(checkpoint, path + '/' + cell_it.Key(), **cell_it);
+}
+
+
+//
+// SaveCheckpoint writes the recorded channels to a checkpoint file.
+//
+static bool SaveCheckpoint(const char* path,
+                           const std::vector<ChannelCheckpoint>& channels,
+                           std::string& err)
+{
+  std::string data(kCheckpointMagic, sizeof(kCheckpointMagic));
+  uint32_t version = kCheckpointVersion;
+  uint32_t count = channels.size();
+  data.append((const char*)&version, sizeof(version));
+  data.append((const char*)&count, sizeof(count));
+
+  for (auto& channel : channels)
+  {
+    AppendString(data, channel.name);
+    AppendString(data, channel.layout);
+    AppendString(data, channel.state);
+
+    uint32_t param_count = channel.parameters.size();
+    data.append((const char*)&param_count, sizeof(param_count));
+    for (auto& param : channel.parameters)
+    {
+      AppendString(data, param.path);
+      AppendString(data, param.signature);
+      AppendString(data, param.value);
+    }
+  }
+
+  // note: write to a temporary file and rename it, so a failed or interrupted
+  //       save never leaves a truncated checkpoint behind
+  std::string tmp_path = std::string(path) + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == NULL)
+  {
+    err = strerror(errno);
+    return false;
+  }
+
+  bool ret = fwrite(data.data(), 1, data.size(), file) == data.size() &&
+             fflush(file) == 0 &&
+             fsync(fileno(file)) == 0;
+  if (!ret)
+    err = strerror(errno);
+
+  if (fclose(file) != 0 && ret)
+  {
+    err = strerror(errno);
+    ret = false;
+  }
+
+  if (ret && rename(tmp_path.c_str(), path) != 0)
+  {
+    err = strerror(errno);
+    ret = false;
+  }
+
+  if (!ret)
+    unlink(tmp_path.c_str());
+  return ret;
+}
+
+
+//
+// LoadCheckpoint reads the recorded channels from a checkpoint file.
+//
+static bool LoadCheckpoint(const char* path,
+                           std::vector<ChannelCheckpoint>& channels,
+                           std::string& err)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    err = strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    err = strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  void* map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if (map == MAP_FAILED || map == NULL)
+  {
+    err = size > 0 ? strerror(errno) : "empty file";
+    return false;
+  }
+
+  const char* ptr = (const char*) map;
+  const char* end = ptr + size;
+
+  uint32_t version;
+  uint32_t count;
+  bool ret = false;
+
+  if (size < sizeof(kCheckpointMagic) + sizeof(version) + sizeof(count) ||
+      memcmp(ptr, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0)
+    err = "not a checkpoint file";
+  else
+  {
+    ptr += sizeof(kCheckpointMagic);
+    memcpy(&version, ptr, sizeof(version));
+    ptr += sizeof(version);
+    memcpy(&count, ptr, sizeof(count));
+    ptr += sizeof(count);
+
+    if (version != kCheckpointVersion)
+      err = "unsupported checkpoint file version " + std::to_string(version);
+    else
+    {
+      ret = true;
+      for (uint32_t i = 0; ret && i < count; i++)
+      {
+        ChannelCheckpoint channel;
+        uint32_t param_count;
+
+        ret = ReadString(ptr, end, channel.name) &&
+              ReadString(ptr, end, channel.layout) &&
+              ReadString(ptr, end, channel.state) &&
+              end - ptr >= (ptrdiff_t) sizeof(param_count);
+        if (!ret)
+          break;
+
+        memcpy(&param_count, ptr, sizeof(param_count));
+        ptr += sizeof(param_count);
+
+        // note: every parameter has at least three string lengths
+        if ((size_t)(end - ptr) / (3 * sizeof(uint32_t)) < param_count)
+        {
+          ret = false;
+          break;
+        }
+
+        channel.parameters.resize(param_count);
+        for (auto& param : channel.parameters)
+          if (!(ret = ReadString(ptr, end, param.path) &&
+                      ReadString(ptr, end, param.signature) &&
+                      ReadString(ptr, end, param.value)))
+            break;
+
+        if (ret)
+          channels.push_back(std::move(channel));
+      }
+      if (!ret)
+        err = "truncated checkpoint file";
+    }
+  }
+
+  munmap(map, size);
+  return ret;
+}
+
+
+//
+// RestoreParameter is a helper function to set a parameter to the recorded
+// value. The signature of the parameter must match the recorded signature.
+//
+static bool RestoreParameter(grid::Parameter& param,
+                             const ParameterCheckpoint& checkpoint)
+{
+  const unsigned long* traits = param.GetSignature();
+  if (checkpoint.signature.size() != (traits[0] + 1) * sizeof(unsigned long) ||
+      memcmp(checkpoint.signature.data(), traits, checkpoint.signature.size()))
+    return false;
+
+  size_t arg_buf_sz = param.GetArgumentBufferSize();
+  char arg_buf[arg_buf_sz];
+  const char* ptr = checkpoint.value.data();
+  const char* end = ptr + checkpoint.value.size();
+
+  if (!GridStreamerDeserializeArguments(ptr, end, arg_buf, arg_buf_sz, traits))
+    return false;
+
+  bool ret = param.CallUnsafe(NULL, 0, arg_buf, arg_buf_sz);
+  GridStreamerReleaseArguments(arg_buf, arg_buf_sz, traits);
+  return ret;
+}
+
+
+//
+// RestoreChannel builds the channel with the recorded layout and restores the
+// parameter values and state. It can be called from any native thread, and
+// locks the grid context only for building the channel. The memory, threads,
+// and durations of building the channel and setting its state are accounted
+// to the context, as for allocate_channel.
+//
+static bool RestoreChannel(PyGrid* self,
+                           ChannelContext& context,
+                           const ChannelCheckpoint& checkpoint,
+                           std::string& err)
+{
+  auto layout = CompileLayout(checkpoint.layout, err);
+  if (layout == nullptr)
+    return false;
+
+  grid::Builder builder;
+  auto& channel = context.channel;
+  uint64_t start = StatsNow();
+  bool committed;
+  {
+    std::lock_guard<std::mutex> lock(self->context->lock);
+    PlacementScope placement(context.placement);
+    MemoryScope memory(*context.memory);
+
+    channel->CreateLayout();
+    {
+      TraceSpan span("UpdateChannel", checkpoint.name.c_str());
+      committed = builder.UpdateChannel(*self->grid, *channel, *layout);
+    }
+    if (committed)
+    {
+      TraceSpan span("CommitLayout", checkpoint.name.c_str());
+      committed = channel->CommitLayout();
+    }
+    if (!committed)
+      channel->AbortLayout();
+  }
+
+  if (!committed)
+  {
+    err = "failed to build the channel";
+    return false;
+  }
+
+  SetChannelLayout(context, layout, checkpoint.layout);
+  RecordChannelStats(context, kStatsCompile, start);
+
+  for (auto& param : checkpoint.parameters)
+  {
+    auto parameter = FindParameter(context, param.path);
+    if (parameter == nullptr || !RestoreParameter(*parameter, param))
+    {
+      err = "failed to restore " + param.path;
+      return false;
+    }
+  }
+
+  grid::State state = GridStreamerStateFromName(checkpoint.state.c_str());
+  if (state != grid::kStateInvalid && state != grid::kStateNull)
+  {
+    std::string detail =
+      TraceStateDetail(checkpoint.name.c_str(), *channel, state);
+    TraceSpan span("SetState", detail.c_str());
+
+    start = StatsNow();
+    bool ret;
+    {
+      PlacementScope placement(context.placement);
+      MemoryScope memory(*context.memory);
+      ret = channel->SetState(state);
+    }
+    RecordChannelStats(context, kStatsSetState, start);
+
+    if (!ret)
+    {
+      err = "failed to set the state to " + checkpoint.state;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+extern "C" {
+
+//
+// PyGridCheckpoint records the layout, state, and all parameter values of all
+// channels with a layout to a checkpoint file.
+//
+PyObject* PyGridCheckpoint(PyGrid* self, PyObject* pypath)
+{
+  PyObject* path_bytes;
+  if (!PyUnicode_FSConverter(pypath, &path_bytes))
+    return NULL;
+
+  std::vector<ChannelCheckpoint> channels;
+  {
+    auto lock = LockGridContext(*self->context);
+    std::lock_guard<std::mutex> channels_lock(self->context->channels_lock);
+
+    // note: channels acquired from a pool with a name have two contexts
+    std::set<const grid::Channel*> recorded;
+    for (auto& context_it : self->context->channels)
+    {
+      ChannelContext& context = *context_it.second;
+      ChannelCheckpoint channel;
+      if (GetChannelLayout(context, &channel.layout) == nullptr ||
+          !recorded.insert(context.channel.get()).second)
+        continue;
+
+      channel.name = context_it.first;
+      channel.state = GridStreamerStateName(context.channel->GetState());
+
+      grid::Registry<grid::Pipeline>& pipelines = context.channel->GetPipelines();
+      for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+        CheckpointCell(channel, pipe_it.Key(), **pipe_it);
+
+      channels.push_back(std::move(channel));
+    }
+  }
+
+  std::string err;
+  bool ret;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = SaveCheckpoint(PyBytes_AS_STRING(path_bytes), channels, err);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(path_bytes);
+  if (!ret)
+  {
+    PyErr_SetString(PyExc_OSError, err.c_str());
+    return NULL;
+  }
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyGridRestore creates a new grid from a checkpoint file. The channels are
+// built and restored in parallel from a number of native threads.
+//
+PyObject* PyGridRestore(PyTypeObject* type,
+                        PyObject* const* args,
+                        Py_ssize_t nargs,
+                        PyObject* kwnames)
+{
+  PyObject* values[3];
+  PyObject* path_bytes = NULL;
+  Py_ssize_t workers = 0;
+
+  // note: name is a borrowed reference
+  static const char* kwlist[] = { "path", "workers", "name", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  PyObject* name = values[2];
+  if (values[1] != NULL)
+  {
+    workers = PyLong_AsSsize_t(values[1]);
+    if (workers == -1 && PyErr_Occurred())
+      return NULL;
+  }
+
+  if (!PyUnicode_FSConverter(values[0], &path_bytes))
+    return NULL;
+
+  std::vector<ChannelCheckpoint> channels;
+  std::string err;
+  bool ret;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = LoadCheckpoint(PyBytes_AS_STRING(path_bytes), channels, err);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(path_bytes);
+  if (!ret)
+  {
+    PyErr_SetString(PyExc_OSError, err.c_str());
+    return NULL;
+  }
+
+  PyGrid* self = (PyGrid*) PyObject_CallFunctionObjArgs((PyObject*) type,
+                                                        name, NULL);
+  if (self == NULL)
+    return NULL;
+
+  std::vector<std::shared_ptr<ChannelContext>> contexts;
+  for (auto& channel : channels)
+  {
+    auto handle = self->grid->AllocateChannel(channel.name);
+    if (!handle)
+    {
+      PyErr_Format(PyExc_ValueError, "Failed to allocate channel '%s'",
+                   channel.name.c_str());
+      Py_DECREF(self);
+      return NULL;
+    }
+    contexts.push_back(PyGridChannelContext(self, channel.name, *handle));
+  }
+
+  if (workers <= 0)
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  workers = std::min<Py_ssize_t>(workers, channels.size());
+
+  std::atomic<size_t> next(0);
+  std::mutex err_lock;
+
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < channels.size(); )
+    {
+      std::string channel_err;
+      if (!RestoreChannel(self, *contexts[i], channels[i], channel_err))
+      {
+        std::lock_guard<std::mutex> lock(err_lock);
+        if (err.empty())
+          err = channels[i].name + ": " + channel_err;
+      }
+    }
+  };
+
+  Py_BEGIN_ALLOW_THREADS
+  std::vector<std::thread> threads;
+  for (Py_ssize_t i = 1; i < workers; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads)
+    thread.join();
+  Py_END_ALLOW_THREADS
+
+  if (!err.empty())
+  {
+    PyErr_SetString(PyExc_RuntimeError, err.c_str());
+    Py_DECREF(self);
+    return NULL;
+  }
+
+  return (PyObject*) self;
+}
+
+
+} // end of extern "C"
@@ -8,14 +8,112 @@
 
 #include "gridmodule.h"
 
+#include <climits>
+#include <cstring>
 #include <iostream>
 
 #include <grid/base/basegrid.h>
+#include <grid/fw/cluster.h>
 #include <grid/fw/grid.h>
+#include <grid/fw/pipeline.h>
 
 #include <Python.h>
 #include <structmember.h>
 
+
+//
+// LockGridContext locks the grid context and releases the GIL while waiting
+// for a native thread holding the lock.
+//
+std::unique_lock<std::mutex> LockGridContext(GridContext& context)
+{
+  std::unique_lock<std::mutex> lock(context.lock, std::try_to_lock);
+  if (!lock.owns_lock())
+  {
+    Py_BEGIN_ALLOW_THREADS
+    lock.lock();
+    Py_END_ALLOW_THREADS
+  }
+  return lock;
+}
+
+
+//
+// SnapshotCell is a helper function to append a cell, and any cells of a
+// pipeline or cluster, to the JSON list of cells of a channel.
+//
+static void SnapshotCell(std::string& json,
+                         const std::string& path,
+                         grid::Cell& cell,
+                         bool values)
+{
+  grid::Cluster*  cluster =  cell.ClusterInterface();
+  grid::Pipeline* pipeline = cell.PipelineInterface();
+
+  if (json.back() != '[')
+    json.push_back(',');
+
+  json.append("{\"path\":");
+  GridStreamerAppendJSONString(json, path.data(), path.size());
+  json.append(",\"type\":");
+  GridStreamerAppendJSONString(json, cell.Type().data(), cell.Type().size());
+  json.append(",\"kind\":");
+  json.append(pipeline != nullptr ? "\"pipeline\"" :
+              cluster != nullptr ? "\"cluster\"" : "\"cell\"");
+  json.append(values ? ",\"parameters\":{" : ",\"parameters\":[");
+
+  auto& params = cell.GetParameters();
+  for (auto param_it = params.Begin(); param_it != params.End(); ++param_it)
+  {
+    if (json.back() != '{' && json.back() != '[')
+      json.push_back(',');
+
+    const std::string& key = param_it.Key();
+    GridStreamerAppendJSONString(json, key.data(), key.size());
+    if (!values)
+      continue;
+
+    json.push_back(':');
+    size_t arg_buf_sz = param_it->GetArgumentBufferSize();
+    char arg_buf[arg_buf_sz];
+    size_t len = json.size();
+    if (!param_it->GetValues(arg_buf, arg_buf_sz) ||
+        !GridStreamerFormatArguments(json, arg_buf, arg_buf_sz,
+                                     param_it->GetSignature()))
+    {
+      json.resize(len);
+      json.append("null");
+    }
+  }
+  json.append(values ? "}}" : "]}");
+
+  if (cluster == nullptr && pipeline == nullptr)
+    return;
+
+  grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
+    pipeline->GetCells() : cluster->GetCells();
+
+  for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
+    SnapshotCell(json, path + '/' + cell_it.Key(), **cell_it, values);
+}
+
+
+//
+// CreateChannelContext creates a new context for a channel of the grid.
+//
+std::shared_ptr<ChannelContext>
+CreateChannelContext(GridContext& context,
+                     const std::shared_ptr<grid::Channel>& channel)
+{
+  auto channel_context = std::make_shared<ChannelContext>();
+  channel_context->channel = channel;
+  channel_context->indexed = false;
+  channel_context->memory = std::make_shared<ChannelMemory>();
+  AssignChannelPlacement(context, channel_context->placement);
+  return channel_context;
+}
+
+
 extern "C" {
 
 //
@@ -24,31 +122,107 @@ extern "C" {
 static PyObject* PyGridStr(PyGrid* self)
 {
   PyObject* name = self->name;
-  Py_XINCREF(name);
+  if (name == NULL)
+    return PyObject_Repr((PyObject*) self);
+
+  Py_INCREF(name);
   return name;
 }
 
 
+//
+// PyGridChannelContext returns the context of a channel of the grid, which is
+// created if it doesn't exist.
+//
+std::shared_ptr<ChannelContext>
+PyGridChannelContext(PyGrid* self,
+                     const std::string& name,
+                     const std::shared_ptr<grid::Channel>& channel)
+{
+  std::lock_guard<std::mutex> lock(self->context->channels_lock);
+
+  auto& context = self->context->channels[name];
+  if (context == nullptr || context->channel != channel)
+    context = CreateChannelContext(*self->context, channel);
+  return context;
+}
+
+
+//
+// PyGridAddChannelContext adds the context of a channel, such as of a channel
+// of a pool, by name.
+//
+void PyGridAddChannelContext(PyGrid* self,
+                             const std::string& name,
+                             const std::shared_ptr<ChannelContext>& context)
+{
+  std::shared_ptr<ChannelContext> prev;
+  std::lock_guard<std::mutex> lock(self->context->channels_lock);
+
+  // note: any previous context is released after unlocking
+  auto& entry = self->context->channels[name];
+  prev = std::move(entry);
+  entry = context;
+}
+
+
+//
+// PyGridFindChannelContext returns the context of a channel by name or
+// nullptr.
+//
+std::shared_ptr<ChannelContext>
+PyGridFindChannelContext(PyGrid* self, const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(self->context->channels_lock);
+
+  auto it = self->context->channels.find(name);
+  return it != self->context->channels.end() ? it->second : nullptr;
+}
+
+
+//
+// PyGridRemoveChannelContext removes the context of a channel by name.
+//
+void PyGridRemoveChannelContext(PyGrid* self, const std::string& name)
+{
+  std::shared_ptr<ChannelContext> context;
+  std::lock_guard<std::mutex> lock(self->context->channels_lock);
+
+  auto it = self->context->channels.find(name);
+  if (it != self->context->channels.end())
+  {
+    // note: the context is released after unlocking
+    context = std::move(it->second);
+    self->context->channels.erase(it);
+  }
+}
+
+
 //
 // GridAllocateChannel allocates a new Channel in Grid with a required name
-// and optional layout.
+// and optional layout and NUMA node.
 //
 static PyObject*
-PyGridAllocateChannel(PyGrid* self, PyObject* args, PyObject* kwargs)
+PyGridAllocateChannel(PyGrid* self,
+                      PyObject* const* args,
+                      Py_ssize_t nargs,
+                      PyObject* kwnames)
 {
-  PyObject* name = NULL;
-  PyObject* layout = NULL;
+  PyObject* values[3];
 
-  // note: name, layout are borrowed references
-  static const char* kwlist[] = { "name", "layout", NULL };
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O",
-                                  (char**) kwlist, &name, &layout))
+  // note: name, layout, numa_node are borrowed references
+  static const char* kwlist[] = { "name", "layout", "numa_node", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
   {
     PyErr_SetString(PyExc_AttributeError,
                     "Invalid arguments");
     return NULL;
   }
 
+  PyObject* name = values[0];
+  PyObject* layout = values[1];
+  PyObject* pynode = values[2];
+
   const char* name_utf8 = PyUnicode_AsUTF8(name);
   if (name_utf8 == NULL || strlen(name_utf8) == 0)
   {
@@ -57,7 +231,23 @@ PyGridAllocateChannel(PyGrid* self, PyObject* args, PyObject* kwargs)
     return NULL;
   }
 
+  int node = -1;
+  if (pynode != NULL && pynode != Py_None)
+  {
+    long value = PyLong_AsLong(pynode);
+    if (value == -1 && PyErr_Occurred())
+      return NULL;
+    if (value < 0 || value > INT_MAX || !IsNUMANode(value))
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid NUMA node %ld", value);
+      return NULL;
+    }
+    node = value;
+  }
+
+  auto lock = LockGridContext(*self->context);
   auto channel = self->grid->AllocateChannel(name_utf8);
+  lock.unlock();
   if (!channel)
   {
     PyErr_SetString(PyExc_AttributeError,
@@ -65,9 +255,11 @@ PyGridAllocateChannel(PyGrid* self, PyObject* args, PyObject* kwargs)
     return NULL;
   }
 
-  PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(&pychannel_type, 0);
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(state->channel_type, 0);
   if (pychannel == NULL)
   {
+    lock.lock();
     self->grid->RemoveChannel(channel);
     return PyErr_NoMemory();
   }
@@ -77,13 +269,25 @@ PyGridAllocateChannel(PyGrid* self, PyObject* args, PyObject* kwargs)
   Py_INCREF(name);  // note: borrowed reference
   pychannel->name = name;
   pychannel->channel = *channel;
+  pychannel->context = PyGridChannelContext(self, name_utf8, *channel);
 
-  if (layout != NULL && !PyChannelCompile(pychannel, layout))
+  // note: the channel is built on the node, so the node is set first
+  if (node >= 0)
+    SetChannelNUMANode(pychannel->context->placement, node);
+
+  if (layout != NULL)
   {
-    self->grid->RemoveChannel(channel);
-    Py_DECREF(pychannel);
-    // note: error is set in PyChannelCompile
-    return NULL;
+    PyObject* ret = PyChannelCompile(pychannel, layout);
+    if (ret == NULL)
+    {
+      PyGridRemoveChannelContext(self, name_utf8);
+      lock = LockGridContext(*self->context);
+      self->grid->RemoveChannel(channel);
+      Py_DECREF(pychannel);
+      // note: error is set in PyChannelCompile
+      return NULL;
+    }
+    Py_DECREF(ret);
   }
 
   return (PyObject*) pychannel;
@@ -100,17 +304,22 @@ PyGridGetChannels(PyGrid* self, PyObject* args)
   if (list == NULL)
     return NULL;
 
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  auto lock = LockGridContext(*self->context);
   grid::Registry<grid::Channel>& channels = self->grid->GetChannels();
   for (auto chan_it = channels.Begin(); chan_it != channels.End(); ++chan_it)
   {
-    PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(&pychannel_type, 0);
+    PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(state->channel_type, 0);
 
     Py_INCREF(self);
     pychannel->grid = self;
     pychannel->channel = *chan_it;
+    pychannel->context = PyGridChannelContext(self, chan_it.Key(), *chan_it);
     pychannel->name = PyUnicode_FromString(chan_it.Key().c_str());
 
-    if (PyList_Append(list, (PyObject*) pychannel) != 0)
+    int ret = PyList_Append(list, (PyObject*) pychannel);
+    Py_DECREF(pychannel);
+    if (ret != 0)
     {
       Py_DECREF(list);
       return NULL;
@@ -121,34 +330,194 @@ PyGridGetChannels(PyGrid* self, PyObject* args)
 }
 
 
+//
+// PyGridGetItem implements grid[path] and returns the channel ("channel"),
+// cell ("channel/pipeline/cell"), or parameter ("channel/pipeline/cell.param")
+//
+static PyObject* PyGridGetItem(PyGrid* self, PyObject* pypath)
+{
+  const char* path = PyUnicode_AsUTF8(pypath);
+  if (path == NULL)
+    return NULL;
+
+  const char* sep = strchr(path, '/');
+  std::string name = sep != NULL ? std::string(path, sep - path) : path;
+
+  auto context = PyGridFindChannelContext(self, name);
+  if (context == nullptr)
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", path);
+    return NULL;
+  }
+
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(state->channel_type, 0);
+  if (pychannel == NULL)
+    return NULL;
+
+  Py_INCREF(self);
+  pychannel->grid = self;
+  pychannel->channel = context->channel;
+  pychannel->context = context;
+  pychannel->name = PyUnicode_FromString(name.c_str());
+
+  if (sep == NULL)
+    return (PyObject*) pychannel;
+
+  PyObject* item = PyChannelLookup(pychannel, sep + 1);
+  Py_DECREF(pychannel);
+  return item;
+}
+
+
+//
+// PyGridSnapshot returns the topology of all channels, optionally including
+// all parameter values, as JSON encoded bytes.
+//
+static PyObject*
+PyGridSnapshot(PyGrid* self,
+               PyObject* const* args,
+               Py_ssize_t nargs,
+               PyObject* kwnames)
+{
+  PyObject* pyvalues;
+
+  static const char* kwlist[] = { "values", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyvalues))
+    return NULL;
+
+  int values = pyvalues != NULL ? PyObject_IsTrue(pyvalues) : 1;
+  if (values < 0)
+    return NULL;
+
+  std::string json = "{\"channels\":[";
+
+  auto lock = LockGridContext(*self->context);
+
+  grid::Registry<grid::Channel>& channels = self->grid->GetChannels();
+  for (auto chan_it = channels.Begin(); chan_it != channels.End(); ++chan_it)
+  {
+    if (json.back() != '[')
+      json.push_back(',');
+
+    const std::string& name = chan_it.Key();
+    json.append("{\"name\":");
+    GridStreamerAppendJSONString(json, name.data(), name.size());
+    json.append(",\"state\":\"");
+    json.append(GridStreamerStateName(chan_it->GetState()));
+    json.append("\",\"cells\":[");
+
+    grid::Registry<grid::Pipeline>& pipelines = chan_it->GetPipelines();
+    for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+      SnapshotCell(json, pipe_it.Key(), **pipe_it, values);
+
+    json.append("]}");
+  }
+  json.append("]}");
+
+  return PyBytes_FromStringAndSize(json.data(), json.size());
+}
+
+
+//
+// PyGridSetPlacement sets the policy for placing the threads of channels that
+// are added afterwards: "cpu" or "numa" round-robin, or "none".
+//
+static PyObject* PyGridSetPlacement(PyGrid* self, PyObject* pypolicy)
+{
+  const char* name = PyUnicode_AsUTF8(pypolicy);
+  if (name == NULL)
+    return NULL;
+
+  PlacementPolicy policy;
+  if (!strcmp(name, "none"))
+    policy = kPlacementNone;
+  else if (!strcmp(name, "cpu"))
+    policy = kPlacementCPU;
+  else if (!strcmp(name, "numa"))
+    policy = kPlacementNUMA;
+  else
+  {
+    PyErr_Format(PyExc_ValueError, "Invalid placement policy '%s'", name);
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(self->context->channels_lock);
+  self->context->placement_policy = policy;
+  self->context->placement_next = 0;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyGridSetup is a helper function to initialize the grid with an optional
+// name.
+//
+static void PyGridSetup(PyGrid* self, PyObject* name)
+{
+  Py_XINCREF(name);
+  Py_XSETREF(self->name, name);
+  self->grid = std::make_shared<grid::BaseGrid>();
+  self->context = std::make_shared<GridContext>();
+}
+
+
 //
 // PyGridInit implements __init__
 //
 static int PyGridInit(PyGrid* self, PyObject* args, PyObject* kwargs)
 {
-  PyObject* name;
+  PyObject* name = NULL;
 
   // note: name is a borrowed references
   static const char* kwlist[] = { "name", NULL };
   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", (char**) kwlist, &name))
     return -1;
 
-  Py_XINCREF(name);
-  self->name = name;
-  self->grid = std::make_shared<grid::BaseGrid>();
-
+  PyGridSetup(self, name);
   return 0;
 }
 
 
+//
+// PyGridVectorcall implements Grid(name) with the vectorcall protocol, which
+// avoids creating the argument tuple and dictionary for __new__ and __init__.
+//
+PyObject* PyGridVectorcall(PyObject* type,
+                           PyObject* const* args,
+                           size_t nargsf,
+                           PyObject* kwnames)
+{
+  PyTypeObject* grid_type = (PyTypeObject*) type;
+  Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+  PyObject* name;
+
+  // note: name is a borrowed reference
+  static const char* kwlist[] = { "name", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &name))
+    return NULL;
+
+  PyGrid* self = (PyGrid*) grid_type->tp_alloc(grid_type, 0);
+  if (self == NULL)
+    return NULL;
+
+  PyGridSetup(self, name);
+  return (PyObject*) self;
+}
+
+
 //
 // PyGridDealloc is the deallocator
 //
 static void PyGridDealloc(PyGrid* self)
 {
+  PyTypeObject* type = Py_TYPE(self);
+
   Py_XDECREF(self->name);
   self->~PyGrid();
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -156,8 +525,8 @@ static PyMethodDef pygrid_methods[] =
 {
   {
     "allocate_channel",
-    (PyCFunction) PyGridAllocateChannel,
-    METH_VARARGS | METH_KEYWORDS,
+    (PyCFunction)(void(*)(void)) PyGridAllocateChannel,
+    METH_FASTCALL | METH_KEYWORDS,
     "Allocate a new channel and add it to the grid"
   },
   {
@@ -166,6 +535,36 @@ static PyMethodDef pygrid_methods[] =
     METH_NOARGS,
     "Return all channels in the Grid"
   },
+  {
+    "checkpoint",
+    (PyCFunction) PyGridCheckpoint,
+    METH_O,
+    "Save the layout, state, and parameter values of all channels to a file"
+  },
+  {
+    "create_pool",
+    (PyCFunction)(void(*)(void)) PyGridCreatePool,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Create a pool of channels with a layout that are built in the background"
+  },
+  {
+    "restore",
+    (PyCFunction)(void(*)(void)) PyGridRestore,
+    METH_FASTCALL | METH_KEYWORDS | METH_CLASS,
+    "Create a grid from a checkpoint file building channels in parallel"
+  },
+  {
+    "set_placement",
+    (PyCFunction) PyGridSetPlacement,
+    METH_O,
+    "Place the threads of new channels round-robin by 'cpu' or 'numa' node"
+  },
+  {
+    "snapshot",
+    (PyCFunction)(void(*)(void)) PyGridSnapshot,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the topology and parameter values of all channels as JSON bytes"
+  },
   {
     NULL  /* Sentinel */
   }
@@ -186,21 +585,28 @@ static PyMemberDef pygrid_members[] =
 };
 
 
-PyTypeObject pygrid_type =
-{
-  PyVarObject_HEAD_INIT(NULL, 0)
-  .tp_name = "gridstreamer.Grid",
-  .tp_basicsize = sizeof(PyGrid),
-  .tp_itemsize = 0,
-  .tp_dealloc = (destructor) PyGridDealloc,
-  .tp_str = (reprfunc) PyGridStr,
-  .tp_flags = Py_TPFLAGS_DEFAULT,
-  .tp_doc = PyDoc_STR(
-      "Grid provides the base for encapsulating the streaming network"),
-  .tp_methods = pygrid_methods,
-  .tp_members = pygrid_members,
-  .tp_init = (initproc) PyGridInit,
-  .tp_new = PyType_GenericNew,
+static PyType_Slot pygrid_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyGridDealloc },
+  { Py_tp_str, (void*) PyGridStr },
+  { Py_tp_doc, (void*) PyDoc_STR(
+      "Grid provides the base for encapsulating the streaming network") },
+  { Py_tp_methods, pygrid_methods },
+  { Py_tp_members, pygrid_members },
+  { Py_tp_init, (void*) PyGridInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { Py_mp_subscript, (void*) PyGridGetItem },
+  { 0, NULL }
+};
+
+
+PyType_Spec pygrid_spec =
+{
+  .name = "gridstreamer.Grid",
+  .basicsize = sizeof(PyGrid),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pygrid_slots,
 };
 
 
@@ -34,6 +34,59 @@ std::string PythonifyName(const std::string& name)
 }
 
 
+//
+// InterpreterLock attaches the current thread to the interpreter. A thread
+// state of another interpreter is released and restored when unlocking. The
+// main interpreter uses the GILState API, so native threads can reuse their
+// thread states.
+//
+InterpreterLock::InterpreterLock(PyInterpreterState* interp)
+  : tstate_(NULL), saved_(NULL), ensured_(false)
+{
+#if PY_VERSION_HEX >= 0x030D0000
+  PyThreadState* current = PyThreadState_GetUnchecked();
+#else
+  // note: before 3.12, this is the thread state holding the GIL, which might
+  // belong to another thread
+  PyThreadState* current = _PyThreadState_UncheckedGet();
+  if (current != NULL && current->thread_id != PyThread_get_thread_ident())
+    current = NULL;
+#endif
+
+  if (current != NULL && PyThreadState_GetInterpreter(current) == interp)
+    return;
+
+  if (current != NULL)
+    saved_ = PyEval_SaveThread();
+
+  if (interp == NULL || interp == PyInterpreterState_Main())
+  {
+    gstate_ = PyGILState_Ensure();
+    ensured_ = true;
+  }
+  else
+  {
+    tstate_ = PyThreadState_New(interp);
+    PyEval_RestoreThread(tstate_);
+  }
+}
+
+
+InterpreterLock::~InterpreterLock()
+{
+  if (ensured_)
+    PyGILState_Release(gstate_);
+  else if (tstate_ != NULL)
+  {
+    PyThreadState_Clear(tstate_);
+    PyThreadState_DeleteCurrent();
+  }
+
+  if (saved_ != NULL)
+    PyEval_RestoreThread(saved_);
+}
+
+
 //
 // PyGridStreamerCellTypes returns a list of cell types.
 //
@@ -60,78 +113,197 @@ static PyMethodDef GridStreamerMethods[] =
     METH_NOARGS,
     "Return a list of registered cell types"
   },
+  {
+    "stats",
+    (PyCFunction)(void(*)(void)) GridStreamerStats,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the counters and histograms of the binding, optionally resetting them"
+  },
+  {
+    "trace_start",
+    (PyCFunction)(void(*)(void)) GridStreamerTraceStart,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Start tracing the binding and channels, keeping size events per thread"
+  },
+  {
+    "trace_stop",
+    GridStreamerTraceStop,
+    METH_NOARGS,
+    "Stop tracing; the events are kept until the next trace_start()"
+  },
+  {
+    "trace_mark",
+    GridStreamerTraceMark,
+    METH_O,
+    "Record an instant event with the name in the trace"
+  },
+  {
+    "trace_dump",
+    (PyCFunction)(void(*)(void)) GridStreamerTraceDump,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return the trace as Chrome trace event JSON, or write it to the path"
+  },
+  {
+    "profile_start",
+    (PyCFunction)(void(*)(void)) GridStreamerProfileStart,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Start profiling the cells, measuring one in rate callback events"
+  },
+  {
+    "profile_stop",
+    GridStreamerProfileStop,
+    METH_NOARGS,
+    "Stop profiling the cells; the profiles are kept"
+  },
+  {
+    "_shard_worker",
+    (PyCFunction)(void(*)(void)) GridStreamerShardWorker,
+    METH_FASTCALL,
+    "Run a shard of a ShardedGrid; used by the worker processes"
+  },
   {
     NULL
   }
 };
 
 
+static int GridStreamerExec(PyObject* module);
+static int GridStreamerTraverse(PyObject* module, visitproc visit, void* arg);
+static int GridStreamerClear(PyObject* module);
+
+
+static PyModuleDef_Slot GridStreamerSlots[] =
+{
+  { Py_mod_exec, (void*) GridStreamerExec },
+#if PY_VERSION_HEX >= 0x030C0000
+  { Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+  { Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#endif
+  { 0, NULL }
+};
+
+
 static struct PyModuleDef GridStreamerModule = {
     PyModuleDef_HEAD_INIT,
     "gridstreamer",
     "Python interface for the GridStreamer project",
-    -1,
-    GridStreamerMethods
+    sizeof(GridStreamerState),
+    GridStreamerMethods,
+    GridStreamerSlots,
+    GridStreamerTraverse,
+    GridStreamerClear,
+    NULL
 };
 
 
-PyMODINIT_FUNC
-PyInit_pygridstreamer(void)
+//
+// GridStreamerGetState returns the module state from the module that created
+// the type or any base type.
+//
+GridStreamerState* GridStreamerGetState(PyTypeObject* type)
 {
-  PyObject* module = PyModule_Create(&GridStreamerModule);
-  if (module == NULL)
-    return NULL;
-
-  if (PyType_Ready(&pygrid_type) < 0)
-    return NULL;
-
-  Py_INCREF(module);
-  if (PyModule_AddObject(module, "Grid", (PyObject *) &pygrid_type) < 0) {
-    Py_DECREF(&pygrid_type);
-    Py_DECREF(module);
-    return NULL;
+#if PY_VERSION_HEX >= 0x030B0000
+  PyObject* module = PyType_GetModuleByDef(type, &GridStreamerModule);
+  return module != NULL ? (GridStreamerState*) PyModule_GetState(module) : NULL;
+#else
+  PyObject* mro = type->tp_mro;
+  for (Py_ssize_t i = 0; mro != NULL && i < PyTuple_GET_SIZE(mro); i++)
+  {
+    PyTypeObject* base = (PyTypeObject*) PyTuple_GET_ITEM(mro, i);
+    if (!PyType_HasFeature(base, Py_TPFLAGS_HEAPTYPE))
+      continue;
+
+    PyObject* module = ((PyHeapTypeObject*) base)->ht_module;
+    if (module != NULL && PyModule_GetDef(module) == &GridStreamerModule)
+      return (GridStreamerState*) PyModule_GetState(module);
   }
 
-  if (PyType_Ready(&pychannel_type) < 0)
-    return NULL;
+  PyErr_SetString(PyExc_TypeError, "Not a gridstreamer type");
+  return NULL;
+#endif
+}
 
-  Py_INCREF(module);
-  if (PyModule_AddObject(module, "Channel", (PyObject *) &pychannel_type) < 0) {
-    Py_DECREF(&pychannel_type);
-    Py_DECREF(module);
-    return NULL;
-  }
 
-  if (PyType_Ready(&pycell_type) < 0)
-    return NULL;
+//
+// GridStreamerAddType is a helper function to create a type of the module
+// and add it to the module.
+//
+static bool
+GridStreamerAddType(PyObject* module, PyType_Spec* spec, PyTypeObject*& type)
+{
+  type = (PyTypeObject*) PyType_FromModuleAndSpec(module, spec, NULL);
+  return type != NULL && PyModule_AddType(module, type) == 0;
+}
 
-  Py_INCREF(module);
-  if (PyModule_AddObject(module, "Cell", (PyObject *) &pycell_type) < 0) {
-    Py_DECREF(&pycell_type);
-    Py_DECREF(module);
-    return NULL;
-  }
 
-  if (PyType_Ready(&pyparameter_type) < 0)
-    return NULL;
+//
+// GridStreamerExec initializes the module and its state. It is executed once
+// for every interpreter that imports the module.
+//
+static int GridStreamerExec(PyObject* module)
+{
+  GridStreamerState* state = (GridStreamerState*) PyModule_GetState(module);
 
-  Py_INCREF(module);
-  if (PyModule_AddObject(module, "Cell", (PyObject *) &pyparameter_type) < 0) {
-    Py_DECREF(&pyparameter_type);
-    Py_DECREF(module);
-    return NULL;
-  }
+  if (!GridStreamerAddType(module, &pygrid_spec, state->grid_type) ||
+      !GridStreamerAddType(module, &pychannel_spec, state->channel_type) ||
+      !GridStreamerAddType(module, &pycell_spec, state->cell_type) ||
+      !GridStreamerAddType(module, &pyparameter_spec, state->parameter_type) ||
+      !GridStreamerAddType(module, &pycallback_spec, state->callback_type) ||
+      !GridStreamerAddType(module, &pypool_spec, state->pool_type) ||
+      !GridStreamerAddType(module, &pyshardedgrid_spec,
+                           state->sharded_grid_type) ||
+      !GridStreamerAddType(module, &pyshardedchannel_spec,
+                           state->sharded_channel_type) ||
+      !GridStreamerAddCAPI(module))
+    return -1;
 
-  if (PyType_Ready(&pycallback_type) < 0)
-    return NULL;
+  // note: type specs can only define a vectorcall slot since Python 3.14
+  state->grid_type->tp_vectorcall = PyGridVectorcall;
+
+  return 0;
+}
 
-  Py_INCREF(module);
-  if (PyModule_AddObject(module, "Cell", (PyObject *) &pycallback_type) < 0) {
-    Py_DECREF(&pycallback_type);
-    Py_DECREF(module);
-    return NULL;
-  }
 
+static int GridStreamerTraverse(PyObject* module, visitproc visit, void* arg)
+{
+  GridStreamerState* state = (GridStreamerState*) PyModule_GetState(module);
+  if (state == NULL)
+    return 0;
+
+  Py_VISIT(state->grid_type);
+  Py_VISIT(state->channel_type);
+  Py_VISIT(state->cell_type);
+  Py_VISIT(state->parameter_type);
+  Py_VISIT(state->callback_type);
+  Py_VISIT(state->pool_type);
+  Py_VISIT(state->sharded_grid_type);
+  Py_VISIT(state->sharded_channel_type);
+  return 0;
+}
 
-  return module;
+
+static int GridStreamerClear(PyObject* module)
+{
+  GridStreamerState* state = (GridStreamerState*) PyModule_GetState(module);
+  if (state == NULL)
+    return 0;
+
+  Py_CLEAR(state->grid_type);
+  Py_CLEAR(state->channel_type);
+  Py_CLEAR(state->cell_type);
+  Py_CLEAR(state->parameter_type);
+  Py_CLEAR(state->callback_type);
+  Py_CLEAR(state->pool_type);
+  Py_CLEAR(state->sharded_grid_type);
+  Py_CLEAR(state->sharded_channel_type);
+  return 0;
+}
+
+
+PyMODINIT_FUNC
+PyInit_pygridstreamer(void)
+{
+  return PyModuleDef_Init(&GridStreamerModule);
 }
@@ -11,10 +11,31 @@
 
 #include <Python.h>
 
+#include <sched.h>
+#include <sys/types.h>
+
+#include <grid/builder/builder.h>
 #include <grid/fw/grid.h>
 #include <grid/util/arguments.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Critical sections lock python objects on free-threaded builds and are
+// no-ops with the GIL; they are only defined by Python 3.13 and later.
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
 
 
 // Helper functions to read and write arguments between Python arguments
@@ -25,16 +46,637 @@
 PyObject* PyGridStreamerReadArguments(void*, size_t, const unsigned long*);
 int PyGridStreamerWriteArguments(PyObject*, void*, size_t, const unsigned long*);
 
+// Helper function to write a single number to an argument buffer for
+// parameters with a single integer or floating point argument.
+bool GridStreamerWriteNumber(double, void*, size_t, const unsigned long*);
+
+// Helper functions to append a (quoted) JSON string, or the arguments of an
+// argument buffer as a JSON array, to a string.
+void GridStreamerAppendJSONString(std::string&, const char*, size_t);
+bool GridStreamerFormatArguments(std::string&, const void*, size_t,
+                                 const unsigned long*);
+
+// Helper functions to serialize the arguments of an argument buffer to bytes
+// and back. Deserialized string arguments are constructed in the argument
+// buffer and must be released with GridStreamerReleaseArguments, as must
+// the string arguments of a buffer filled by Parameter::GetValues or
+// constructed with GridStreamerConstructArguments before it's written.
+void GridStreamerSerializeArguments(std::string&, const void*, size_t,
+                                    const unsigned long*);
+bool GridStreamerDeserializeArguments(const char*&, const char*, void*, size_t,
+                                      const unsigned long*);
+void GridStreamerConstructArguments(void*, size_t, const unsigned long*);
+void GridStreamerReleaseArguments(void*, size_t, const unsigned long*);
+
+// Helper function to match the arguments of a METH_FASTCALL | METH_KEYWORDS
+// call to a NULL terminated keyword list; missing arguments are NULL.
+bool GridStreamerParseArguments(PyObject* const*, Py_ssize_t, PyObject*,
+                                const char* const*, Py_ssize_t, PyObject**);
+
+// Helper functions to return the name of a channel state and the state for a
+// name (or kStateInvalid).
+const char* GridStreamerStateName(grid::State state);
+grid::State GridStreamerStateFromName(const char* name);
+
 // Helper function to convert camelCase/CamelCase to snake_case
 std::string PythonifyName(const std::string& name);
 
+
+// StatsHistogram keeps the count, total, maximum, and power of two buckets of
+// durations in nanoseconds. Updates are lock-free and can be made from any
+// thread.
+struct StatsHistogram
+{
+  static const int kBuckets = 40;
+
+  void Add(uint64_t ns);
+  void Merge(const StatsHistogram& other);
+  void Reset();
+
+  std::atomic<uint64_t>             count{0};
+  std::atomic<uint64_t>             total{0};
+  std::atomic<uint64_t>             max{0};
+  std::atomic<uint64_t>             buckets[kBuckets] = {};
+};
+
+// Counters and histograms of the binding that are reported by stats(). They
+// are kept in shards per thread, which are combined when reading them. The
+// durations of getting and setting parameters are sampled.
+enum StatsCounter
+{
+  kStatsCallbackReceived,
+  kStatsCallbackDispatched,
+  kStatsCallbackDropped,
+  kStatsParameterGet,
+  kStatsParameterSet,
+  kStatsCounterCount
+};
+
+enum StatsTimer
+{
+  kStatsGILWait,
+  kStatsHandler,
+  kStatsParameterGetTime,
+  kStatsParameterSetTime,
+  kStatsCompile,
+  kStatsSetState,
+  kStatsTimerCount
+};
+
+void StatsCount(StatsCounter counter);
+void StatsRecord(StatsTimer timer, uint64_t ns);
+
+// Count a frequent operation and return the start time if the duration of
+// the operation is sampled (one in kStatsSampleRate per thread), or 0.
+const uint32_t kStatsSampleRate = 64;
+uint64_t StatsCountSampled(StatsCounter counter);
+
+// Return the time of the monotonic clock in nanoseconds.
+inline uint64_t StatsNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Return a dictionary of a histogram.
+PyObject* StatsHistogramToDict(const StatsHistogram& histogram);
+
+
+// LatencyHistogram keeps latencies in nanoseconds in buckets by the magnitude
+// of the value, with linear sub-buckets for each magnitude like an HDR
+// histogram, so percentiles are within about 3% of the recorded values.
+// Updates are lock-free and can be made from any thread.
+struct LatencyHistogram
+{
+  static const int kSubBits = 5;
+  static const int kMaxBits = 40;
+  static const int kBuckets = (kMaxBits - kSubBits + 1) << kSubBits;
+
+  void Add(uint64_t ns);
+  uint64_t Percentile(double fraction) const;
+  void Reset();
+
+  std::atomic<uint64_t>             count{0};
+  std::atomic<uint64_t>             total{0};
+  std::atomic<uint64_t>             min{UINT64_MAX};
+  std::atomic<uint64_t>             max{0};
+  std::atomic<uint64_t>             buckets[kBuckets] = {};
+};
+
+// LatencyMonitor keeps the latency histograms of the stages of a channel,
+// such as "source_to_sink" or a pipeline. Latencies are recorded by cells or
+// extensions that see the buffer timestamps through the C API, or from
+// Python. A handler can be called, at most once per interval, when a latency
+// exceeds the threshold. Stages are never removed, so they are recorded
+// without a lock; the handler and its interpreter are protected by the lock.
+class LatencyMonitor;
+
+struct LatencyStage
+{
+  LatencyStage(LatencyMonitor* monitor, const std::string& name)
+    : monitor(monitor), name(name) {}
+
+  LatencyMonitor*                   monitor;
+  std::string                       name;
+  LatencyHistogram                  histogram;
+};
+
+class LatencyMonitor
+{
+ public:
+  ~LatencyMonitor();
+
+  // Return the stage for the name, adding it if it doesn't exist.
+  LatencyStage* GetStage(const std::string& name);
+
+  // Record a latency of a stage; can be called from any thread.
+  void Record(LatencyStage& stage, uint64_t ns);
+
+  // Set or clear (NULL) the handler and threshold; requires the GIL.
+  void SetThreshold(uint64_t ns, PyObject* handler, uint64_t interval);
+
+  // Return a dictionary of the percentiles by stage; requires the GIL.
+  PyObject* ToDict(bool reset);
+
+ private:
+  void Notify(LatencyStage& stage, uint64_t ns);
+
+  std::mutex                        lock_;
+  std::list<LatencyStage>           stages_;
+  std::atomic<uint64_t>             threshold_{0};
+  std::atomic<uint64_t>             interval_{0};
+  std::atomic<uint64_t>             notified_{0};
+  PyObject*                         handler_ = NULL;
+  PyInterpreterState*               interp_ = NULL;
+};
+
+
+// The tracer records spans and instant events of the binding and the channels
+// when enabled by trace_start(), with the thread and whether it held the GIL.
+// Names must be static strings; details are copied (and truncated).
+extern std::atomic<bool> trace_enabled;
+
+inline bool TraceEnabled()
+{
+  return trace_enabled.load(std::memory_order_relaxed);
+}
+
+void TraceRecord(char phase, const char* name, uint64_t start,
+                 uint64_t duration, const char* detail);
+
+inline void TraceInstant(const char* name, const char* detail = NULL)
+{
+  if (TraceEnabled())
+    TraceRecord('i', name, StatsNow(), 0, detail);
+}
+
+// Return the detail of a state transition of a channel ("name: from -> to")
+// if the tracer is enabled, or an empty string.
+std::string TraceStateDetail(const char* name,
+                             const grid::Channel& channel,
+                             grid::State state);
+
+// TraceSpan records the duration of a scope if the tracer is enabled when the
+// scope is entered.
+class TraceSpan
+{
+ public:
+  explicit TraceSpan(const char* name, const char* detail = NULL)
+    : name_(name), detail_(detail), start_(TraceEnabled() ? StatsNow() : 0) {}
+  ~TraceSpan()
+  {
+    if (start_ != 0)
+      TraceRecord('X', name_, start_, StatsNow() - start_, detail_);
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char*   name_;
+  const char*   detail_;
+  uint64_t      start_;
+};
+
+
+// ParameterKeyframe describes the value of a parameter at a time (in seconds)
+// relative to the start of an automation.
+struct ParameterKeyframe
+{
+  double time;
+  double value;
+};
+
+enum ParameterInterpolation
+{
+  kInterpolationLinear,
+  kInterpolationExponential,
+};
+
+// Schedule an automation for a parameter that is applied from a native
+// thread until the last keyframe is reached. Any current automation of the
+// parameter is replaced.
+void ScheduleParameter(std::shared_ptr<grid::Parameter> parameter,
+                       std::vector<ParameterKeyframe> keyframes,
+                       ParameterInterpolation interpolation,
+                       std::chrono::microseconds interval);
+
+// Cancel any automation of the parameter; returns false if there is none.
+bool CancelParameterSchedule(const grid::Parameter* parameter);
+
+
+// ParameterState keeps the state of a grid::Parameter that is shared by all
+// PyParameter objects of that parameter. The version is incremented for every
+// change through the binding, and watchers are called with the new value.
+// The watchers belong to the interpreter that created the state and are
+// protected by the lock.
+struct ParameterState
+{
+  ~ParameterState();
+
+  PyInterpreterState*               interp;
+  std::weak_ptr<grid::Parameter>    parameter;
+  std::atomic<uint64_t>             version;
+  std::atomic<uint64_t>             gets{0};
+  std::atomic<uint64_t>             sets{0};
+  std::atomic<bool>                 watched;
+  std::mutex                        lock;
+  std::list<PyObject*>              watchers;
+};
+
+// Return the (shared) state of the parameter; requires the GIL.
+std::shared_ptr<ParameterState>
+GetParameterState(const std::shared_ptr<grid::Parameter>& parameter);
+
+// Notify that the parameter was changed; can be called without the GIL.
+void ParameterChanged(const grid::Parameter* parameter);
+
+
+// CellProfile keeps the profile of a grid::Cell that is shared by all objects
+// of the cell: the number of callback events of the cell, the wall and CPU
+// time of the sampled events until they were dispatched to Python, and the
+// events waiting to be dispatched (queue). The profiles are only updated
+// while profiling is enabled, which is when the rate is not 0.
+struct CellProfile
+{
+  std::weak_ptr<grid::Cell>         cell;
+  std::atomic<uint64_t>             calls{0};
+  std::atomic<uint64_t>             samples{0};
+  std::atomic<uint64_t>             cpu_ns{0};
+  std::atomic<uint64_t>             wall_ns{0};
+  std::atomic<uint64_t>             max_ns{0};
+  std::atomic<int64_t>              queue{0};
+  std::atomic<int64_t>              queue_max{0};
+};
+
+extern std::atomic<uint32_t> profile_rate;
+
+// Return the (shared) profile of the cell.
+std::shared_ptr<CellProfile>
+GetCellProfile(const std::shared_ptr<grid::Cell>& cell);
+
+// ProfileScope profiles a callback event of a cell from when it is received
+// until it is dispatched (the scope is left). The CPU time is measured from
+// when the dispatch starts.
+class ProfileScope
+{
+ public:
+  explicit ProfileScope(CellProfile* profile);
+  ~ProfileScope();
+
+  void Dispatch();
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+ private:
+  CellProfile*  profile_;
+  uint64_t      wall_;
+  uint64_t      cpu_;
+};
+
+// Append the profiles of a cell and, for pipelines and clusters, of the cells
+// they contain to a list, optionally resetting them.
+bool GridStreamerCellProfiles(PyObject* list,
+                              const std::string& path,
+                              const std::shared_ptr<grid::Cell>& cell,
+                              bool reset);
+
+
+// Compile a layout string, or return the layout compiled earlier for the same
+// string if it is among the most recently used layouts. Can be called without
+// the GIL.
+std::shared_ptr<grid::Layout>
+CompileLayout(const std::string& text, std::string& err);
+
+
+// ChannelPlacement keeps the CPU affinity (empty for any CPU) and nice value
+// of the native threads of a channel. The threads are the threads started
+// while setting the state of the channel, which also inherit the affinity.
+// The NUMA node (or -1) is the preferred node for the memory allocated while
+// building the channel or setting its state, and the local and remote counts
+// are the pages allocated on or off the node during that time.
+// The lock protects the placement.
+struct ChannelPlacement
+{
+  std::mutex                        lock;
+  std::vector<int>                  cpus;
+  bool                              nice_set = false;
+  int                               nice = 0;
+  int                               numa_node = -1;
+  uint64_t                          numa_local = 0;
+  uint64_t                          numa_remote = 0;
+  std::vector<pid_t>                threads;
+};
+
+// PlacementScope applies the placement of a channel to the threads that are
+// started within the scope, such as by setting the state of the channel.
+class PlacementScope
+{
+ public:
+  explicit PlacementScope(ChannelPlacement& placement);
+  ~PlacementScope();
+
+  PlacementScope(const PlacementScope&) = delete;
+  PlacementScope& operator=(const PlacementScope&) = delete;
+
+ private:
+  ChannelPlacement*   placement_;
+  std::vector<int>    cpus_;
+  bool                nice_set_;
+  int                 nice_;
+  int                 numa_node_;
+  uint64_t            numa_hit_;
+  uint64_t            numa_foreign_;
+  std::vector<pid_t>  threads_;
+  cpu_set_t           saved_;
+  bool                restore_;
+  int                 policy_;
+  unsigned long       nodes_[16];
+  bool                restore_policy_;
+};
+
+// Set the affinity or nice value (or none) of the channel and apply it to
+// the threads of the channel; return 0 or the error number.
+int SetChannelAffinity(ChannelPlacement& placement,
+                       const std::vector<int>& cpus);
+int SetChannelPriority(ChannelPlacement& placement, const int* nice);
+
+// Return true if the NUMA node exists.
+bool IsNUMANode(int node);
+
+// Set the NUMA node (or -1) of the channel and the affinity to the CPUs of
+// the node; return 0 or the error number.
+int SetChannelNUMANode(ChannelPlacement& placement, int node);
+
+// Return the placement and the threads with their effective affinity, nice
+// value, and last CPU as a dictionary.
+PyObject* ChannelPlacementToDict(ChannelPlacement& placement);
+
+
+// BudgetPolicy is what happens to a callback event that would exceed the
+// memory budget of its channel: the event is dropped, waits until the events
+// before it were dispatched, or fails the channel, which drops all events.
+enum BudgetPolicy
+{
+  kBudgetDrop,
+  kBudgetBackpressure,
+  kBudgetError,
+};
+
+// ChannelMemory keeps the memory accounting of a channel: the net growth of
+// the heap while building the channel and setting its state, which holds the
+// cells and their buffers, and the callback events waiting to be dispatched
+// (queue). The budget (or 0 for none) limits their sum and is enforced when
+// the callback events are received. The handler is called with the bytes of
+// the channel when the budget is exceeded, at most once per second.
+class ChannelMemory
+{
+ public:
+  ~ChannelMemory();
+
+  // Reserve the memory of a callback event before it is dispatched, and
+  // release it afterwards; return false if the event is dropped. Reserving
+  // can wait for other events and must be called without the GIL.
+  bool Reserve(uint64_t bytes);
+  void Release(uint64_t bytes);
+
+  // Add the growth of the heap (negative if it shrank).
+  void AddHeap(int64_t bytes);
+
+  // Set or clear (0) the budget and handler (or NULL); requires the GIL.
+  void SetBudget(uint64_t bytes, BudgetPolicy policy, PyObject* handler);
+
+  // Return true if the channel failed by exceeding the budget.
+  bool Failed() const { return failed_; }
+
+  // Return a dictionary of the memory and budget; requires the GIL.
+  PyObject* ToDict(bool reset);
+
+ private:
+  uint64_t Total() const;
+  void Queue(uint64_t bytes);
+  void Notify(uint64_t bytes);
+
+  std::mutex                        lock_;
+  std::condition_variable           drained_;
+  std::atomic<int64_t>              heap_{0};
+  std::atomic<int64_t>              queue_{0};
+  std::atomic<int64_t>              queue_max_{0};
+  std::atomic<int64_t>              events_{0};
+  std::atomic<int>                  waiters_{0};
+  std::atomic<uint64_t>             budget_{0};
+  std::atomic<BudgetPolicy>         policy_{kBudgetDrop};
+  std::atomic<uint64_t>             exceeded_{0};
+  std::atomic<uint64_t>             dropped_{0};
+  std::atomic<bool>                 failed_{false};
+  std::atomic<uint64_t>             notified_{0};
+  PyObject*                         handler_ = NULL;
+  PyInterpreterState*               interp_ = NULL;
+};
+
+// MemoryScope adds the net growth of the heap within the scope, such as by
+// building the channel or setting its state, to the memory of the channel.
+class MemoryScope
+{
+ public:
+  explicit MemoryScope(ChannelMemory& memory);
+  ~MemoryScope();
+
+  MemoryScope(const MemoryScope&) = delete;
+  MemoryScope& operator=(const MemoryScope&) = delete;
+
+ private:
+  ChannelMemory&      memory_;
+  int64_t             heap_;
+};
+
+// Return the memory of the channel of a cell, or nullptr if the cell wasn't
+// registered with a channel.
+std::shared_ptr<ChannelMemory>
+FindCellMemory(const std::shared_ptr<grid::Cell>& cell);
+
+
+// ChannelContext keeps the binding state of a grid::Channel that is shared by
+// all PyChannel objects of that channel. The index maps the paths of all cells
+// ("pipeline/cell") and parameters ("pipeline/cell.parameter") of the
+// committed layout; it is built on demand and cleared when recompiling.
+// The lock protects the layout and the index. The statistics keep the
+// durations of compiling the channel and of setting its state, and the
+// latency monitor the latencies of the stages of the channel. The placement
+// keeps the affinity and priority of its threads, and the memory the memory
+// accounting and budget, which is shared with the callbacks of its cells.
+struct ChannelContext
+{
+  std::mutex                                                        lock;
+  std::shared_ptr<grid::Channel>                                    channel;
+  std::shared_ptr<grid::Layout>                                     layout;
+  std::string                                                       text;
+  bool                                                              indexed;
+  std::unordered_map<std::string, std::shared_ptr<grid::Cell>>      cells;
+  std::unordered_map<std::string, std::shared_ptr<grid::Parameter>> parameters;
+  StatsHistogram                                                    compile_stats;
+  StatsHistogram                                                    state_stats;
+  LatencyMonitor                                                    latency;
+  ChannelPlacement                                                  placement;
+  std::shared_ptr<ChannelMemory>                                    memory;
+};
+
+// Register the cells of the channel with the memory of the channel.
+void RegisterChannelMemory(ChannelContext& context);
+
+// Set the committed layout of the channel, or return it and its text.
+void SetChannelLayout(ChannelContext& context,
+                      const std::shared_ptr<grid::Layout>& layout,
+                      const std::string& text);
+std::shared_ptr<grid::Layout>
+GetChannelLayout(ChannelContext& context, std::string* text = NULL);
+
+// Return the cell or parameter for the path in the index, or nullptr.
+std::shared_ptr<grid::Cell>
+FindCell(ChannelContext& context, const std::string& path);
+std::shared_ptr<grid::Parameter>
+FindParameter(ChannelContext& context, const std::string& path);
+
+// Record the duration of compiling the channel (kStatsCompile) or setting its
+// state (kStatsSetState) since the start timestamp.
+void RecordChannelStats(ChannelContext& context, StatsTimer timer,
+                        uint64_t start);
+
+
+// PlacementPolicy places new channels round-robin on the allowed CPUs, or on
+// the allowed CPUs of the NUMA nodes.
+enum PlacementPolicy
+{
+  kPlacementNone,
+  kPlacementCPU,
+  kPlacementNUMA,
+};
+
+// GridContext keeps the binding state of a grid::Grid. The lock serializes
+// changes to the grid, such as allocating or building channels, between the
+// python threads and the native threads of the binding. The channels lock
+// protects the channel contexts by name and the placement policy.
+struct GridContext
+{
+  std::mutex                                                        lock;
+  std::mutex                                                        channels_lock;
+  std::unordered_map<std::string, std::shared_ptr<ChannelContext>>  channels;
+  PlacementPolicy                   placement_policy = kPlacementNone;
+  unsigned long                     placement_next = 0;
+};
+
+// Assign the placement of a new channel by the policy of the grid; the
+// channels lock must be held.
+void AssignChannelPlacement(GridContext& context, ChannelPlacement& placement);
+
+// Create a new context for a channel of the grid; the channels lock must be
+// held.
+std::shared_ptr<ChannelContext>
+CreateChannelContext(GridContext& context,
+                     const std::shared_ptr<grid::Channel>& channel);
+
+// Lock the grid context from a thread that holds the GIL.
+std::unique_lock<std::mutex> LockGridContext(GridContext& context);
+
+// ChannelHandle is the handle returned by grid::Grid::AllocateChannel
+typedef decltype(std::declval<grid::Grid&>().AllocateChannel(std::string()))
+  ChannelHandle;
+
+
+// InterpreterLock acquires the GIL of an interpreter from any native or
+// python thread, and restores the previous thread state when released.
+class InterpreterLock
+{
+ public:
+  explicit InterpreterLock(PyInterpreterState* interp);
+  ~InterpreterLock();
+
+  InterpreterLock(const InterpreterLock&) = delete;
+  InterpreterLock& operator=(const InterpreterLock&) = delete;
+
+ private:
+  PyThreadState*    tstate_;
+  PyThreadState*    saved_;
+  PyGILState_STATE  gstate_;
+  bool              ensured_;
+};
+
+
 extern "C" {
 
-extern PyTypeObject pygrid_type;
-extern PyTypeObject pychannel_type;
-extern PyTypeObject pycell_type;
-extern PyTypeObject pyparameter_type;
-extern PyTypeObject pycallback_type;
+// GridStreamerState is the module state, which keeps the types of the module
+// for each interpreter that imports the module.
+typedef struct
+{
+  PyTypeObject*                     grid_type;
+  PyTypeObject*                     channel_type;
+  PyTypeObject*                     cell_type;
+  PyTypeObject*                     parameter_type;
+  PyTypeObject*                     callback_type;
+  PyTypeObject*                     pool_type;
+  PyTypeObject*                     sharded_grid_type;
+  PyTypeObject*                     sharded_channel_type;
+} GridStreamerState;
+
+// Return the module state for a type, or subtype, of the module.
+GridStreamerState* GridStreamerGetState(PyTypeObject* type);
+
+// Add the C API for other native extensions (pygridstreamer.h) to the module.
+bool GridStreamerAddCAPI(PyObject* module);
+
+// Return the counters and histograms of the binding; implements stats().
+PyObject* GridStreamerStats(PyObject* module, PyObject* const* args,
+                            Py_ssize_t nargs, PyObject* kwnames);
+
+// Start and stop the tracer, record a mark, and dump the trace; implement
+// trace_start(), trace_stop(), trace_mark(), and trace_dump().
+PyObject* GridStreamerTraceStart(PyObject* module, PyObject* const* args,
+                                 Py_ssize_t nargs, PyObject* kwnames);
+PyObject* GridStreamerTraceStop(PyObject* module, PyObject*);
+PyObject* GridStreamerTraceMark(PyObject* module, PyObject* name);
+PyObject* GridStreamerTraceDump(PyObject* module, PyObject* const* args,
+                                Py_ssize_t nargs, PyObject* kwnames);
+
+// Start and stop profiling the cells; implement profile_start() and
+// profile_stop().
+PyObject* GridStreamerProfileStart(PyObject* module, PyObject* const* args,
+                                   Py_ssize_t nargs, PyObject* kwnames);
+PyObject* GridStreamerProfileStop(PyObject* module, PyObject*);
+
+// Run the loop of a shard of a ShardedGrid in the worker process; implements
+// _shard_worker().
+PyObject* GridStreamerShardWorker(PyObject* module, PyObject* const* args,
+                                  Py_ssize_t nargs);
+
+extern PyType_Spec pygrid_spec;
+extern PyType_Spec pychannel_spec;
+extern PyType_Spec pycell_spec;
+extern PyType_Spec pyparameter_spec;
+extern PyType_Spec pycallback_spec;
+extern PyType_Spec pypool_spec;
+extern PyType_Spec pyshardedgrid_spec;
+extern PyType_Spec pyshardedchannel_spec;
 
 
 // PyGrid describes the Grid class for Python and encapsulates the grid object.
@@ -43,8 +685,28 @@ typedef struct
   PyObject_HEAD
   PyObject*                         name;
   std::shared_ptr<grid::Grid>       grid;
+  std::shared_ptr<GridContext>      context;
 } PyGrid;
 
+// PyGrid exported functions
+std::shared_ptr<ChannelContext>
+PyGridChannelContext(PyGrid* self,
+                     const std::string& name,
+                     const std::shared_ptr<grid::Channel>& channel);
+std::shared_ptr<ChannelContext>
+PyGridFindChannelContext(PyGrid* self, const std::string& name);
+void PyGridAddChannelContext(PyGrid* self,
+                             const std::string& name,
+                             const std::shared_ptr<ChannelContext>& context);
+void PyGridRemoveChannelContext(PyGrid* self, const std::string& name);
+PyObject* PyGridCreatePool(PyGrid* self, PyObject* const* args,
+                           Py_ssize_t nargs, PyObject* kwnames);
+PyObject* PyGridCheckpoint(PyGrid* self, PyObject* pypath);
+PyObject* PyGridRestore(PyTypeObject* type, PyObject* const* args,
+                        Py_ssize_t nargs, PyObject* kwnames);
+PyObject* PyGridVectorcall(PyObject* type, PyObject* const* args,
+                           size_t nargsf, PyObject* kwnames);
+
 
 // PyChannel describes a Channel in Grid.
 typedef struct
@@ -53,10 +715,12 @@ typedef struct
   PyObject*                         name;
   PyGrid*                           grid;
   std::shared_ptr<grid::Channel>    channel;
+  std::shared_ptr<ChannelContext>   context;
 } PyChannel;
 
 // PyChannel exported functions
 PyObject* PyChannelCompile(PyChannel* self, PyObject* pylayout);
+PyObject* PyChannelLookup(PyChannel* self, const char* path);
 
 
 // PyCell describes a Cell in Grid. The "parent" element can be a PyChannel
@@ -71,15 +735,28 @@ typedef struct
   std::shared_ptr<grid::Cell>       cell;
 } PyCell;
 
+// PyCell exported functions
+PyCell* PyCellCreate(GridStreamerState* state,
+                     const std::string& name,
+                     const std::shared_ptr<grid::Cell>& cell);
+
 
 // PyParameter describes a Parameter in Grid.
 typedef struct
 {
   PyObject_HEAD
   PyObject*                         name;
+  PyObject*                         value;
+  std::vector<char>                 values;
   std::shared_ptr<grid::Parameter>  parameter;
+  std::shared_ptr<ParameterState>   state;
 } PyParameter;
 
+// PyParameter exported functions
+PyParameter* PyParameterCreate(GridStreamerState* state,
+                               const std::string& name,
+                               const std::shared_ptr<grid::Parameter>& param);
+
 
 // PyCallback describes a Callback in Grid.
 typedef struct
@@ -88,11 +765,47 @@ typedef struct
   PyObject*                         name;
   std::shared_ptr<grid::Callback>   callback;
   std::unique_ptr<grid::Slot>       slot;
+  std::once_flag                    connected;
+  std::mutex                        lock;
   std::list<PyObject*>              functions;
-  bool                              active;
+  std::atomic<bool>                 active;
+  PyInterpreterState*               interp;
+  std::atomic<uint64_t>             received;
+  std::atomic<uint64_t>             dispatched;
+  std::atomic<uint64_t>             dropped;
+  std::shared_ptr<CellProfile>      profile;
+  std::shared_ptr<ChannelMemory>    memory;
 } PyCallback;
 
 
+// PyPool describes a pool of channels that are built in the background.
+class ChannelPool;
+typedef struct
+{
+  PyObject_HEAD
+  PyGrid*                           grid;
+  std::shared_ptr<ChannelPool>      pool;
+} PyPool;
+
+
+// PyShardedGrid describes a grid that runs its channels in worker processes.
+class ShardedGrid;
+typedef struct
+{
+  PyObject_HEAD
+  PyObject*                         name;
+  std::shared_ptr<ShardedGrid>      grid;
+} PyShardedGrid;
+
+
+// PyShardedChannel describes a Channel in a ShardedGrid by its name.
+typedef struct
+{
+  PyObject_HEAD
+  PyObject*                         name;
+  PyShardedGrid*                    grid;
+} PyShardedChannel;
+
 
 } // end of extern "C"
 
@@ -0,0 +1,245 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <Python.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+//
+// The buckets are indexed by the magnitude (highest bit) of the value and the
+// next kSubBits bits, so each power of two range is divided into 1 << kSubBits
+// linear buckets. Values below 2 << kSubBits have their own bucket.
+//
+static int LatencyBucket(uint64_t ns)
+{
+  const int kSub = 1 << LatencyHistogram::kSubBits;
+
+  if (ns >= (1ULL << LatencyHistogram::kMaxBits))
+    ns = (1ULL << LatencyHistogram::kMaxBits) - 1;
+  if (ns < (uint64_t) kSub)
+    return ns;
+
+  int shift = 63 - __builtin_clzll(ns) - LatencyHistogram::kSubBits;
+  return shift * kSub + (ns >> shift);
+}
+
+
+//
+// LatencyBucketValue returns the highest value of a bucket.
+//
+static uint64_t LatencyBucketValue(int bucket)
+{
+  const int kSub = 1 << LatencyHistogram::kSubBits;
+
+  if (bucket < 2 * kSub)
+    return bucket;
+
+  int shift = bucket / kSub - 1;
+  uint64_t top = bucket - shift * kSub;
+  return ((top + 1) << shift) - 1;
+}
+
+
+void LatencyHistogram::Add(uint64_t ns)
+{
+  count.fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(ns, std::memory_order_relaxed);
+  buckets[LatencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t curr = min.load(std::memory_order_relaxed);
+  while (ns < curr &&
+         !min.compare_exchange_weak(curr, ns, std::memory_order_relaxed))
+    ;
+  curr = max.load(std::memory_order_relaxed);
+  while (ns > curr &&
+         !max.compare_exchange_weak(curr, ns, std::memory_order_relaxed))
+    ;
+}
+
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+  uint64_t counts[kBuckets];
+  uint64_t total_count = 0;
+  for (int i = 0; i < kBuckets; i++)
+  {
+    counts[i] = buckets[i].load(std::memory_order_relaxed);
+    total_count += counts[i];
+  }
+
+  if (total_count == 0)
+    return 0;
+
+  // note: the value is the highest value of the bucket, but at most the max,
+  // which is also the value of the last bucket for values beyond its range
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(fraction * total_count));
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets - 1; i++)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min(LatencyBucketValue(i), max.load());
+  }
+  return max;
+}
+
+
+void LatencyHistogram::Reset()
+{
+  count = 0;
+  total = 0;
+  min = UINT64_MAX;
+  max = 0;
+  for (int i = 0; i < kBuckets; i++)
+    buckets[i] = 0;
+}
+
+
+LatencyMonitor::~LatencyMonitor()
+{
+  if (handler_ == NULL)
+    return;
+
+  // note: the monitor can be released from any thread
+  InterpreterLock lock(interp_);
+  Py_DECREF(handler_);
+}
+
+
+LatencyStage* LatencyMonitor::GetStage(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto& stage : stages_)
+    if (stage.name == name)
+      return &stage;
+
+  stages_.emplace_back(this, name);
+  return &stages_.back();
+}
+
+
+void LatencyMonitor::Record(LatencyStage& stage, uint64_t ns)
+{
+  stage.histogram.Add(ns);
+
+  uint64_t threshold = threshold_.load(std::memory_order_relaxed);
+  if (threshold != 0 && ns >= threshold)
+    Notify(stage, ns);
+}
+
+
+//
+// Notify calls the handler with the stage and latency unless it was called
+// within the interval. It acquires the GIL and can be called from any thread.
+//
+void LatencyMonitor::Notify(LatencyStage& stage, uint64_t ns)
+{
+  uint64_t now = StatsNow();
+  uint64_t last = notified_.load(std::memory_order_relaxed);
+  if (last != 0 && now - last < interval_.load(std::memory_order_relaxed))
+    return;
+  if (!notified_.compare_exchange_strong(last, now))
+    return;
+
+  PyInterpreterState* interp;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    interp = interp_;
+  }
+  if (interp == NULL)
+    return;
+
+  InterpreterLock gil(interp);
+  PyObject* handler;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    handler = handler_;
+    Py_XINCREF(handler);
+  }
+  if (handler == NULL)
+    return;
+
+  PyObject* ret = PyObject_CallFunction(handler, "sK", stage.name.c_str(),
+                                        (unsigned long long) ns);
+  if (ret == NULL)
+    PyErr_Print();
+  Py_XDECREF(ret);
+  Py_DECREF(handler);
+}
+
+
+void LatencyMonitor::SetThreshold(uint64_t ns,
+                                  PyObject* handler,
+                                  uint64_t interval)
+{
+  PyObject* prev;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    prev = handler_;
+    handler_ = handler;
+    Py_XINCREF(handler);
+    interp_ = PyInterpreterState_Get();
+    interval_ = interval;
+    notified_ = 0;
+    threshold_ = handler != NULL ? ns : 0;
+  }
+  Py_XDECREF(prev);
+}
+
+
+PyObject* LatencyMonitor::ToDict(bool reset)
+{
+  std::vector<LatencyStage*> stages;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (auto& stage : stages_)
+      stages.push_back(&stage);
+  }
+
+  PyObject* dict = PyDict_New();
+  if (dict == NULL)
+    return NULL;
+
+  for (auto stage : stages)
+  {
+    auto& histogram = stage->histogram;
+    unsigned long long count = histogram.count;
+    unsigned long long total = histogram.total;
+    unsigned long long min = count != 0 ? histogram.min.load() : 0;
+
+    PyObject* value = Py_BuildValue(
+        "{sKsKsdsKsKsKsKsKsK}",
+        "count", count,
+        "min_ns", min,
+        "mean_ns", count != 0 ? (double) total / count : 0.0,
+        "p50_ns", (unsigned long long) histogram.Percentile(0.5),
+        "p90_ns", (unsigned long long) histogram.Percentile(0.9),
+        "p99_ns", (unsigned long long) histogram.Percentile(0.99),
+        "p999_ns", (unsigned long long) histogram.Percentile(0.999),
+        "max_ns", (unsigned long long) histogram.max.load(),
+        "total_ns", total);
+    if (value == NULL ||
+        PyDict_SetItemString(dict, stage->name.c_str(), value) != 0)
+    {
+      Py_XDECREF(value);
+      Py_DECREF(dict);
+      return NULL;
+    }
+    Py_DECREF(value);
+
+    if (reset)
+      histogram.Reset();
+  }
+
+  return dict;
+}
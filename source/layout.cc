@@ -0,0 +1,78 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/builder/builder.h>
+
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+
+//
+// The compiled layouts are cached by their layout string, so a layout that is
+// compiled again is only compiled once. The cache keeps the most recently used
+// layouts; the keys refer to the strings of the list entries.
+//
+typedef std::list<std::pair<std::string, std::shared_ptr<grid::Layout>>>
+  LayoutCacheList;
+
+static const size_t kLayoutCacheSize = 256;
+
+static std::mutex layout_cache_lock;
+static LayoutCacheList layout_cache_list;
+static std::unordered_map<std::string_view, LayoutCacheList::iterator>
+  layout_cache;
+
+
+std::shared_ptr<grid::Layout>
+CompileLayout(const std::string& text, std::string& err)
+{
+  {
+    std::lock_guard<std::mutex> lock(layout_cache_lock);
+    auto it = layout_cache.find(text);
+    if (it != layout_cache.end())
+    {
+      layout_cache_list.splice(layout_cache_list.begin(), layout_cache_list,
+                               it->second);
+      return it->second->second;
+    }
+  }
+
+  grid::Builder builder;
+  std::shared_ptr<grid::Layout> layout;
+  {
+    TraceSpan span("Compile");
+    layout = builder.Compile(text.c_str(), err);
+  }
+  if (layout == nullptr)
+    return nullptr;
+
+  // note: released layouts are destroyed after releasing the lock
+  LayoutCacheList evicted;
+  std::lock_guard<std::mutex> lock(layout_cache_lock);
+
+  auto it = layout_cache.find(text);
+  if (it != layout_cache.end())
+    return it->second->second;
+
+  layout_cache_list.emplace_front(text, layout);
+  layout_cache.emplace(layout_cache_list.front().first,
+                       layout_cache_list.begin());
+
+  if (layout_cache_list.size() > kLayoutCacheSize)
+  {
+    layout_cache.erase(layout_cache_list.back().first);
+    evicted.splice(evicted.begin(), layout_cache_list,
+                   std::prev(layout_cache_list.end()));
+  }
+  return layout;
+}
@@ -0,0 +1,326 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/fw/cell.h>
+#include <grid/fw/cluster.h>
+#include <grid/fw/pipeline.h>
+
+#include <Python.h>
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+
+//
+// The channels of the cells are kept in a table indexed by the grid cell, so
+// the callbacks of a cell can account their events to the memory of the
+// channel. Entries of released cells are dropped like the cell profiles.
+//
+struct CellMemory
+{
+  std::weak_ptr<grid::Cell>         cell;
+  std::weak_ptr<ChannelMemory>      memory;
+};
+
+static std::mutex cell_memory_lock;
+static std::unordered_map<const grid::Cell*, CellMemory> cell_memory;
+static size_t cell_memory_pruned;
+
+
+static const char* budget_policy_names[] =
+{
+  "drop",
+  "backpressure",
+  "error",
+};
+
+
+//
+// HeapInUse is a helper function to return the bytes allocated on the heap.
+//
+static int64_t HeapInUse()
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+
+MemoryScope::MemoryScope(ChannelMemory& memory)
+  : memory_(memory), heap_(HeapInUse())
+{
+}
+
+
+MemoryScope::~MemoryScope()
+{
+  // note: the heap also includes allocations of other threads meanwhile
+  memory_.AddHeap(HeapInUse() - heap_);
+}
+
+
+ChannelMemory::~ChannelMemory()
+{
+  if (handler_ == NULL)
+    return;
+
+  // note: the memory can be released from any thread
+  InterpreterLock lock(interp_);
+  Py_DECREF(handler_);
+}
+
+
+uint64_t ChannelMemory::Total() const
+{
+  int64_t total = std::max<int64_t>(heap_, 0) + queue_;
+  return std::max<int64_t>(total, 0);
+}
+
+
+bool ChannelMemory::Reserve(uint64_t bytes)
+{
+  if (failed_)
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint64_t budget = budget_.load(std::memory_order_relaxed);
+  if (budget != 0 && Total() + bytes > budget)
+  {
+    exceeded_.fetch_add(1, std::memory_order_relaxed);
+    Notify(Total() + bytes);
+
+    BudgetPolicy policy = policy_;
+    if (policy != kBudgetBackpressure)
+    {
+      if (policy == kBudgetError)
+        failed_ = true;
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    // note: the event is dispatched when no other event is waiting, even if
+    // the heap alone exceeds the budget; it is queued while holding the lock,
+    // so only one waiting event is admitted at a time
+    std::unique_lock<std::mutex> lock(lock_);
+    waiters_++;
+    drained_.wait(lock, [&]() {
+      uint64_t budget = budget_;
+      return budget == 0 || policy_ != kBudgetBackpressure ||
+        events_ == 0 || Total() + bytes <= budget;
+    });
+    waiters_--;
+    Queue(bytes);
+    return true;
+  }
+
+  Queue(bytes);
+  return true;
+}
+
+
+//
+// Queue is a helper function to add a callback event to the queue.
+//
+void ChannelMemory::Queue(uint64_t bytes)
+{
+  int64_t queue = queue_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  events_.fetch_add(1, std::memory_order_relaxed);
+
+  int64_t curr = queue_max_.load(std::memory_order_relaxed);
+  while (queue > curr &&
+         !queue_max_.compare_exchange_weak(curr, queue,
+                                           std::memory_order_relaxed))
+    ;
+}
+
+
+void ChannelMemory::Release(uint64_t bytes)
+{
+  queue_.fetch_sub(bytes, std::memory_order_relaxed);
+  events_.fetch_sub(1, std::memory_order_relaxed);
+
+  if (waiters_ != 0)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    drained_.notify_all();
+  }
+}
+
+
+void ChannelMemory::AddHeap(int64_t bytes)
+{
+  heap_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+
+//
+// Notify calls the handler with the bytes of the channel unless it was called
+// within a second. It acquires the GIL and can be called from any thread.
+//
+void ChannelMemory::Notify(uint64_t bytes)
+{
+  const uint64_t kInterval = 1000000000ULL;
+
+  uint64_t now = StatsNow();
+  uint64_t last = notified_.load(std::memory_order_relaxed);
+  if (last != 0 && now - last < kInterval)
+    return;
+  if (!notified_.compare_exchange_strong(last, now))
+    return;
+
+  PyInterpreterState* interp;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    interp = interp_;
+  }
+  if (interp == NULL)
+    return;
+
+  InterpreterLock gil(interp);
+  PyObject* handler;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    handler = handler_;
+    Py_XINCREF(handler);
+  }
+  if (handler == NULL)
+    return;
+
+  PyObject* ret = PyObject_CallFunction(handler, "K",
+                                        (unsigned long long) bytes);
+  if (ret == NULL)
+    PyErr_Print();
+  Py_XDECREF(ret);
+  Py_DECREF(handler);
+}
+
+
+void ChannelMemory::SetBudget(uint64_t bytes,
+                              BudgetPolicy policy,
+                              PyObject* handler)
+{
+  PyObject* prev;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    prev = handler_;
+    handler_ = handler;
+    Py_XINCREF(handler);
+    interp_ = PyInterpreterState_Get();
+    notified_ = 0;
+    policy_ = policy;
+    budget_ = bytes;
+    failed_ = false;
+
+    // note: events waiting for the budget are re-evaluated
+    drained_.notify_all();
+  }
+  Py_XDECREF(prev);
+}
+
+
+PyObject* ChannelMemory::ToDict(bool reset)
+{
+  long long heap = std::max<int64_t>(heap_, 0);
+  long long queue = std::max<int64_t>(queue_, 0);
+  unsigned long long budget = budget_;
+
+  PyObject* pybudget = NULL;
+  if (budget != 0)
+    pybudget = PyLong_FromUnsignedLongLong(budget);
+  else
+  {
+    pybudget = Py_None;
+    Py_INCREF(pybudget);
+  }
+
+  PyObject* dict = Py_BuildValue(
+      "{sLsLsLsLsLsNsssKsKsO}",
+      "heap", heap,
+      "queue", queue,
+      "queue_events", (long long) std::max<int64_t>(events_, 0),
+      "queue_max", (long long) queue_max_.load(),
+      "total", (long long) Total(),
+      "budget", pybudget,
+      "policy", budget_policy_names[policy_],
+      "exceeded", (unsigned long long) exceeded_.load(),
+      "dropped", (unsigned long long) dropped_.load(),
+      "failed", failed_ ? Py_True : Py_False);
+
+  if (dict != NULL && reset)
+  {
+    queue_max_ = queue_.load();
+    exceeded_ = 0;
+    dropped_ = 0;
+  }
+
+  return dict;
+}
+
+
+//
+// RegisterCells is a helper function to register a cell and any cells of a
+// pipeline or cluster with the memory of the channel. The lock must be held.
+//
+static void RegisterCells(const std::shared_ptr<ChannelMemory>& memory,
+                          const std::shared_ptr<grid::Cell>& cell)
+{
+  auto& entry = cell_memory[cell.get()];
+  entry.cell = cell;
+  entry.memory = memory;
+
+  grid::Cluster*  cluster =  cell->ClusterInterface();
+  grid::Pipeline* pipeline = cell->PipelineInterface();
+  if (cluster == nullptr && pipeline == nullptr)
+    return;
+
+  grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
+    pipeline->GetCells() : cluster->GetCells();
+
+  for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
+    RegisterCells(memory, *cell_it);
+}
+
+
+void RegisterChannelMemory(ChannelContext& context)
+{
+  std::lock_guard<std::mutex> lock(cell_memory_lock);
+
+  // drop entries of released cells whenever the table doubled
+  if (cell_memory.size() >= 2 * cell_memory_pruned + 64)
+  {
+    for (auto it = cell_memory.begin(); it != cell_memory.end(); )
+    {
+      if (it->second.cell.expired())
+        it = cell_memory.erase(it);
+      else
+        ++it;
+    }
+    cell_memory_pruned = cell_memory.size();
+  }
+
+  grid::Registry<grid::Pipeline>& pipelines = context.channel->GetPipelines();
+  for (auto pipe_it = pipelines.Begin(); pipe_it != pipelines.End(); ++pipe_it)
+    RegisterCells(context.memory, *pipe_it);
+}
+
+
+std::shared_ptr<ChannelMemory>
+FindCellMemory(const std::shared_ptr<grid::Cell>& cell)
+{
+  std::lock_guard<std::mutex> lock(cell_memory_lock);
+  auto it = cell_memory.find(cell.get());
+  if (it == cell_memory.end() || it->second.cell.lock() != cell)
+    return nullptr;
+  return it->second.memory.lock();
+}
@@ -12,9 +12,158 @@
 
 #include <Python.h>
 
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+
+//
+// The parameter states are kept in a table indexed by the grid parameter,
+// which holds the states until the grid parameter is released.
+//
+static std::mutex parameter_states_lock;
+static std::unordered_map<const grid::Parameter*,
+                          std::shared_ptr<ParameterState>> parameter_states;
+static size_t parameter_states_pruned;
+
+
+ParameterState::~ParameterState()
+{
+  if (watchers.empty())
+    return;
+
+  // note: the state can be released from any thread or interpreter
+  InterpreterLock lock(interp);
+  for (auto func : watchers)
+    Py_DECREF(func);
+}
+
+
+std::shared_ptr<ParameterState>
+GetParameterState(const std::shared_ptr<grid::Parameter>& parameter)
+{
+  std::shared_ptr<ParameterState> state;
+  std::list<std::shared_ptr<ParameterState>> expired;
+  {
+    std::lock_guard<std::mutex> lock(parameter_states_lock);
+
+    // drop states of released parameters whenever the table doubled
+    if (parameter_states.size() >= 2 * parameter_states_pruned + 64)
+    {
+      for (auto it = parameter_states.begin(); it != parameter_states.end(); )
+      {
+        if (it->second->parameter.expired())
+        {
+          expired.push_back(std::move(it->second));
+          it = parameter_states.erase(it);
+        }
+        else
+          ++it;
+      }
+      parameter_states_pruned = parameter_states.size();
+    }
+
+    auto& entry = parameter_states[parameter.get()];
+    if (entry == nullptr || entry->parameter.expired())
+    {
+      expired.push_back(std::move(entry));
+      entry = std::make_shared<ParameterState>();
+      entry->interp = PyInterpreterState_Get();
+      entry->parameter = parameter;
+      entry->version = 0;
+      entry->watched = false;
+    }
+    state = entry;
+  }
+
+  // note: expired states are released here, outside of the lock
+  return state;
+}
+
+
+//
+// ParameterChanged increments the version of the parameter and calls all
+// functions watching the parameter with the new value.
+//
+void ParameterChanged(const grid::Parameter* parameter)
+{
+  std::shared_ptr<ParameterState> state;
+  {
+    std::lock_guard<std::mutex> lock(parameter_states_lock);
+    auto it = parameter_states.find(parameter);
+    if (it == parameter_states.end())
+      return;
+
+    it->second->version++;
+    if (!it->second->watched)
+      return;
+    state = it->second;
+  }
+
+  // -- start of Python GIL --
+  InterpreterLock lock(state->interp);
+
+  auto param = state->parameter.lock();
+  if (param != nullptr)
+  {
+    size_t arg_buf_sz = param->GetArgumentBufferSize();
+    char arg_buf[arg_buf_sz];
+
+    PyObject* value = NULL;
+    if (param->GetValues(arg_buf, arg_buf_sz))
+      value = PyGridStreamerReadArguments(arg_buf, arg_buf_sz,
+                                          param->GetSignature());
+
+    // note: watchers can be removed while they are called
+    std::list<PyObject*> watchers;
+    {
+      std::lock_guard<std::mutex> watchers_lock(state->lock);
+      watchers = state->watchers;
+      for (auto func : watchers)
+        Py_INCREF(func);
+    }
+
+    for (auto func : watchers)
+    {
+      if (value != NULL && !PyObject_CallFunctionObjArgs(func, value, NULL))
+        PyErr_Print();
+      Py_DECREF(func);
+    }
+
+    if (value == NULL)
+      PyErr_Print();
+    Py_XDECREF(value);
+  }
+  state.reset();
+
+  // -- end of Python GIL --
+}
+
+
 extern "C" {
 
 
+//
+// PyParameterCreate creates a new PyParameter for the grid parameter.
+//
+PyParameter* PyParameterCreate(GridStreamerState* state,
+                               const std::string& name,
+                               const std::shared_ptr<grid::Parameter>& param)
+{
+  PyParameter* pyparameter =
+    (PyParameter*) PyType_GenericAlloc(state->parameter_type, 0);
+  if (pyparameter == NULL)
+    return NULL;
+
+  pyparameter->parameter = param;
+  pyparameter->state = GetParameterState(param);
+  pyparameter->name = PyUnicode_FromString(name.c_str());
+
+  return pyparameter;
+}
+
+
 //
 // PyParameterStr implements __str__ and returns the registered name of the
 // Parameter.
@@ -44,9 +193,15 @@ PyParameterInit(PyParameter* self, PyObject* args, PyObject* kwargs)
 //
 static void PyParameterDealloc(PyParameter* self)
 {
+  PyTypeObject* type = Py_TYPE(self);
+
   Py_XDECREF(self->name);
+  Py_XDECREF(self->value);
+  std::vector<char>().swap(self->values);
   self->parameter.reset();
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  self->state.reset();
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -59,6 +214,20 @@ static PyObject* PyParameterFormatGet(PyParameter* self)
 }
 
 
+//
+// CountParameterAccess is a helper function to count a get or set of the
+// parameter and record its duration if it was sampled (start is not 0).
+//
+static void
+CountParameterAccess(ParameterState& state, bool set, uint64_t start)
+{
+  (set ? state.sets : state.gets).fetch_add(1, std::memory_order_relaxed);
+  if (start != 0)
+    StatsRecord(set ? kStatsParameterSetTime : kStatsParameterGetTime,
+                StatsNow() - start);
+}
+
+
 //
 // PyParameterValueSet sets the parameter value
 //
@@ -71,6 +240,7 @@ static int PyParameterValueSet(PyParameter* self, PyObject* args)
     return -1;
   }
  
+  uint64_t start = StatsCountSampled(kStatsParameterSet);
   const unsigned long* traits = param->GetSignature();
   if (PyUnicode_Check(args) && traits[0] > 1)
   {
@@ -82,6 +252,8 @@ static int PyParameterValueSet(PyParameter* self, PyObject* args)
       PyErr_SetString(PyExc_TypeError, "Invalid format in argument");
       return -1;
     }
+    ParameterChanged(param.get());
+    CountParameterAccess(*self->state, true, start);
     return 0;
   }
 
@@ -91,12 +263,32 @@ static int PyParameterValueSet(PyParameter* self, PyObject* args)
   if (!PyGridStreamerWriteArguments(args, arg_buf, arg_buf_sz, traits))
     return -1;
 
-  return param->CallUnsafe(NULL, 0, arg_buf, arg_buf_sz)? 0 : -1;
+  if (!param->CallUnsafe(NULL, 0, arg_buf, arg_buf_sz))
+    return -1;
+
+  ParameterChanged(param.get());
+  CountParameterAccess(*self->state, true, start);
+  return 0;
+}
+
+
+//
+// HasStringArguments is a helper function to check if a signature has string
+// arguments, which can't be compared by their bytes.
+//
+static bool HasStringArguments(const unsigned long* traits)
+{
+  for (size_t i = 1; i <= traits[0]; i++)
+    if (traits[i] == grid::TypeT<std::string>::Sig)
+      return true;
+  return false;
 }
 
 
 //
-// PyParameterValueGet returns the parameters as a dictionary
+// PyParameterValueGet returns the parameters as a tuple. The tuple is cached
+// and returned again while the bytes of the values are unchanged, which
+// avoids converting the arguments for repeated reads.
 //
 static PyObject* PyParameterValueGet(PyParameter* self)
 {
@@ -107,15 +299,246 @@ static PyObject* PyParameterValueGet(PyParameter* self)
     return NULL;
   }
 
+  uint64_t start = StatsCountSampled(kStatsParameterGet);
+  const unsigned long* traits = param->GetSignature();
   size_t arg_buf_sz = param->GetArgumentBufferSize();
   char arg_buf[arg_buf_sz];
+  memset(arg_buf, 0, arg_buf_sz);
   if (!param->GetValues(arg_buf, arg_buf_sz))
   {
     PyErr_SetString(PyExc_TypeError, "Failed to get parameter values");
     return NULL;
   }
 
-  return PyGridStreamerReadArguments(arg_buf, arg_buf_sz, param->GetSignature());
+  // note: string arguments are never cached; the bytes of the values are
+  //       compared, so changes not made through the binding are seen
+  bool cacheable = !HasStringArguments(traits);
+  PyObject* value = NULL;
+
+  Py_BEGIN_CRITICAL_SECTION(self);
+  if (cacheable && self->value != NULL &&
+      self->values.size() == arg_buf_sz &&
+      memcmp(self->values.data(), arg_buf, arg_buf_sz) == 0)
+  {
+    value = self->value;
+    Py_INCREF(value);
+  }
+  Py_END_CRITICAL_SECTION();
+
+  if (value == NULL)
+  {
+    value = PyGridStreamerReadArguments(arg_buf, arg_buf_sz, traits);
+    if (value != NULL && cacheable)
+    {
+      Py_INCREF(value);
+      Py_BEGIN_CRITICAL_SECTION(self);
+      Py_XSETREF(self->value, value);
+      self->values.assign(arg_buf, arg_buf + arg_buf_sz);
+      Py_END_CRITICAL_SECTION();
+    }
+  }
+
+  GridStreamerReleaseArguments(arg_buf, arg_buf_sz, traits);
+  if (value == NULL)
+    return NULL;
+
+  CountParameterAccess(*self->state, false, start);
+  return value;
+}
+
+
+//
+// PyParameterStatsGet returns the number of gets and sets of the parameter
+// through the binding.
+//
+static PyObject* PyParameterStatsGet(PyParameter* self)
+{
+  return Py_BuildValue("{sKsK}",
+      "get", (unsigned long long) self->state->gets.load(),
+      "set", (unsigned long long) self->state->sets.load());
+}
+
+
+//
+// PyParameterVersionGet returns the version of the parameter, which is
+// incremented for every change through the binding.
+//
+static PyObject* PyParameterVersionGet(PyParameter* self)
+{
+  return PyLong_FromUnsignedLongLong(self->state->version);
+}
+
+
+//
+// PyParameterWatch adds a function that is called with the new value when
+// the parameter is changed.
+//
+static PyObject* PyParameterWatch(PyParameter* self, PyObject* func)
+{
+  if (!PyCallable_Check(func))
+  {
+    PyErr_SetString(PyExc_AttributeError, "Invalid arguments");
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(self->state->lock);
+
+  Py_INCREF(func);
+  self->state->watchers.push_back(func);
+  self->state->watched = true;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyParameterUnwatch removes a function watching the parameter.
+//
+static PyObject* PyParameterUnwatch(PyParameter* self, PyObject* func)
+{
+  PyObject* watcher = NULL;
+  {
+    std::lock_guard<std::mutex> lock(self->state->lock);
+
+    auto& watchers = self->state->watchers;
+    auto it = std::find(watchers.begin(), watchers.end(), func);
+    if (it != watchers.end())
+    {
+      watcher = *it;
+      watchers.erase(it);
+      self->state->watched = !watchers.empty();
+    }
+  }
+
+  if (watcher == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "function not registered");
+    return NULL;
+  }
+
+  // note: releasing the function can call python code
+  Py_DECREF(watcher);
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyParameterSchedule schedules an automation of the parameter value from a
+// list of (time, value) keyframes. The time is in seconds relative to now; the
+// interval is at least 100us.
+//
+static PyObject*
+PyParameterSchedule(PyParameter* self,
+                    PyObject* const* args,
+                    Py_ssize_t nargs,
+                    PyObject* kwnames)
+{
+  PyObject* values[3];
+  const char* mode = "linear";
+  double interval = 0.01;
+
+  // note: keyframes is a borrowed reference
+  static const char* kwlist[] = { "keyframes", "mode", "interval", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  PyObject* pykeyframes = values[0];
+  if ((values[1] != NULL && (mode = PyUnicode_AsUTF8(values[1])) == NULL) ||
+      (values[2] != NULL && (interval = PyFloat_AsDouble(values[2])) == -1.0 &&
+       PyErr_Occurred()))
+    return NULL;
+
+  auto param = self->parameter;
+  if (param == nullptr)
+  {
+    PyErr_SetString(PyExc_TypeError, "Not a parameter");
+    return NULL;
+  }
+
+  ParameterInterpolation interpolation;
+  if (!strcmp(mode, "linear"))
+    interpolation = kInterpolationLinear;
+  else if (!strcmp(mode, "exponential"))
+    interpolation = kInterpolationExponential;
+  else
+  {
+    PyErr_SetString(PyExc_ValueError, "Mode must be linear or exponential");
+    return NULL;
+  }
+
+  if (interval <= 0)
+  {
+    PyErr_SetString(PyExc_ValueError, "Interval must be positive");
+    return NULL;
+  }
+
+  PyObject* seq = PySequence_Fast(pykeyframes, "Keyframes must be a sequence");
+  if (seq == NULL)
+    return NULL;
+
+  std::vector<ParameterKeyframe> keyframes;
+  Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+  for (Py_ssize_t i = 0; i < size; i++)
+  {
+    ParameterKeyframe keyframe;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "dd",
+                          &keyframe.time, &keyframe.value))
+    {
+      Py_DECREF(seq);
+      return NULL;
+    }
+
+    if (keyframe.time < 0 ||
+        (!keyframes.empty() && keyframe.time < keyframes.back().time))
+    {
+      PyErr_SetString(PyExc_ValueError, "Keyframe times must be ascending");
+      Py_DECREF(seq);
+      return NULL;
+    }
+    keyframes.push_back(keyframe);
+  }
+  Py_DECREF(seq);
+
+  if (keyframes.empty())
+  {
+    PyErr_SetString(PyExc_ValueError, "No keyframes");
+    return NULL;
+  }
+
+  // ensure the parameter accepts a single number
+  size_t arg_buf_sz = param->GetArgumentBufferSize();
+  char arg_buf[arg_buf_sz];
+  if (!GridStreamerWriteNumber(keyframes[0].value, arg_buf, arg_buf_sz,
+                               param->GetSignature()))
+  {
+    PyErr_SetString(PyExc_TypeError,
+                    "Only parameters with a single number can be scheduled");
+    return NULL;
+  }
+
+  // note: don't hold the GIL while waiting for the lock of the scheduler
+  Py_BEGIN_ALLOW_THREADS
+  ScheduleParameter(param, std::move(keyframes), interpolation,
+                    std::chrono::microseconds((long long)(interval * 1e6)));
+  Py_END_ALLOW_THREADS
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyParameterCancel cancels any scheduled automation of the parameter.
+//
+static PyObject* PyParameterCancel(PyParameter* self)
+{
+  bool ret;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = CancelParameterSchedule(self->parameter.get());
+  Py_END_ALLOW_THREADS
+
+  return PyBool_FromLong(ret);
 }
 
 
@@ -138,30 +561,86 @@ static PyGetSetDef pyparameter_getsets[] =
     NULL,
     NULL
   },
+  {
+    "stats",
+    (getter) PyParameterStatsGet,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    "version",
+    (getter) PyParameterVersionGet,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+//
+// Define the PyParameter methods
+//
+static PyMethodDef pyparameter_methods[] =
+{
+  {
+    "schedule",
+    (PyCFunction)(void(*)(void)) PyParameterSchedule,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Schedule (time, value) keyframes with linear or exponential interpolation"
+  },
+  {
+    "cancel",
+    (PyCFunction) PyParameterCancel,
+    METH_NOARGS,
+    "Cancel a scheduled automation of the parameter"
+  },
+  {
+    "watch",
+    (PyCFunction) PyParameterWatch,
+    METH_O,
+    "Call a function with the new value when the parameter changes"
+  },
+  {
+    "unwatch",
+    (PyCFunction) PyParameterUnwatch,
+    METH_O,
+    "Stop calling a function when the parameter changes"
+  },
   {
     NULL  /* Sentinel */
   }
 };
 
 
+static PyType_Slot pyparameter_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyParameterDealloc },
+  { Py_tp_repr, (void*) PyParameterStr },
+  { Py_tp_str, (void*) PyParameterStr },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "Parameter describe a generic parameter for Grid types") },
+  { Py_tp_methods, pyparameter_methods },
+  { Py_tp_getset, pyparameter_getsets },
+  { Py_tp_init, (void*) PyParameterInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
 //
 // Define the PyParameter type
 //
-PyTypeObject pyparameter_type =
-{
-  PyVarObject_HEAD_INIT(NULL, 0)
-  .tp_name = "gridstreamer.Parameter",
-  .tp_basicsize = sizeof(PyParameter),
-  .tp_itemsize = 0,
-  .tp_dealloc = (destructor) PyParameterDealloc,
-  .tp_repr = (reprfunc) PyParameterStr,
-  .tp_str = (reprfunc) PyParameterStr,
-  .tp_flags = Py_TPFLAGS_DEFAULT,
-  .tp_doc = PyDoc_STR(
-      "Parameter describe a generic parameter for Grid types"),
-  .tp_getset = pyparameter_getsets,
-  .tp_init = (initproc) PyParameterInit,
-  .tp_new = PyType_GenericNew,
+PyType_Spec pyparameter_spec =
+{
+  .name = "gridstreamer.Parameter",
+  .basicsize = sizeof(PyParameter),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pyparameter_slots,
 };
 
 
@@ -0,0 +1,499 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <Python.h>
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+
+//
+// ListThreads is a helper function to return the sorted ids of the threads of
+// the process.
+//
+static std::vector<pid_t> ListThreads()
+{
+  std::vector<pid_t> threads;
+
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == NULL)
+    return threads;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    pid_t tid = atoi(entry->d_name);
+    if (tid > 0)
+      threads.push_back(tid);
+  }
+  closedir(dir);
+
+  std::sort(threads.begin(), threads.end());
+  return threads;
+}
+
+
+//
+// MakeCPUSet is a helper function to convert a list of CPUs to a CPU set.
+//
+static void MakeCPUSet(const std::vector<int>& cpus, cpu_set_t& set)
+{
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &set);
+}
+
+
+//
+// ApplyPlacement is a helper function to set the affinity and nice value of
+// a thread; it returns 0 or the error number.
+//
+static int ApplyPlacement(pid_t tid,
+                          const std::vector<int>& cpus,
+                          bool nice_set,
+                          int nice)
+{
+  if (!cpus.empty())
+  {
+    cpu_set_t set;
+    MakeCPUSet(cpus, set);
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0)
+      return errno;
+  }
+
+  if (nice_set && setpriority(PRIO_PROCESS, tid, nice) != 0)
+    return errno;
+
+  return 0;
+}
+
+
+//
+// ReadNUMAStat is a helper function to read the number of pages allocated on
+// a NUMA node as intended, and intended for the node but allocated on another
+// node.
+//
+static void ReadNUMAStat(int node, uint64_t& hit, uint64_t& foreign)
+{
+  hit = 0;
+  foreign = 0;
+
+  std::ifstream file("/sys/devices/system/node/node" +
+                     std::to_string(node) + "/numastat");
+  std::string name;
+  uint64_t value;
+  while (file >> name >> value)
+  {
+    if (name == "numa_hit")
+      hit = value;
+    else if (name == "numa_foreign")
+      foreign = value;
+  }
+}
+
+
+PlacementScope::PlacementScope(ChannelPlacement& placement)
+  : placement_(NULL), restore_(false), restore_policy_(false)
+{
+  {
+    std::lock_guard<std::mutex> lock(placement.lock);
+    if (placement.cpus.empty() && !placement.nice_set &&
+        placement.numa_node < 0)
+      return;
+
+    cpus_ = placement.cpus;
+    nice_set_ = placement.nice_set;
+    nice_ = placement.nice;
+    numa_node_ = placement.numa_node;
+  }
+
+  placement_ = &placement;
+  threads_ = ListThreads();
+
+  // note: threads inherit the affinity of the thread that creates them
+  if (!cpus_.empty() && sched_getaffinity(0, sizeof(saved_), &saved_) == 0)
+  {
+    cpu_set_t set;
+    MakeCPUSet(cpus_, set);
+    restore_ = sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+
+  // note: the memory policy applies to the thread and the threads it creates,
+  // so the grid allocates the memory of the channel on the node
+  if (numa_node_ >= 0 &&
+      syscall(SYS_get_mempolicy, &policy_, nodes_, sizeof(nodes_) * 8,
+              NULL, 0) == 0)
+  {
+    unsigned long nodes[sizeof(nodes_) / sizeof(nodes_[0])] = {};
+    nodes[numa_node_ / 64] = 1UL << (numa_node_ % 64);
+    restore_policy_ = syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+                              sizeof(nodes) * 8) == 0;
+    ReadNUMAStat(numa_node_, numa_hit_, numa_foreign_);
+  }
+}
+
+
+PlacementScope::~PlacementScope()
+{
+  if (placement_ == NULL)
+    return;
+
+  if (restore_)
+    sched_setaffinity(0, sizeof(saved_), &saved_);
+
+  // note: the counters of the node include allocations of other threads
+  uint64_t hit = 0, foreign = 0;
+  if (restore_policy_)
+  {
+    syscall(SYS_set_mempolicy, policy_, nodes_, sizeof(nodes_) * 8);
+    ReadNUMAStat(numa_node_, hit, foreign);
+  }
+
+  std::vector<pid_t> threads = ListThreads();
+  std::vector<pid_t> started;
+  std::set_difference(threads.begin(), threads.end(),
+                      threads_.begin(), threads_.end(),
+                      std::back_inserter(started));
+
+  for (pid_t tid : started)
+    ApplyPlacement(tid, cpus_, nice_set_, nice_);
+
+  // note: threads that exited are dropped when the placement is read
+  std::lock_guard<std::mutex> lock(placement_->lock);
+  if (restore_policy_)
+  {
+    placement_->numa_local += hit - std::min(hit, numa_hit_);
+    placement_->numa_remote += foreign - std::min(foreign, numa_foreign_);
+  }
+  for (pid_t tid : started)
+    if (std::find(placement_->threads.begin(), placement_->threads.end(),
+                  tid) == placement_->threads.end())
+      placement_->threads.push_back(tid);
+}
+
+
+//
+// AllowedCPUs is a helper function to return the CPUs the calling thread is
+// allowed to run on.
+//
+static std::vector<int> AllowedCPUs()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+
+int SetChannelAffinity(ChannelPlacement& placement,
+                       const std::vector<int>& cpus)
+{
+  std::vector<int> affinity = cpus.empty() ? AllowedCPUs() : cpus;
+
+  std::lock_guard<std::mutex> lock(placement.lock);
+  placement.cpus = cpus;
+
+  int err = 0;
+  for (pid_t tid : placement.threads)
+  {
+    int ret = ApplyPlacement(tid, affinity, false, 0);
+    if (ret != 0 && ret != ESRCH && err == 0)
+      err = ret;
+  }
+  return err;
+}
+
+
+int SetChannelPriority(ChannelPlacement& placement, const int* nice)
+{
+  std::lock_guard<std::mutex> lock(placement.lock);
+  placement.nice_set = nice != NULL;
+  placement.nice = nice != NULL ? *nice : 0;
+  if (nice == NULL)
+    return 0;
+
+  int err = 0;
+  for (pid_t tid : placement.threads)
+  {
+    int ret = ApplyPlacement(tid, std::vector<int>(), true, *nice);
+    if (ret != 0 && ret != ESRCH && err == 0)
+      err = ret;
+  }
+  return err;
+}
+
+
+//
+// ReadThreadCPU is a helper function to return the CPU that a thread last
+// ran on (field 39 of /proc/<pid>/task/<tid>/stat), or -1.
+//
+static int ReadThreadCPU(pid_t tid)
+{
+  std::ifstream file("/proc/self/task/" + std::to_string(tid) + "/stat");
+  std::string stat((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+
+  // note: fields are counted after the command, which can contain spaces
+  size_t pos = stat.rfind(')');
+  if (pos == std::string::npos)
+    return -1;
+
+  std::istringstream fields(stat.substr(pos + 1));
+  std::string field;
+  for (int i = 3; i <= 39 && fields >> field; i++)
+    if (i == 39)
+      return atoi(field.c_str());
+  return -1;
+}
+
+
+//
+// CPUListToPython is a helper function to return a list of CPUs.
+//
+static PyObject* CPUListToPython(const std::vector<int>& cpus)
+{
+  PyObject* list = PyList_New(cpus.size());
+  if (list == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < cpus.size(); i++)
+    PyList_SET_ITEM(list, i, PyLong_FromLong(cpus[i]));
+  return list;
+}
+
+
+PyObject* ChannelPlacementToDict(ChannelPlacement& placement)
+{
+  std::vector<int> cpus;
+  bool nice_set;
+  int nice;
+  int numa_node;
+  unsigned long long numa_local, numa_remote;
+  std::vector<pid_t> threads;
+  {
+    std::lock_guard<std::mutex> lock(placement.lock);
+
+    // drop threads that exited
+    auto alive = ListThreads();
+    placement.threads.erase(
+        std::remove_if(placement.threads.begin(), placement.threads.end(),
+                       [&](pid_t tid) {
+                         return !std::binary_search(alive.begin(),
+                                                    alive.end(), tid);
+                       }),
+        placement.threads.end());
+
+    cpus = placement.cpus;
+    nice_set = placement.nice_set;
+    nice = placement.nice;
+    numa_node = placement.numa_node;
+    numa_local = placement.numa_local;
+    numa_remote = placement.numa_remote;
+    threads = placement.threads;
+  }
+
+  PyObject* list = PyList_New(0);
+  if (list == NULL)
+    return NULL;
+
+  for (pid_t tid : threads)
+  {
+    cpu_set_t set;
+    std::vector<int> affinity;
+    if (sched_getaffinity(tid, sizeof(set), &set) != 0)
+      continue;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        affinity.push_back(cpu);
+
+    errno = 0;
+    int prio = getpriority(PRIO_PROCESS, tid);
+    if (prio == -1 && errno != 0)
+      continue;
+
+    PyObject* row = Py_BuildValue("{sisNsisi}",
+                                  "tid", (int) tid,
+                                  "cpus", CPUListToPython(affinity),
+                                  "nice", prio,
+                                  "cpu", ReadThreadCPU(tid));
+    if (row == NULL || PyList_Append(list, row) != 0)
+    {
+      Py_XDECREF(row);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(row);
+  }
+
+  PyObject* pycpus = NULL;
+  if (cpus.empty())
+  {
+    pycpus = Py_None;
+    Py_INCREF(pycpus);
+  }
+  else
+    pycpus = CPUListToPython(cpus);
+
+  PyObject* pynice = NULL;
+  if (nice_set)
+    pynice = PyLong_FromLong(nice);
+  else
+  {
+    pynice = Py_None;
+    Py_INCREF(pynice);
+  }
+
+  PyObject* pynode = NULL;
+  if (numa_node >= 0)
+    pynode = PyLong_FromLong(numa_node);
+  else
+  {
+    pynode = Py_None;
+    Py_INCREF(pynode);
+  }
+
+  return Py_BuildValue("{sNsNsNs{sKsK}sN}",
+                       "cpus", pycpus,
+                       "nice", pynice,
+                       "numa_node", pynode,
+                       "numa_pages",
+                         "local", numa_local,
+                         "remote", numa_remote,
+                       "threads", list);
+}
+
+
+//
+// ReadCPUList is a helper function to read a list of CPUs ("0-3,8,10-11")
+// from a file.
+//
+static std::vector<int> ReadCPUList(const std::string& path)
+{
+  std::vector<int> cpus;
+  std::ifstream file(path);
+  std::string range;
+  while (std::getline(file, range, ','))
+  {
+    int first, last;
+    int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (n < 1)
+      continue;
+    if (n == 1)
+      last = first;
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+
+bool IsNUMANode(int node)
+{
+  std::string path = "/sys/devices/system/node/node" + std::to_string(node);
+  return node >= 0 && node < 1024 && access(path.c_str(), F_OK) == 0;
+}
+
+
+//
+// NUMANodeCPUs is a helper function to return the allowed CPUs of a NUMA node.
+//
+static std::vector<int> NUMANodeCPUs(int node)
+{
+  std::vector<int> cpus;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return cpus;
+
+  for (int cpu : ReadCPUList("/sys/devices/system/node/node" +
+                             std::to_string(node) + "/cpulist"))
+    if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+      cpus.push_back(cpu);
+  return cpus;
+}
+
+
+int SetChannelNUMANode(ChannelPlacement& placement, int node)
+{
+  {
+    std::lock_guard<std::mutex> lock(placement.lock);
+    placement.numa_node = node;
+  }
+
+  // note: nodes without allowed CPUs leave the threads on any CPU
+  return SetChannelAffinity(placement,
+                            node >= 0 ? NUMANodeCPUs(node) : std::vector<int>());
+}
+
+
+//
+// PlacementSets is a helper function to return the sets of CPUs for a
+// placement policy with their NUMA node: a set for each allowed CPU (without
+// a node), or for the allowed CPUs of each NUMA node.
+//
+static std::vector<std::pair<int, std::vector<int>>>
+PlacementSets(PlacementPolicy policy)
+{
+  std::vector<std::pair<int, std::vector<int>>> sets;
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return sets;
+
+  if (policy == kPlacementCPU)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed))
+        sets.emplace_back(-1, std::vector<int>{ cpu });
+  }
+  else if (policy == kPlacementNUMA)
+  {
+    for (int node = 0; IsNUMANode(node); node++)
+    {
+      std::vector<int> cpus = NUMANodeCPUs(node);
+      if (!cpus.empty())
+        sets.emplace_back(node, cpus);
+    }
+  }
+
+  return sets;
+}
+
+
+void AssignChannelPlacement(GridContext& context, ChannelPlacement& placement)
+{
+  if (context.placement_policy == kPlacementNone)
+    return;
+
+  auto sets = PlacementSets(context.placement_policy);
+  if (sets.empty())
+    return;
+
+  auto& set = sets[context.placement_next++ % sets.size()];
+  std::lock_guard<std::mutex> lock(placement.lock);
+  placement.numa_node = set.first;
+  placement.cpus = set.second;
+}
@@ -0,0 +1,704 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/builder/builder.h>
+
+#include <Python.h>
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+
+//
+// ChannelPool keeps a number of channels built from a layout and brought to
+// a state by a native thread, so they can be handed out immediately.
+// Channels returned to the pool are rebuilt by the same thread. Each channel
+// has its own context, which accounts the memory and threads of building the
+// channel and setting its state, and is registered with the grid on acquire.
+//
+class ChannelPool
+{
+ public:
+  struct Entry
+  {
+    Entry(const std::string& name,
+          ChannelHandle handle,
+          std::shared_ptr<ChannelContext> context)
+      : name(name), handle(handle), channel(*handle), context(context) {}
+
+    std::string                       name;
+    ChannelHandle                     handle;
+    std::shared_ptr<grid::Channel>    channel;
+    std::shared_ptr<ChannelContext>   context;
+  };
+
+  ChannelPool(std::shared_ptr<grid::Grid> grid,
+              std::shared_ptr<GridContext> context,
+              std::shared_ptr<grid::Layout> layout,
+              const std::string& text,
+              const std::string& prefix,
+              size_t size,
+              grid::State state);
+  ~ChannelPool();
+
+  std::unique_ptr<Entry> Acquire(std::string& err);
+  bool Release(const std::shared_ptr<grid::Channel>& channel);
+  size_t Available();
+
+  const std::shared_ptr<grid::Layout>& Layout() const { return layout_; }
+  const std::string& Text() const                     { return text_; }
+  size_t Size() const                                 { return size_; }
+
+ private:
+  std::shared_ptr<ChannelContext>
+  CreateContext(const std::shared_ptr<grid::Channel>& channel);
+  std::unique_ptr<Entry> Build(std::string& err);
+  bool UpdateLayout(Entry& entry);
+  bool SetState(Entry& entry, grid::State state);
+  bool Reset(Entry& entry);
+  void Remove(Entry& entry);
+  void Run();
+
+  std::shared_ptr<grid::Grid>         grid_;
+  std::shared_ptr<GridContext>        context_;
+  std::shared_ptr<grid::Layout>       layout_;
+  std::string                         text_;
+  std::string                         prefix_;
+  size_t                              size_;
+  grid::State                         state_;
+
+  std::mutex                          mutex_;
+  std::condition_variable             cond_;
+  std::deque<std::unique_ptr<Entry>>  ready_;
+  std::deque<std::unique_ptr<Entry>>  recycle_;
+  std::list<std::unique_ptr<Entry>>   acquired_;
+  std::string                         error_;
+  size_t                              building_ = 0;
+  unsigned long                       next_id_ = 0;
+  bool                                stop_ = false;
+  std::thread                         thread_;
+};
+
+
+ChannelPool::ChannelPool(std::shared_ptr<grid::Grid> grid,
+                         std::shared_ptr<GridContext> context,
+                         std::shared_ptr<grid::Layout> layout,
+                         const std::string& text,
+                         const std::string& prefix,
+                         size_t size,
+                         grid::State state)
+  : grid_(grid), context_(context), layout_(layout), text_(text),
+    prefix_(prefix), size_(size), state_(state)
+{
+  thread_ = std::thread(&ChannelPool::Run, this);
+}
+
+
+ChannelPool::~ChannelPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+
+  // note: acquired channels are owned by their users
+  for (auto& entry : ready_)
+    Remove(*entry);
+  for (auto& entry : recycle_)
+    Remove(*entry);
+}
+
+
+//
+// CreateContext creates a new context for a channel of the pool.
+//
+std::shared_ptr<ChannelContext>
+ChannelPool::CreateContext(const std::shared_ptr<grid::Channel>& channel)
+{
+  std::lock_guard<std::mutex> lock(context_->channels_lock);
+  return CreateChannelContext(*context_, channel);
+}
+
+
+//
+// UpdateLayout builds and commits the layout of the channel; the grid context
+// must be locked.
+//
+bool ChannelPool::UpdateLayout(Entry& entry)
+{
+  grid::Builder builder;
+  auto& channel = entry.channel;
+  uint64_t start = StatsNow();
+  PlacementScope placement(entry.context->placement);
+  MemoryScope memory(*entry.context->memory);
+  bool ret;
+
+  channel->CreateLayout();
+  {
+    TraceSpan span("UpdateChannel", entry.name.c_str());
+    ret = builder.UpdateChannel(*grid_, *channel, *layout_);
+  }
+  if (ret)
+  {
+    TraceSpan span("CommitLayout", entry.name.c_str());
+    ret = channel->CommitLayout();
+  }
+  if (!ret)
+    channel->AbortLayout();
+  else
+    RecordChannelStats(*entry.context, kStatsCompile, start);
+
+  return ret;
+}
+
+
+//
+// SetState sets the state of the channel.
+//
+bool ChannelPool::SetState(Entry& entry, grid::State state)
+{
+  std::string detail =
+    TraceStateDetail(entry.name.c_str(), *entry.channel, state);
+  TraceSpan span("SetState", detail.c_str());
+
+  uint64_t start = StatsNow();
+  bool ret;
+  {
+    PlacementScope placement(entry.context->placement);
+    MemoryScope memory(*entry.context->memory);
+    ret = entry.channel->SetState(state);
+  }
+  RecordChannelStats(*entry.context, kStatsSetState, start);
+  return ret;
+}
+
+
+//
+// Build allocates a new channel with a unique name, builds the layout,
+// and sets the state.
+//
+std::unique_ptr<ChannelPool::Entry> ChannelPool::Build(std::string& err)
+{
+  std::unique_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(context_->lock);
+
+    for (int retries = 0; entry == nullptr && retries < 100; retries++)
+    {
+      std::string name;
+      {
+        std::lock_guard<std::mutex> pool_lock(mutex_);
+        name = prefix_ + '-' + std::to_string(next_id_++);
+      }
+
+      auto handle = grid_->AllocateChannel(name);
+      if (handle)
+        entry.reset(new Entry(name, handle, CreateContext(*handle)));
+    }
+
+    if (entry == nullptr)
+    {
+      err = "Failed to allocate a channel";
+      return nullptr;
+    }
+
+    if (!UpdateLayout(*entry))
+    {
+      grid_->RemoveChannel(entry->handle);
+      err = "Failed to build the channel";
+      return nullptr;
+    }
+  }
+
+  if (!SetState(*entry, state_))
+  {
+    Remove(*entry);
+    err = "Failed to set the state of the channel";
+    return nullptr;
+  }
+
+  return entry;
+}
+
+
+//
+// Reset closes the channel and rebuilds the layout with a new context.
+//
+bool ChannelPool::Reset(Entry& entry)
+{
+  if (!SetState(entry, grid::kStateNull))
+    return false;
+
+  // note: the context of the previous user can be released from any thread
+  entry.context = CreateContext(entry.channel);
+  {
+    std::lock_guard<std::mutex> lock(context_->lock);
+    if (!UpdateLayout(entry))
+      return false;
+  }
+
+  return SetState(entry, state_);
+}
+
+
+//
+// Remove closes the channel and removes it from the grid.
+//
+void ChannelPool::Remove(Entry& entry)
+{
+  SetState(entry, grid::kStateNull);
+
+  std::lock_guard<std::mutex> lock(context_->lock);
+  grid_->RemoveChannel(entry.handle);
+}
+
+
+//
+// Run builds channels until the pool is filled up and rebuilds channels
+// returned to the pool.
+//
+void ChannelPool::Run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!stop_)
+  {
+    if (!recycle_.empty())
+    {
+      std::unique_ptr<Entry> entry = std::move(recycle_.front());
+      recycle_.pop_front();
+      building_++;
+
+      lock.unlock();
+      bool ret = Reset(*entry);
+      if (!ret)
+        Remove(*entry);
+      lock.lock();
+
+      building_--;
+      if (ret)
+        ready_.push_back(std::move(entry));
+      cond_.notify_all();
+    }
+    else if (ready_.size() + building_ < size_ && error_.empty())
+    {
+      building_++;
+
+      lock.unlock();
+      std::string err;
+      std::unique_ptr<Entry> entry = Build(err);
+      lock.lock();
+
+      building_--;
+      if (entry != nullptr)
+        ready_.push_back(std::move(entry));
+      else
+        error_ = err;
+      cond_.notify_all();
+    }
+    else
+      cond_.wait(lock);
+  }
+}
+
+
+//
+// Acquire returns a channel of the pool, or builds a new channel if none is
+// available. Should be called without the GIL.
+//
+std::unique_ptr<ChannelPool::Entry> ChannelPool::Acquire(std::string& err)
+{
+  std::unique_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_.empty())
+    {
+      entry = std::move(ready_.front());
+      ready_.pop_front();
+    }
+    // retry building channels after an earlier failure
+    error_.clear();
+  }
+  cond_.notify_all();
+
+  if (entry == nullptr)
+    entry = Build(err);
+
+  if (entry != nullptr)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    acquired_.push_back(std::unique_ptr<Entry>(new Entry(*entry)));
+  }
+
+  return entry;
+}
+
+
+//
+// Release returns an acquired channel to the pool. The channel is rebuilt
+// unless the pool is full, in which case it is removed.
+// Should be called without the GIL.
+//
+bool ChannelPool::Release(const std::shared_ptr<grid::Channel>& channel)
+{
+  std::unique_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto it = acquired_.begin(); it != acquired_.end(); ++it)
+    {
+      if ((*it)->channel == channel)
+      {
+        entry = std::move(*it);
+        acquired_.erase(it);
+        break;
+      }
+    }
+
+    if (entry == nullptr)
+      return false;
+
+    if (ready_.size() + recycle_.size() + building_ < size_)
+    {
+      recycle_.push_back(std::move(entry));
+      cond_.notify_all();
+      return true;
+    }
+  }
+
+  Remove(*entry);
+  return true;
+}
+
+
+size_t ChannelPool::Available()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ready_.size();
+}
+
+
+extern "C" {
+
+//
+// PyGridCreatePool implements Grid.create_pool(layout, size, state)
+//
+PyObject* PyGridCreatePool(PyGrid* self,
+                           PyObject* const* args,
+                           Py_ssize_t nargs,
+                           PyObject* kwnames)
+{
+  PyObject* values[4];
+  Py_ssize_t size = 1;
+  const char* state_name = "set";
+  const char* prefix = "pool";
+
+  static const char* kwlist[] = { "layout", "size", "state", "prefix", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  const char* text = PyUnicode_AsUTF8(values[0]);
+  if (text == NULL ||
+      (values[1] != NULL && (size = PyLong_AsSsize_t(values[1])) == -1 &&
+       PyErr_Occurred()) ||
+      (values[2] != NULL && (state_name = PyUnicode_AsUTF8(values[2])) == NULL) ||
+      (values[3] != NULL && (prefix = PyUnicode_AsUTF8(values[3])) == NULL))
+    return NULL;
+
+  if (size < 1)
+  {
+    PyErr_SetString(PyExc_ValueError, "Pool size must be at least 1");
+    return NULL;
+  }
+
+  grid::State state = GridStreamerStateFromName(state_name);
+  if (state == grid::kStateInvalid || state == grid::kStateFlushing)
+  {
+    PyErr_SetString(PyExc_ValueError, "Invalid state for the pool");
+    return NULL;
+  }
+
+  std::string err;
+  std::shared_ptr<grid::Layout> layout;
+
+  Py_BEGIN_ALLOW_THREADS
+  layout = CompileLayout(text, err);
+  Py_END_ALLOW_THREADS
+
+  if (layout == nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError, err.c_str());
+    return NULL;
+  }
+
+  PyTypeObject* pool_type = GridStreamerGetState(Py_TYPE(self))->pool_type;
+  PyPool* pypool = (PyPool*) PyType_GenericAlloc(pool_type, 0);
+  if (pypool == NULL)
+    return NULL;
+
+  Py_INCREF(self);
+  pypool->grid = self;
+  pypool->pool = std::make_shared<ChannelPool>(self->grid, self->context,
+                                               layout, text, prefix, size,
+                                               state);
+
+  return (PyObject*) pypool;
+}
+
+
+//
+// PyPoolAcquire returns a channel from the pool. The channel is registered
+// with the grid under the optional name in addition to its pool name.
+//
+static PyObject* PyPoolAcquire(PyPool* self,
+                               PyObject* const* args,
+                               Py_ssize_t nargs,
+                               PyObject* kwnames)
+{
+  PyObject* name;
+  const char* alias = NULL;
+
+  static const char* kwlist[] = { "name", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &name))
+    return NULL;
+
+  if (name != NULL && name != Py_None &&
+      (alias = PyUnicode_AsUTF8(name)) == NULL)
+    return NULL;
+
+  if (alias != NULL && PyGridFindChannelContext(self->grid, alias) != nullptr)
+  {
+    PyErr_SetString(PyExc_AttributeError,
+                    "Channel with that name already exists");
+    return NULL;
+  }
+
+  std::unique_ptr<ChannelPool::Entry> entry;
+  std::string err;
+
+  Py_BEGIN_ALLOW_THREADS
+  entry = self->pool->Acquire(err);
+  Py_END_ALLOW_THREADS
+
+  if (entry == nullptr)
+  {
+    PyErr_SetString(PyExc_RuntimeError, err.c_str());
+    return NULL;
+  }
+
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  PyChannel* pychannel = (PyChannel*) PyType_GenericAlloc(state->channel_type, 0);
+  if (pychannel == NULL)
+  {
+    Py_BEGIN_ALLOW_THREADS
+    self->pool->Release(entry->channel);
+    Py_END_ALLOW_THREADS
+    return NULL;
+  }
+
+  Py_INCREF(self->grid);
+  pychannel->grid = self->grid;
+  pychannel->channel = entry->channel;
+  pychannel->context = entry->context;
+  PyGridAddChannelContext(self->grid, entry->name, entry->context);
+  SetChannelLayout(*pychannel->context,
+                   self->pool->Layout(), self->pool->Text());
+  pychannel->name =
+    PyUnicode_FromString(alias != NULL ? alias : entry->name.c_str());
+
+  bool added = true;
+  if (alias != NULL)
+  {
+    std::lock_guard<std::mutex> lock(self->grid->context->channels_lock);
+    added = self->grid->context->channels.emplace(alias,
+                                                  pychannel->context).second;
+  }
+
+  // note: another thread could have used the name while acquiring
+  if (!added)
+  {
+    PyGridRemoveChannelContext(self->grid, entry->name);
+    Py_BEGIN_ALLOW_THREADS
+    self->pool->Release(entry->channel);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(pychannel);
+    PyErr_SetString(PyExc_AttributeError,
+                    "Channel with that name already exists");
+    return NULL;
+  }
+
+  return (PyObject*) pychannel;
+}
+
+
+//
+// PyPoolRelease returns a channel acquired from the pool, which is then
+// rebuilt in the background. The channel must not be used afterwards.
+//
+static PyObject* PyPoolRelease(PyPool* self, PyObject* arg)
+{
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(self));
+  if (!PyObject_TypeCheck(arg, state->channel_type))
+  {
+    PyErr_SetString(PyExc_TypeError, "Expected a channel");
+    return NULL;
+  }
+
+  PyChannel* pychannel = (PyChannel*) arg;
+  bool ret;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = self->pool->Release(pychannel->channel);
+  Py_END_ALLOW_THREADS
+
+  if (!ret)
+  {
+    PyErr_SetString(PyExc_ValueError, "Channel not acquired from this pool");
+    return NULL;
+  }
+
+  // drop the channel name and any alias from the grid
+  // note: the contexts are released after unlocking
+  std::vector<std::shared_ptr<ChannelContext>> contexts;
+  {
+    std::lock_guard<std::mutex> lock(self->grid->context->channels_lock);
+    auto& channels = self->grid->context->channels;
+    for (auto it = channels.begin(); it != channels.end(); )
+    {
+      if (it->second->channel == pychannel->channel)
+      {
+        contexts.push_back(std::move(it->second));
+        it = channels.erase(it);
+      }
+      else
+        ++it;
+    }
+  }
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyPoolGetAvailable returns the number of channels ready to be acquired.
+//
+static PyObject* PyPoolGetAvailable(PyPool* self)
+{
+  return PyLong_FromSize_t(self->pool->Available());
+}
+
+
+//
+// PyPoolGetSize returns the number of channels kept in the pool.
+//
+static PyObject* PyPoolGetSize(PyPool* self)
+{
+  return PyLong_FromSize_t(self->pool->Size());
+}
+
+
+//
+// PyPoolInit implements __init__, which just returns an error.
+//
+static int PyPoolInit(PyPool* self, PyObject* args, PyObject* kwargs)
+{
+  PyErr_SetString(PyExc_TypeError,
+                  "Pools can only be created using the Grid API.");
+  return -1;
+}
+
+
+//
+// PyPoolDealloc is the deallocator; it stops the pool and removes all
+// channels that weren't acquired.
+//
+static void PyPoolDealloc(PyPool* self)
+{
+  PyTypeObject* type = Py_TYPE(self);
+
+  Py_BEGIN_ALLOW_THREADS
+  self->pool.reset();
+  Py_END_ALLOW_THREADS
+
+  Py_XDECREF(self->grid);
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
+}
+
+
+static PyGetSetDef pypool_getsets[] =
+{
+  {
+    "available",
+    (getter) PyPoolGetAvailable,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    "size",
+    (getter) PyPoolGetSize,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyMethodDef pypool_methods[] =
+{
+  {
+    "acquire",
+    (PyCFunction)(void(*)(void)) PyPoolAcquire,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Return a channel from the pool, optionally registered under a name"
+  },
+  {
+    "release",
+    (PyCFunction) PyPoolRelease,
+    METH_O,
+    "Return a channel to the pool to be rebuilt"
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyType_Slot pypool_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyPoolDealloc },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "Pool keeps channels built and ready to be acquired") },
+  { Py_tp_methods, pypool_methods },
+  { Py_tp_getset, pypool_getsets },
+  { Py_tp_init, (void*) PyPoolInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
+PyType_Spec pypool_spec =
+{
+  .name = "gridstreamer.Pool",
+  .basicsize = sizeof(PyPool),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pypool_slots,
+};
+
+
+} // end of extern "C"
@@ -0,0 +1,272 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/fw/cell.h>
+#include <grid/fw/cluster.h>
+#include <grid/fw/pipeline.h>
+
+#include <Python.h>
+
+#include <time.h>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+
+std::atomic<uint32_t> profile_rate{0};
+
+
+//
+// The cell profiles are kept in a table indexed by the grid cell, which holds
+// the profiles until the grid cell is released, like the parameter states.
+//
+static std::mutex cell_profiles_lock;
+static std::unordered_map<const grid::Cell*,
+                          std::shared_ptr<CellProfile>> cell_profiles;
+static size_t cell_profiles_pruned;
+
+
+std::shared_ptr<CellProfile>
+GetCellProfile(const std::shared_ptr<grid::Cell>& cell)
+{
+  std::shared_ptr<CellProfile> profile;
+  std::list<std::shared_ptr<CellProfile>> expired;
+  {
+    std::lock_guard<std::mutex> lock(cell_profiles_lock);
+
+    // drop profiles of released cells whenever the table doubled
+    if (cell_profiles.size() >= 2 * cell_profiles_pruned + 64)
+    {
+      for (auto it = cell_profiles.begin(); it != cell_profiles.end(); )
+      {
+        if (it->second->cell.expired())
+        {
+          expired.push_back(std::move(it->second));
+          it = cell_profiles.erase(it);
+        }
+        else
+          ++it;
+      }
+      cell_profiles_pruned = cell_profiles.size();
+    }
+
+    auto& entry = cell_profiles[cell.get()];
+    if (entry == nullptr || entry->cell.expired())
+    {
+      expired.push_back(std::move(entry));
+      entry = std::make_shared<CellProfile>();
+      entry->cell = cell;
+    }
+    profile = entry;
+  }
+
+  return profile;
+}
+
+
+//
+// FindCellProfile returns the profile of a cell, or nullptr if there is none.
+//
+static std::shared_ptr<CellProfile>
+FindCellProfile(const std::shared_ptr<grid::Cell>& cell)
+{
+  std::lock_guard<std::mutex> lock(cell_profiles_lock);
+  auto it = cell_profiles.find(cell.get());
+  if (it == cell_profiles.end() || it->second->cell.lock() != cell)
+    return nullptr;
+  return it->second;
+}
+
+
+//
+// ProfileCPUTime is a helper function to return the CPU time of the thread
+// in nanoseconds.
+//
+static uint64_t ProfileCPUTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+ProfileScope::ProfileScope(CellProfile* profile)
+  : profile_(NULL), wall_(0), cpu_(0)
+{
+  uint32_t rate = profile_rate.load(std::memory_order_relaxed);
+  if (rate == 0 || profile == NULL)
+    return;
+
+  profile_ = profile;
+  uint64_t calls = profile->calls.fetch_add(1, std::memory_order_relaxed);
+  if (calls % rate == 0)
+    wall_ = StatsNow();
+
+  int64_t queue = profile->queue.fetch_add(1, std::memory_order_relaxed) + 1;
+  int64_t curr = profile->queue_max.load(std::memory_order_relaxed);
+  while (queue > curr &&
+         !profile->queue_max.compare_exchange_weak(curr, queue,
+                                                   std::memory_order_relaxed))
+    ;
+}
+
+
+void ProfileScope::Dispatch()
+{
+  if (wall_ != 0)
+    cpu_ = ProfileCPUTime();
+}
+
+
+ProfileScope::~ProfileScope()
+{
+  if (profile_ == NULL)
+    return;
+
+  profile_->queue.fetch_sub(1, std::memory_order_relaxed);
+  if (wall_ == 0)
+    return;
+
+  uint64_t wall = StatsNow() - wall_;
+  profile_->samples.fetch_add(1, std::memory_order_relaxed);
+  profile_->wall_ns.fetch_add(wall, std::memory_order_relaxed);
+  if (cpu_ != 0)
+    profile_->cpu_ns.fetch_add(ProfileCPUTime() - cpu_,
+                               std::memory_order_relaxed);
+
+  uint64_t curr = profile_->max_ns.load(std::memory_order_relaxed);
+  while (wall > curr &&
+         !profile_->max_ns.compare_exchange_weak(curr, wall,
+                                                 std::memory_order_relaxed))
+    ;
+}
+
+
+//
+// ProfileRow is a helper function to return the profile of a cell as a
+// dictionary. The CPU and wall times are estimated for all calls from the
+// sampled calls.
+//
+static PyObject* ProfileRow(const std::string& path,
+                            const std::shared_ptr<grid::Cell>& cell,
+                            bool reset)
+{
+  unsigned long long calls = 0, samples = 0, cpu = 0, wall = 0, max = 0;
+  long long queue = 0, queue_max = 0;
+
+  auto profile = FindCellProfile(cell);
+  if (profile != nullptr)
+  {
+    calls = profile->calls;
+    samples = profile->samples;
+    cpu = profile->cpu_ns;
+    wall = profile->wall_ns;
+    max = profile->max_ns;
+    queue = profile->queue;
+    queue_max = profile->queue_max;
+
+    if (reset)
+    {
+      profile->calls = 0;
+      profile->samples = 0;
+      profile->cpu_ns = 0;
+      profile->wall_ns = 0;
+      profile->max_ns = 0;
+      profile->queue_max = 0;
+    }
+  }
+
+  double scale = samples != 0 ? (double) calls / samples : 0.0;
+
+  return Py_BuildValue("{sssssKsKsdsdsKsLsL}",
+                       "path", path.c_str(),
+                       "type", cell->Type().c_str(),
+                       "calls", calls,
+                       "samples", samples,
+                       "cpu_ns", cpu * scale,
+                       "wall_ns", wall * scale,
+                       "max_ns", max,
+                       "queue", queue,
+                       "queue_max", queue_max);
+}
+
+
+bool GridStreamerCellProfiles(PyObject* list,
+                              const std::string& path,
+                              const std::shared_ptr<grid::Cell>& cell,
+                              bool reset)
+{
+  PyObject* row = ProfileRow(path, cell, reset);
+  if (row == NULL || PyList_Append(list, row) != 0)
+  {
+    Py_XDECREF(row);
+    return false;
+  }
+  Py_DECREF(row);
+
+  grid::Cluster*  cluster =  cell->ClusterInterface();
+  grid::Pipeline* pipeline = cell->PipelineInterface();
+  if (cluster == nullptr && pipeline == nullptr)
+    return true;
+
+  grid::Registry<grid::Cell>& cells = pipeline != nullptr ?
+    pipeline->GetCells() : cluster->GetCells();
+
+  for (auto cell_it = cells.Begin(); cell_it != cells.End(); ++cell_it)
+    if (!GridStreamerCellProfiles(list, path + '/' + cell_it.Key(),
+                                  *cell_it, reset))
+      return false;
+
+  return true;
+}
+
+
+//
+// GridStreamerProfileStart starts profiling the callback events of the cells,
+// measuring one in rate events of each cell.
+//
+PyObject* GridStreamerProfileStart(PyObject* module,
+                                   PyObject* const* args,
+                                   Py_ssize_t nargs,
+                                   PyObject* kwnames)
+{
+  PyObject* pyrate;
+
+  static const char* kwlist[] = { "rate", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyrate))
+    return NULL;
+
+  unsigned long rate = 1;
+  if (pyrate != NULL)
+  {
+    rate = PyLong_AsUnsignedLong(pyrate);
+    if (rate == (unsigned long) -1 && PyErr_Occurred())
+      return NULL;
+    if (rate == 0 || rate > UINT32_MAX)
+    {
+      PyErr_SetString(PyExc_ValueError, "rate must be between 1 and 2**32-1");
+      return NULL;
+    }
+  }
+
+  profile_rate = rate;
+  Py_RETURN_TRUE;
+}
+
+
+//
+// GridStreamerProfileStop stops profiling; the profiles are kept.
+//
+PyObject* GridStreamerProfileStop(PyObject* module, PyObject*)
+{
+  profile_rate = 0;
+  Py_RETURN_TRUE;
+}
@@ -0,0 +1,116 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+//
+// The C API of the pygridstreamer module for other native extensions.
+//
+// The API is a table of functions exported as the capsule
+// "pygridstreamer._C_API", which gives direct access to the grid objects of
+// the python objects, and to the helper functions that convert arguments.
+//
+//   const PyGridStreamer_CAPI* api = PyGridStreamer_Import();
+//   if (api == NULL)
+//     return NULL;
+//
+//   std::shared_ptr<grid::Parameter> param;
+//   if (!api->FindParameter(pychannel, "pipeline/cell.param", &param))
+//     return NULL;
+//
+// Functions are only appended to the table, and the version is incremented
+// with every addition. Functions return false (or NULL) and set a Python
+// exception on errors, and require the GIL unless noted otherwise.
+//
+
+#ifndef PYGRIDSTREAMER_H
+#define PYGRIDSTREAMER_H
+
+#include <Python.h>
+
+#include <memory>
+
+namespace grid {
+class Grid;
+class Channel;
+class Cell;
+class Parameter;
+class Callback;
+}
+
+#define PYGRIDSTREAMER_CAPSULE_NAME   "pygridstreamer._C_API"
+#define PYGRIDSTREAMER_API_VERSION    2
+
+// A latency stage of a channel (opaque).
+typedef struct PyGridStreamer_LatencyStage PyGridStreamer_LatencyStage;
+
+
+typedef struct
+{
+  unsigned int  version;
+
+  // Return the grid object of a Grid, Channel, Cell, Parameter, or Callback.
+  bool (*GetGrid)(PyObject* grid, std::shared_ptr<grid::Grid>* out);
+  bool (*GetChannel)(PyObject* channel, std::shared_ptr<grid::Channel>* out);
+  bool (*GetCell)(PyObject* cell, std::shared_ptr<grid::Cell>* out);
+  bool (*GetParameter)(PyObject* parameter,
+                       std::shared_ptr<grid::Parameter>* out);
+  bool (*GetCallback)(PyObject* callback,
+                      std::shared_ptr<grid::Callback>* out);
+
+  // Return the cell ("pipeline/cell") or parameter ("pipeline/cell.param")
+  // of the committed layout of a Channel without creating python objects.
+  bool (*FindCell)(PyObject* channel, const char* path,
+                   std::shared_ptr<grid::Cell>* out);
+  bool (*FindParameter)(PyObject* channel, const char* path,
+                        std::shared_ptr<grid::Parameter>* out);
+
+  // Set a parameter from an argument buffer and notify the binding of the
+  // change, or only notify the binding of a change made by the extension.
+  // These functions can be called without the GIL and don't set exceptions.
+  bool (*SetParameter)(grid::Parameter* parameter,
+                       void* args_buf, size_t args_sz);
+  void (*ParameterChanged)(const grid::Parameter* parameter);
+
+  // Convert between python objects and argument buffers.
+  PyObject* (*ReadArguments)(void* args_buf, size_t args_sz,
+                             const unsigned long* traits);
+  bool (*WriteArguments)(PyObject* args, void* args_buf, size_t args_sz,
+                         const unsigned long* traits);
+  bool (*WriteNumber)(double value, void* args_buf, size_t args_sz,
+                      const unsigned long* traits);
+
+  // Version 2: Return the latency stage of a Channel for a name, such as
+  // "source_to_sink", and record a latency in nanoseconds, for example from
+  // the timestamps of buffers. The stage is valid as long as the channel.
+  // Recording can be called from any thread without the GIL.
+  PyGridStreamer_LatencyStage* (*GetLatencyStage)(PyObject* channel,
+                                                  const char* name);
+  void (*RecordLatency)(PyGridStreamer_LatencyStage* stage,
+                        unsigned long long ns);
+} PyGridStreamer_CAPI;
+
+
+//
+// PyGridStreamer_Import imports the pygridstreamer module and returns its
+// C API, or NULL if the module is older than this header.
+//
+static inline const PyGridStreamer_CAPI* PyGridStreamer_Import(void)
+{
+  const PyGridStreamer_CAPI* api = (const PyGridStreamer_CAPI*)
+    PyCapsule_Import(PYGRIDSTREAMER_CAPSULE_NAME, 0);
+  if (api != NULL && api->version < PYGRIDSTREAMER_API_VERSION)
+  {
+    PyErr_Format(PyExc_ImportError,
+                 "pygridstreamer C API version %u is older than %u",
+                 api->version, (unsigned int) PYGRIDSTREAMER_API_VERSION);
+    return NULL;
+  }
+  return api;
+}
+
+
+#endif  // PYGRIDSTREAMER_H
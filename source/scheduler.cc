@@ -0,0 +1,290 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/fw/parameter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// note: shorter intervals would keep the scheduler thread spinning
+const std::chrono::microseconds kMinInterval(100);
+
+
+// Automation describes a scheduled parameter automation.
+struct Automation
+{
+  std::shared_ptr<grid::Parameter>  parameter;
+  std::vector<ParameterKeyframe>    keyframes;
+  ParameterInterpolation            interpolation;
+  std::chrono::microseconds         interval;
+  Clock::time_point                 start;
+  Clock::time_point                 next;
+};
+
+
+// Pending describes an evaluated value that is waiting to be applied.
+struct Pending
+{
+  std::shared_ptr<grid::Parameter>  parameter;
+  double                            value;
+};
+
+
+//
+// Scheduler applies all automations from a single native thread, which is
+// started with the first automation and stopped when the module is unloaded.
+// Values are applied one at a time without the lock, and cancelling or
+// replacing an automation drops its pending values and waits for a value
+// that is being applied, so no value of the automation is written after.
+//
+class Scheduler
+{
+ public:
+  ~Scheduler();
+
+  void Schedule(Automation&& automation);
+  bool Cancel(const grid::Parameter* parameter);
+
+ private:
+  void Run();
+  bool RemoveLocked(const grid::Parameter* parameter);
+  void WaitLocked(std::unique_lock<std::mutex>& lock,
+                  const grid::Parameter* parameter);
+  static bool Evaluate(const Automation& automation,
+                       Clock::time_point now,
+                       double& value);
+  static void Apply(grid::Parameter& parameter, double value);
+
+  std::mutex              mutex_;
+  std::condition_variable cond_;
+  std::condition_variable applied_;
+  std::list<Automation>   automations_;
+  std::deque<Pending>     pending_;
+  const grid::Parameter*  applying_ = nullptr;
+  std::thread             thread_;
+  bool                    stop_ = false;
+};
+
+
+Scheduler::~Scheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+
+  if (thread_.joinable())
+    thread_.join();
+}
+
+
+void Scheduler::Schedule(Automation&& automation)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  RemoveLocked(automation.parameter.get());
+  WaitLocked(lock, automation.parameter.get());
+  automations_.push_back(std::move(automation));
+
+  if (!thread_.joinable())
+    thread_ = std::thread(&Scheduler::Run, this);
+  cond_.notify_one();
+}
+
+
+bool Scheduler::Cancel(const grid::Parameter* parameter)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  bool ret = RemoveLocked(parameter);
+  WaitLocked(lock, parameter);
+  return ret;
+}
+
+
+//
+// RemoveLocked removes the automation and the pending values of a parameter
+// and returns false if there was no automation.
+//
+bool Scheduler::RemoveLocked(const grid::Parameter* parameter)
+{
+  pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                [&](const Pending& p) {
+                                    return p.parameter.get() == parameter;
+                                }),
+                 pending_.end());
+
+  size_t size = automations_.size();
+  automations_.remove_if([&](const Automation& a) {
+      return a.parameter.get() == parameter;
+  });
+  return automations_.size() != size;
+}
+
+
+//
+// WaitLocked waits until a value of the parameter that is being applied is
+// written. Watchers called by the scheduler thread don't wait for themselves.
+//
+void Scheduler::WaitLocked(std::unique_lock<std::mutex>& lock,
+                           const grid::Parameter* parameter)
+{
+  if (std::this_thread::get_id() != thread_.get_id())
+    applied_.wait(lock, [&]() { return applying_ != parameter; });
+}
+
+
+//
+// Evaluate returns the interpolated value of the automation for the given time
+// and returns false when the value is of the last keyframe.
+//
+bool Scheduler::Evaluate(const Automation& automation,
+                         Clock::time_point now,
+                         double& value)
+{
+  auto& keyframes = automation.keyframes;
+  double time = std::chrono::duration<double>(now - automation.start).count();
+
+  size_t i = 1;
+  while (i < keyframes.size() && keyframes[i].time < time)
+    i++;
+
+  if (time <= keyframes.front().time)
+    value = keyframes.front().value;
+  else if (i == keyframes.size())
+    value = keyframes.back().value;
+  else
+  {
+    const ParameterKeyframe& k0 = keyframes[i - 1];
+    const ParameterKeyframe& k1 = keyframes[i];
+    double f = k1.time > k0.time ? (time - k0.time) / (k1.time - k0.time) : 1;
+
+    // exponential interpolation requires values of the same sign
+    if (automation.interpolation == kInterpolationExponential &&
+        k0.value * k1.value > 0)
+      value = k0.value * std::pow(k1.value / k0.value, f);
+    else
+      value = k0.value + (k1.value - k0.value) * f;
+  }
+
+  return time < keyframes.back().time;
+}
+
+
+//
+// Apply sets the value of the parameter. It must be called without the lock,
+// because the watchers of the parameter can schedule or cancel automations.
+//
+void Scheduler::Apply(grid::Parameter& parameter, double value)
+{
+  size_t arg_buf_sz = parameter.GetArgumentBufferSize();
+  char arg_buf[arg_buf_sz];
+
+  if (GridStreamerWriteNumber(value, arg_buf, arg_buf_sz,
+                              parameter.GetSignature()) &&
+      parameter.CallUnsafe(NULL, 0, arg_buf, arg_buf_sz))
+    ParameterChanged(&parameter);
+}
+
+
+void Scheduler::Run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!stop_)
+  {
+    if (!pending_.empty())
+    {
+      Pending pending = std::move(pending_.front());
+      pending_.pop_front();
+
+      applying_ = pending.parameter.get();
+      lock.unlock();
+      Apply(*pending.parameter, pending.value);
+      lock.lock();
+      applying_ = nullptr;
+      applied_.notify_all();
+      continue;
+    }
+
+    if (automations_.empty())
+    {
+      cond_.wait(lock);
+      continue;
+    }
+
+    Clock::time_point now = Clock::now();
+
+    for (auto it = automations_.begin(); it != automations_.end(); )
+    {
+      if (it->next <= now)
+      {
+        double value;
+        bool more = Evaluate(*it, now, value);
+        pending_.push_back({ it->parameter, value });
+        if (!more)
+        {
+          it = automations_.erase(it);
+          continue;
+        }
+        it->next = std::max(it->next + it->interval, now);
+      }
+      ++it;
+    }
+
+    if (!pending_.empty())
+      continue;
+
+    Clock::time_point next = Clock::time_point::max();
+    for (auto& automation : automations_)
+      next = std::min(next, automation.next);
+
+    if (next != Clock::time_point::max())
+      cond_.wait_until(lock, next);
+  }
+}
+
+
+Scheduler scheduler;
+
+} // end of namespace
+
+
+void ScheduleParameter(std::shared_ptr<grid::Parameter> parameter,
+                       std::vector<ParameterKeyframe> keyframes,
+                       ParameterInterpolation interpolation,
+                       std::chrono::microseconds interval)
+{
+  Automation automation;
+  automation.parameter = parameter;
+  automation.keyframes = std::move(keyframes);
+  automation.interpolation = interpolation;
+  automation.interval = std::max(interval, kMinInterval);
+  automation.start = Clock::now();
+  automation.next = automation.start;
+
+  scheduler.Schedule(std::move(automation));
+}
+
+
+bool CancelParameterSchedule(const grid::Parameter* parameter)
+{
+  return scheduler.Cancel(parameter);
+}
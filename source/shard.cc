@@ -0,0 +1,2485 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <grid/base/basegrid.h>
+#include <grid/builder/builder.h>
+#include <grid/fw/callback.h>
+#include <grid/fw/cell.h>
+#include <grid/util/function.h>
+
+#include <Python.h>
+#include <structmember.h>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdarg>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <unordered_map>
+
+extern char** environ;
+
+
+//
+// A sharded grid runs its channels in worker processes (shards), which run
+// a native loop without the GIL in a new python process. The grid talks to
+// a shard over a socket with a binary protocol of request and reply messages
+// (native byte order):
+//
+//   request:   uint16_t op, uint16_t reserved, uint32_t channel, payload
+//   reply:     int32_t status, payload (or the error message)
+//
+// Strings in the payload are stored with a uint32_t length, signatures as a
+// uint32_t count followed by the traits, and parameter values serialized by
+// GridStreamerSerializeArguments. Callback events are sent over a ring
+// buffer in shared memory, and dispatched by a thread of the grid.
+//
+enum ShardOp : uint16_t
+{
+  kShardAllocate = 1,
+  kShardCompile,
+  kShardSetState,
+  kShardGetState,
+  kShardSignature,
+  kShardGet,
+  kShardApply,
+  kShardConnect,
+  kShardDisconnect,
+};
+
+enum ShardStatus : int32_t
+{
+  kShardOk = 0,
+  kShardError,
+  kShardErrorKey,
+  kShardErrorLayout,
+  kShardErrorValue,
+};
+
+struct ShardRequest
+{
+  uint16_t                          op;
+  uint16_t                          reserved;
+  uint32_t                          channel;
+};
+
+static const size_t kShardMaxMessage = 1 << 16;
+
+
+//
+// ShardRing is the header of the ring buffer of a shard, which is followed by
+// the data. The worker writes records of callback events at the head, and the
+// reader of the grid reads them at the tail. Records don't wrap around; a
+// padding record fills the end of the data instead. The reader sleeps on the
+// waiting flag (a futex) when the ring is empty. Events that don't fit into
+// the ring are dropped.
+//
+struct ShardRing
+{
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint32_t> waiting;
+  std::atomic<uint64_t>             events;
+  std::atomic<uint64_t>             dropped;
+  uint64_t                          capacity;
+};
+
+struct ShardRecord
+{
+  uint32_t                          size;
+  uint32_t                          callback;
+};
+
+static const uint32_t kShardPadding = UINT32_MAX;
+
+
+static char* ShardRingData(ShardRing* ring)
+{
+  return (char*) (ring + 1);
+}
+
+
+//
+// ShardRingPush writes a record to the ring and wakes the reader; it returns
+// false if the ring is full. Writers must be serialized.
+//
+static bool ShardRingPush(ShardRing* ring,
+                          uint32_t callback,
+                          const char* data,
+                          size_t len)
+{
+  size_t size = (sizeof(ShardRecord) + len + 7) & ~7UL;
+  uint64_t capacity = ring->capacity;
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+  size_t offset = head % capacity;
+  size_t padding = capacity - offset < size ? capacity - offset : 0;
+  if (size > capacity / 2 || head + padding + size - tail > capacity)
+  {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  char* base = ShardRingData(ring);
+  if (padding != 0)
+  {
+    ShardRecord record = { (uint32_t) padding, kShardPadding };
+    memcpy(base + offset, &record, sizeof(record));
+    head += padding;
+    offset = 0;
+  }
+
+  ShardRecord record = { (uint32_t) size, callback };
+  memcpy(base + offset, &record, sizeof(record));
+  memcpy(base + offset + sizeof(record), data, len);
+
+  ring->head.store(head + size);
+  ring->events.fetch_add(1, std::memory_order_relaxed);
+
+  if (ring->waiting.exchange(0) != 0)
+    syscall(SYS_futex, &ring->waiting, FUTEX_WAKE, 1, NULL, NULL, 0);
+  return true;
+}
+
+
+//
+// AppendString and ReadString are helper functions to write and read a
+// length-prefixed string of a message.
+//
+static void AppendString(std::string& msg, const std::string& str)
+{
+  uint32_t len = str.size();
+  msg.append((const char*) &len, sizeof(len));
+  msg.append(str);
+}
+
+
+static bool ReadString(const char*& ptr, const char* end, std::string& str)
+{
+  uint32_t len;
+  if (end - ptr < (ptrdiff_t) sizeof(len))
+    return false;
+  memcpy(&len, ptr, sizeof(len));
+  ptr += sizeof(len);
+  if ((size_t) (end - ptr) < len)
+    return false;
+  str.assign(ptr, len);
+  ptr += len;
+  return true;
+}
+
+
+//
+// AppendValue and ReadValue are helper functions to write and read a value
+// of a message.
+//
+template <typename T>
+static void AppendValue(std::string& msg, T value)
+{
+  msg.append((const char*) &value, sizeof(value));
+}
+
+
+template <typename T>
+static bool ReadValue(const char*& ptr, const char* end, T& value)
+{
+  if (end - ptr < (ptrdiff_t) sizeof(value))
+    return false;
+  memcpy(&value, ptr, sizeof(value));
+  ptr += sizeof(value);
+  return true;
+}
+
+
+//
+// AppendSignature and ReadSignature are helper functions to write and read
+// the traits of a signature; the traits include the count.
+//
+static void AppendSignature(std::string& msg, const unsigned long* traits)
+{
+  AppendValue<uint32_t>(msg, traits[0]);
+  msg.append((const char*) (traits + 1), traits[0] * sizeof(traits[0]));
+}
+
+
+static bool ReadSignature(const char*& ptr,
+                          const char* end,
+                          std::vector<unsigned long>& traits)
+{
+  uint32_t count;
+  if (!ReadValue(ptr, end, count) ||
+      (size_t) (end - ptr) / sizeof(unsigned long) < count)
+    return false;
+
+  traits.resize(count + 1);
+  traits[0] = count;
+  memcpy(traits.data() + 1, ptr, count * sizeof(unsigned long));
+  ptr += count * sizeof(unsigned long);
+  return true;
+}
+
+
+//
+// ReceiveMessage is a helper function to receive a message from the socket;
+// it returns false if the socket was closed or failed.
+//
+static bool ReceiveMessage(int fd, std::string& msg)
+{
+  msg.resize(kShardMaxMessage);
+  ssize_t len;
+  do
+    len = recv(fd, &msg[0], msg.size(), 0);
+  while (len < 0 && errno == EINTR);
+
+  if (len <= 0)
+    return false;
+  msg.resize(len);
+  return true;
+}
+
+
+static bool SendMessage(int fd, const std::string& msg)
+{
+  ssize_t len;
+  do
+    len = send(fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+  while (len < 0 && errno == EINTR);
+  return len == (ssize_t) msg.size();
+}
+
+
+//
+// ShardWorker runs the channels of a shard in the worker process. Callback
+// events of the channels are written to the ring by the native threads of the
+// channels.
+//
+class ShardWorker
+{
+ public:
+  ShardWorker(int fd, ShardRing* ring) : fd_(fd), ring_(ring) {}
+
+  void Run();
+
+ private:
+  struct Channel
+  {
+    ChannelHandle                     handle;
+    std::shared_ptr<ChannelContext>   context;
+  };
+
+  struct Callback
+  {
+    ShardWorker*                      worker;
+    uint32_t                          id;
+    std::shared_ptr<grid::Callback>   callback;
+    std::unique_ptr<grid::Slot>       slot;
+  };
+
+  int32_t Handle(const ShardRequest& request,
+                 const char* ptr,
+                 const char* end,
+                 std::string& reply);
+  int32_t Build(Channel& channel,
+                const std::shared_ptr<grid::Layout>& layout,
+                const std::string& text,
+                std::string& err);
+  int32_t Connect(Channel& channel, const std::string& path, std::string& reply);
+
+  static void OnCallback(uintptr_t context...);
+  static void OnClose(const grid::Slot& slot, uintptr_t context) {}
+
+  int                                           fd_;
+  ShardRing*                                    ring_;
+  std::mutex                                    ring_lock_;
+  grid::BaseGrid                                grid_;
+  std::unordered_map<uint32_t, Channel>         channels_;
+  std::unordered_map<uint32_t, std::unique_ptr<Callback>> callbacks_;
+  uint32_t                                      next_callback_ = 1;
+};
+
+
+void ShardWorker::Run()
+{
+  std::string request;
+  std::string reply;
+
+  while (ReceiveMessage(fd_, request))
+  {
+    ShardRequest header;
+    const char* ptr = request.data();
+    const char* end = ptr + request.size();
+
+    reply.assign(sizeof(int32_t), '\0');
+    int32_t status = ReadValue(ptr, end, header) ?
+      Handle(header, ptr, end, reply) : (int32_t) kShardError;
+
+    if (status != kShardOk && reply.size() == sizeof(int32_t))
+      reply += "invalid request";
+    memcpy(&reply[0], &status, sizeof(status));
+
+    if (!SendMessage(fd_, reply))
+      break;
+  }
+
+  // note: slots must be released before the channels
+  callbacks_.clear();
+  for (auto& channel : channels_)
+  {
+    channel.second.context->channel->SetState(grid::kStateNull);
+    grid_.RemoveChannel(channel.second.handle);
+  }
+  channels_.clear();
+}
+
+
+int32_t ShardWorker::Build(Channel& channel,
+                           const std::shared_ptr<grid::Layout>& layout,
+                           const std::string& text,
+                           std::string& err)
+{
+  auto& context = *channel.context;
+  auto& grid_channel = context.channel;
+  grid::Builder builder;
+
+  grid_channel->CreateLayout();
+  bool committed = builder.UpdateChannel(grid_, *grid_channel, *layout) &&
+    grid_channel->CommitLayout();
+  if (!committed)
+  {
+    grid_channel->AbortLayout();
+    err = "Failed to build the channel";
+    return kShardError;
+  }
+
+  SetChannelLayout(context, layout, text);
+  return kShardOk;
+}
+
+
+//
+// OnCallback writes a callback event to the ring. The arguments are stored
+// like in an argument buffer, so they can be read by the grid with
+// PyGridStreamerReadArguments.
+//
+void ShardWorker::OnCallback(uintptr_t context...)
+{
+  Callback* self = (Callback*) context;
+  const unsigned long* traits = self->callback->Signature();
+
+  size_t args_sz = 0;
+  for (size_t i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_sz = ((args_sz + align - 1) & -align) + count * size;
+  }
+
+  // note: vectors are allocated with the alignment of any argument
+  std::vector<char> buf(args_sz);
+  uintptr_t args_ptr = (uintptr_t) buf.data();
+
+  va_list args;
+  va_start(args, context);
+
+  size_t i;
+  for (i = 1; i <= traits[0]; i++)
+  {
+    unsigned long trait = traits[i];
+    unsigned int count = trait >> grid::kCountShift;
+    size_t size = 1 << (trait & grid::kSizeMask);
+    size_t align = 1 << ((trait & grid::kAlignMask) >> grid::kAlignShift);
+    args_ptr = (args_ptr + align - 1) & -align;
+
+    if (count > 1)
+    {
+      unsigned long t =  (trait & ~grid::kCountMask) | (1 << grid::kCountShift);
+      if (t != grid::TypeT<uint8_t>::Sig)
+        break;
+      memcpy((void*) args_ptr, va_arg(args, char*), size);
+    }
+    else
+    {
+      switch (trait)
+      {
+        case grid::TypeT<uint8_t>::Sig:
+          *(uint8_t*) args_ptr = va_arg(args, unsigned int); break;
+        case grid::TypeT<uint16_t>::Sig:
+          *(uint16_t*) args_ptr = va_arg(args, unsigned int); break;
+        case grid::TypeT<uint32_t>::Sig:
+          *(uint32_t*) args_ptr = va_arg(args, unsigned int); break;
+        case grid::TypeT<uint64_t>::Sig:
+          *(uint64_t*) args_ptr = va_arg(args, uint64_t); break;
+        case grid::TypeT<int8_t>::Sig:
+          *(int8_t*) args_ptr = va_arg(args, int); break;
+        case grid::TypeT<int16_t>::Sig:
+          *(int16_t*) args_ptr = va_arg(args, int); break;
+        case grid::TypeT<int32_t>::Sig:
+          *(int32_t*) args_ptr = va_arg(args, int); break;
+        case grid::TypeT<int64_t>::Sig:
+          *(int64_t*) args_ptr = va_arg(args, int64_t); break;
+        case grid::TypeT<bool>::Sig:
+          *(bool*) args_ptr = va_arg(args, int); break;
+        case grid::TypeT<float>::Sig:
+          *(float*) args_ptr = va_arg(args, double); break;
+        case grid::TypeT<double>::Sig:
+          *(double*) args_ptr = va_arg(args, double); break;
+        case grid::TypeT<long double>::Sig:
+          *(long double*) args_ptr = va_arg(args, double); break;
+        default:
+          goto out;
+      }
+    }
+    args_ptr += count * size;
+  }
+
+out:
+  va_end(args);
+
+  if (i <= traits[0])
+  {
+    self->worker->ring_->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(self->worker->ring_lock_);
+  ShardRingPush(self->worker->ring_, self->id, buf.data(), buf.size());
+}
+
+
+//
+// Connect connects to the callback of a cell by the path of the callback
+// ("pipeline/cell.on_callback") and returns its id and signature.
+//
+int32_t ShardWorker::Connect(Channel& channel,
+                             const std::string& path,
+                             std::string& reply)
+{
+  size_t dot = path.rfind('.');
+  auto cell = dot != std::string::npos ?
+    FindCell(*channel.context, path.substr(0, dot)) : nullptr;
+  if (cell == nullptr)
+  {
+    reply += path;
+    return kShardErrorKey;
+  }
+
+  std::string name = path.substr(dot + 1);
+  auto& callbacks = cell->GetCallbacks();
+  for (auto cb_it = callbacks.Begin(); cb_it != callbacks.End(); ++cb_it)
+  {
+    if (name != cb_it.Key() && name != "on_" + PythonifyName(cb_it.Key()))
+      continue;
+
+    auto callback = std::make_unique<Callback>();
+    callback->worker = this;
+    callback->id = next_callback_++;
+    callback->callback = *cb_it;
+    callback->slot = callback->callback->Connect(OnCallback, OnClose,
+                                                 (uintptr_t) callback.get());
+
+    AppendValue<uint32_t>(reply, callback->id);
+    AppendSignature(reply, callback->callback->Signature());
+    callbacks_[callback->id] = std::move(callback);
+    return kShardOk;
+  }
+
+  reply += path;
+  return kShardErrorKey;
+}
+
+
+int32_t ShardWorker::Handle(const ShardRequest& request,
+                            const char* ptr,
+                            const char* end,
+                            std::string& reply)
+{
+  std::string err;
+
+  if (request.op == kShardAllocate)
+  {
+    std::string name, text;
+    if (!ReadString(ptr, end, name) || !ReadString(ptr, end, text))
+      return kShardError;
+
+    auto handle = grid_.AllocateChannel(name);
+    if (!handle)
+    {
+      reply += "Channel with that name already exists";
+      return kShardError;
+    }
+
+    Channel channel = { handle, std::make_shared<ChannelContext>() };
+    channel.context->channel = *handle;
+    channel.context->indexed = false;
+    channel.context->memory = std::make_shared<ChannelMemory>();
+
+    int32_t status = kShardOk;
+    if (!text.empty())
+    {
+      auto layout = CompileLayout(text, err);
+      status = layout != nullptr ?
+        Build(channel, layout, text, err) : (int32_t) kShardErrorLayout;
+    }
+    if (status != kShardOk)
+    {
+      grid_.RemoveChannel(handle);
+      reply += err;
+      return status;
+    }
+
+    channels_[request.channel] = std::move(channel);
+    return kShardOk;
+  }
+
+  auto it = channels_.find(request.channel);
+  if (it == channels_.end())
+  {
+    reply += "Invalid channel";
+    return kShardError;
+  }
+  Channel& channel = it->second;
+  auto& grid_channel = channel.context->channel;
+
+  switch (request.op)
+  {
+    case kShardCompile:
+    {
+      std::string text;
+      if (!ReadString(ptr, end, text))
+        return kShardError;
+
+      auto layout = CompileLayout(text, err);
+      if (layout == nullptr)
+      {
+        reply += err;
+        return kShardErrorLayout;
+      }
+      if (layout == GetChannelLayout(*channel.context))
+        return kShardOk;
+
+      int32_t status = Build(channel, layout, text, err);
+      reply += err;
+      return status;
+    }
+
+    case kShardSetState:
+    {
+      int32_t state;
+      if (!ReadValue(ptr, end, state))
+        return kShardError;
+      AppendValue<uint8_t>(reply, grid_channel->SetState((grid::State) state));
+      return kShardOk;
+    }
+
+    case kShardGetState:
+      AppendValue<int32_t>(reply, grid_channel->GetState());
+      return kShardOk;
+
+    case kShardSignature:
+    case kShardGet:
+    {
+      std::string path;
+      if (!ReadString(ptr, end, path))
+        return kShardError;
+
+      auto param = FindParameter(*channel.context, path);
+      if (param == nullptr)
+      {
+        reply += path;
+        return kShardErrorKey;
+      }
+
+      AppendSignature(reply, param->GetSignature());
+      AppendValue<uint64_t>(reply, param->GetArgumentBufferSize());
+      if (request.op == kShardSignature)
+        return kShardOk;
+
+      std::vector<char> buf(param->GetArgumentBufferSize());
+      if (!param->GetValues(buf.data(), buf.size()))
+      {
+        reply.resize(sizeof(int32_t));
+        reply += "Failed to get parameter values";
+        return kShardErrorValue;
+      }
+      GridStreamerSerializeArguments(reply, buf.data(), buf.size(),
+                                     param->GetSignature());
+      return kShardOk;
+    }
+
+    case kShardApply:
+    {
+      // note: like apply(), all changes are reverted if any change fails
+      struct Entry
+      {
+        std::shared_ptr<grid::Parameter>  parameter;
+        std::vector<char>                 prev;
+      };
+      std::vector<Entry> entries;
+
+      uint32_t count;
+      if (!ReadValue(ptr, end, count))
+        return kShardError;
+
+      int32_t status = kShardOk;
+      for (uint32_t i = 0; i < count && status == kShardOk; i++)
+      {
+        std::string path;
+        uint8_t scan;
+        if (!ReadString(ptr, end, path) || !ReadValue(ptr, end, scan))
+        {
+          status = kShardError;
+          break;
+        }
+
+        auto param = FindParameter(*channel.context, path);
+        if (param == nullptr)
+        {
+          reply += "Invalid parameter '" + path + "'";
+          status = kShardErrorKey;
+          break;
+        }
+
+        Entry entry = { param, std::vector<char>(param->GetArgumentBufferSize()) };
+        if (!param->GetValues(entry.prev.data(), entry.prev.size()))
+        {
+          reply += "Failed to get parameter '" + path + "'";
+          status = kShardErrorValue;
+          break;
+        }
+
+        bool ret;
+        if (scan)
+        {
+          std::string str;
+          ret = ReadString(ptr, end, str) && param->Scan(str);
+        }
+        else
+        {
+          std::vector<char> buf(param->GetArgumentBufferSize());
+          const unsigned long* traits = param->GetSignature();
+          ret = GridStreamerDeserializeArguments(ptr, end, buf.data(),
+                                                 buf.size(), traits);
+          if (ret)
+          {
+            ret = param->CallUnsafe(NULL, 0, buf.data(), buf.size());
+            GridStreamerReleaseArguments(buf.data(), buf.size(), traits);
+          }
+        }
+
+        if (!ret)
+        {
+          GridStreamerReleaseArguments(entry.prev.data(), entry.prev.size(),
+                                       param->GetSignature());
+          reply += "Failed to set parameter, reverted";
+          status = kShardErrorValue;
+          break;
+        }
+        entries.push_back(std::move(entry));
+      }
+
+      bool reverted = true;
+      if (status != kShardOk)
+        for (size_t i = entries.size(); i-- > 0; )
+          reverted &= entries[i].parameter->CallUnsafe(NULL, 0,
+                                                       entries[i].prev.data(),
+                                                       entries[i].prev.size());
+
+      for (auto& entry : entries)
+        GridStreamerReleaseArguments(entry.prev.data(), entry.prev.size(),
+                                     entry.parameter->GetSignature());
+
+      if (!reverted)
+      {
+        reply = "Failed to set parameter and to revert the changes";
+        status = kShardError;
+      }
+      return status;
+    }
+
+    case kShardConnect:
+    {
+      std::string path;
+      if (!ReadString(ptr, end, path))
+        return kShardError;
+      return Connect(channel, path, reply);
+    }
+
+    case kShardDisconnect:
+    {
+      uint32_t id;
+      if (!ReadValue(ptr, end, id))
+        return kShardError;
+      callbacks_.erase(id);
+      return kShardOk;
+    }
+  }
+
+  return kShardError;
+}
+
+
+//
+// ShardCallback keeps the functions connected to a callback of a shard, and
+// the signature of its events.
+//
+struct ShardCallback
+{
+  uint32_t                          channel;
+  std::string                       path;
+  std::vector<unsigned long>        traits;
+  std::list<PyObject*>              functions;
+};
+
+
+//
+// Shard is a worker process of a sharded grid. Requests are serialized by
+// the call lock and sent without the GIL. The reader thread dispatches the
+// callback events of the shard to the connected functions, acquiring the GIL
+// once for all events that are read together. The lock protects the
+// callbacks.
+//
+class Shard
+{
+ public:
+  explicit Shard(PyInterpreterState* interp) : interp_(interp) {}
+  ~Shard();
+
+  bool Start(const std::string& executable,
+             const std::string& module,
+             size_t ring_size,
+             std::string& err);
+
+  // Shut down the socket, which stops the worker and fails any requests.
+  void Shutdown();
+
+  // Send a request and receive the reply; must be called without the GIL.
+  int32_t Call(ShardOp op,
+               uint32_t channel,
+               const std::string& payload,
+               std::string& reply);
+
+  // Add or remove a function of a callback by its id; the signature is only
+  // used for the first function.
+  void AddFunction(uint32_t id,
+                   uint32_t channel,
+                   const std::string& path,
+                   const std::vector<unsigned long>& traits,
+                   PyObject* func);
+  bool RemoveFunction(uint32_t channel,
+                      const std::string& path,
+                      PyObject* func,
+                      uint32_t& id,
+                      bool& empty);
+  bool FindCallback(uint32_t channel, const std::string& path, uint32_t& id);
+
+  PyObject* ToDict();
+
+  size_t                            channels = 0;
+
+ private:
+  bool FindCallbackLocked(uint32_t channel, const std::string& path,
+                          uint32_t& id);
+  void Read();
+  void Dispatch(std::vector<std::pair<uint32_t, std::vector<char>>>& events);
+
+  PyInterpreterState*               interp_;
+  pid_t                             pid_ = -1;
+  int                               fd_ = -1;
+  ShardRing*                        ring_ = NULL;
+  size_t                            map_size_ = 0;
+  std::mutex                        call_lock_;
+  std::mutex                        lock_;
+  std::unordered_map<uint32_t, ShardCallback> callbacks_;
+  std::atomic<bool>                 stop_{false};
+  std::atomic<bool>                 closed_{false};
+  std::thread                       reader_;
+};
+
+
+bool Shard::Start(const std::string& executable,
+                  const std::string& module,
+                  size_t ring_size,
+                  std::string& err)
+{
+  map_size_ = sizeof(ShardRing) + ring_size;
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0)
+  {
+    err = strerror(errno);
+    return false;
+  }
+  fd_ = sockets[0];
+
+  int memfd = syscall(SYS_memfd_create, "gridstreamer-shard", MFD_CLOEXEC);
+  void* map = MAP_FAILED;
+  if (memfd >= 0 && ftruncate(memfd, map_size_) == 0)
+    map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (map == MAP_FAILED)
+  {
+    err = strerror(errno);
+    if (memfd >= 0)
+      close(memfd);
+    close(sockets[1]);
+    return false;
+  }
+
+  ring_ = new (map) ShardRing();
+  ring_->capacity = ring_size;
+
+  // note: the worker loads the module from the same file, and gets the socket
+  // and the ring as file descriptors 3 and 4
+  static const char kWorker[] =
+    "import sys, importlib.util as u\n"
+    "s = u.spec_from_file_location('pygridstreamer', sys.argv[1])\n"
+    "m = u.module_from_spec(s)\n"
+    "s.loader.exec_module(m)\n"
+    "m._shard_worker(3, 4)\n";
+
+  const char* argv[] = {
+    executable.c_str(), "-c", kWorker, module.c_str(), NULL
+  };
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, sockets[1], 3);
+  posix_spawn_file_actions_adddup2(&actions, memfd, 4);
+
+  int ret = posix_spawn(&pid_, executable.c_str(), &actions, NULL,
+                        (char* const*) argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(sockets[1]);
+  close(memfd);
+
+  if (ret != 0)
+  {
+    pid_ = -1;
+    err = strerror(ret);
+    return false;
+  }
+
+  reader_ = std::thread(&Shard::Read, this);
+  return true;
+}
+
+
+//
+// ShardWaitExit is a helper function to wait for the worker to exit within the
+// timeout (in milliseconds, negative for none); it returns false if the
+// worker is still running.
+//
+static bool ShardWaitExit(pid_t pid, int timeout)
+{
+  auto end = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(timeout);
+
+  for (;;)
+  {
+    int status;
+    pid_t ret = waitpid(pid, &status, timeout < 0 ? 0 : WNOHANG);
+    if (ret == pid || (ret < 0 && errno != EINTR))
+      return true;
+    if (ret == 0 && std::chrono::steady_clock::now() >= end)
+      return false;
+    if (ret == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+
+void Shard::Shutdown()
+{
+  closed_ = true;
+  if (fd_ >= 0)
+    shutdown(fd_, SHUT_RDWR);
+}
+
+
+Shard::~Shard()
+{
+  if (reader_.joinable())
+  {
+    stop_ = true;
+    ring_->waiting = 0;
+    syscall(SYS_futex, &ring_->waiting, FUTEX_WAKE, 1, NULL, NULL, 0);
+    reader_.join();
+  }
+
+  // note: the worker exits when the socket is closed, unless it's stuck, such
+  // as in setting the state of a channel
+  const int kExitTimeout = 2000;
+  const int kTerminateTimeout = 1000;
+
+  if (fd_ >= 0)
+    close(fd_);
+  if (pid_ > 0 && !ShardWaitExit(pid_, kExitTimeout))
+  {
+    kill(pid_, SIGTERM);
+    if (!ShardWaitExit(pid_, kTerminateTimeout))
+    {
+      kill(pid_, SIGKILL);
+      ShardWaitExit(pid_, -1);
+    }
+  }
+  if (ring_ != NULL)
+    munmap(ring_, map_size_);
+
+  if (!callbacks_.empty())
+  {
+    InterpreterLock lock(interp_);
+    for (auto& callback : callbacks_)
+      for (auto func : callback.second.functions)
+        Py_DECREF(func);
+  }
+}
+
+
+int32_t Shard::Call(ShardOp op,
+                    uint32_t channel,
+                    const std::string& payload,
+                    std::string& reply)
+{
+  ShardRequest header = { op, 0, channel };
+  std::string request((const char*) &header, sizeof(header));
+  request += payload;
+
+  std::lock_guard<std::mutex> lock(call_lock_);
+  if (request.size() > kShardMaxMessage)
+  {
+    reply = "Request too large";
+    return kShardError;
+  }
+
+  int32_t status;
+  if (!SendMessage(fd_, request) || !ReceiveMessage(fd_, reply) ||
+      reply.size() < sizeof(status))
+  {
+    reply = closed_ ? "Sharded grid is closed" : "Shard exited";
+    return kShardError;
+  }
+
+  memcpy(&status, reply.data(), sizeof(status));
+  reply.erase(0, sizeof(status));
+  return status;
+}
+
+
+void Shard::AddFunction(uint32_t id,
+                        uint32_t channel,
+                        const std::string& path,
+                        const std::vector<unsigned long>& traits,
+                        PyObject* func)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  auto& callback = callbacks_[id];
+  if (callback.functions.empty())
+  {
+    callback.channel = channel;
+    callback.path = path;
+    callback.traits = traits;
+  }
+  Py_INCREF(func);
+  callback.functions.push_back(func);
+}
+
+
+//
+// FindCallbackLocked is a helper function to find the id of a callback of a
+// channel by its path. The lock must be held.
+//
+bool Shard::FindCallbackLocked(uint32_t channel,
+                               const std::string& path,
+                               uint32_t& id)
+{
+  for (auto& callback : callbacks_)
+  {
+    if (callback.second.channel == channel && callback.second.path == path)
+    {
+      id = callback.first;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool Shard::FindCallback(uint32_t channel, const std::string& path, uint32_t& id)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return FindCallbackLocked(channel, path, id);
+}
+
+
+bool Shard::RemoveFunction(uint32_t channel,
+                           const std::string& path,
+                           PyObject* func,
+                           uint32_t& id,
+                           bool& empty)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!FindCallbackLocked(channel, path, id))
+    return false;
+
+  auto& functions = callbacks_[id].functions;
+  auto it = std::find(functions.begin(), functions.end(), func);
+  if (it == functions.end())
+    return false;
+
+  functions.erase(it);
+  empty = functions.empty();
+  if (empty)
+    callbacks_.erase(id);
+
+  // note: the caller holds the GIL
+  Py_DECREF(func);
+  return true;
+}
+
+
+//
+// Read reads the events from the ring until the shard is stopped, and copies
+// them, so the worker can reuse the ring while they are dispatched.
+//
+void Shard::Read()
+{
+  std::vector<std::pair<uint32_t, std::vector<char>>> events;
+  char* base = ShardRingData(ring_);
+
+  while (!stop_)
+  {
+    uint64_t tail = ring_->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring_->head.load(std::memory_order_acquire);
+
+    if (tail == head)
+    {
+      // note: the worker clears the flag and wakes the reader after writing
+      ring_->waiting.store(1);
+      if (ring_->head.load() == tail && !stop_)
+      {
+        struct timespec timeout = { 0, 100000000 };
+        syscall(SYS_futex, &ring_->waiting, FUTEX_WAIT, 1, &timeout, NULL, 0);
+      }
+      ring_->waiting.store(0);
+      continue;
+    }
+
+    while (tail != head)
+    {
+      ShardRecord record;
+      const char* ptr = base + tail % ring_->capacity;
+      memcpy(&record, ptr, sizeof(record));
+      if (record.callback != kShardPadding)
+        events.emplace_back(record.callback,
+                            std::vector<char>(ptr + sizeof(record),
+                                              ptr + record.size));
+      tail += record.size;
+    }
+    ring_->tail.store(tail, std::memory_order_release);
+
+    Dispatch(events);
+    events.clear();
+  }
+}
+
+
+void Shard::Dispatch(std::vector<std::pair<uint32_t, std::vector<char>>>& events)
+{
+  uint64_t start = StatsNow();
+  InterpreterLock gil(interp_);
+  StatsRecord(kStatsGILWait, StatsNow() - start);
+
+  for (auto& event : events)
+  {
+    StatsCount(kStatsCallbackReceived);
+
+    std::list<PyObject*> functions;
+    std::vector<unsigned long> traits;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      auto it = callbacks_.find(event.first);
+      if (it != callbacks_.end())
+      {
+        functions = it->second.functions;
+        traits = it->second.traits;
+        for (auto func : functions)
+          Py_INCREF(func);
+      }
+    }
+
+    if (functions.empty())
+    {
+      StatsCount(kStatsCallbackDropped);
+      continue;
+    }
+
+    PyObject* tuple = PyGridStreamerReadArguments(event.second.data(),
+                                                  event.second.size(),
+                                                  traits.data());
+    if (tuple == NULL)
+      PyErr_Print();
+
+    for (auto func : functions)
+    {
+      if (tuple != NULL)
+      {
+        start = StatsNow();
+        if (!PyObject_CallObject(func, tuple))
+          PyErr_Print();
+        StatsRecord(kStatsHandler, StatsNow() - start);
+      }
+      Py_DECREF(func);
+    }
+
+    Py_XDECREF(tuple);
+    StatsCount(tuple != NULL ? kStatsCallbackDispatched : kStatsCallbackDropped);
+  }
+}
+
+
+PyObject* Shard::ToDict()
+{
+  return Py_BuildValue("{sisnsKsK}",
+                       "pid", (int) pid_,
+                       "channels", (Py_ssize_t) channels,
+                       "events", (unsigned long long) ring_->events.load(),
+                       "dropped", (unsigned long long) ring_->dropped.load());
+}
+
+
+//
+// ShardedGrid keeps the shards and the channels by name. The channel ids are
+// unique in the grid. The lock protects the channels and the signatures of
+// their parameters.
+//
+class ShardedGrid
+{
+ public:
+  struct Signature
+  {
+    std::vector<unsigned long>      traits;
+    size_t                          size;
+  };
+
+  struct Channel
+  {
+    size_t                          shard;
+    uint32_t                        id;
+    std::string                     text;
+    std::unordered_map<std::string, Signature> signatures;
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::mutex                          lock;
+  std::unordered_map<std::string, Channel> channels;
+  uint32_t                            next_id = 1;
+};
+
+
+//
+// ShardError is a helper function to raise the exception for the status and
+// error message of a reply.
+//
+static void ShardError(int32_t status, const std::string& err)
+{
+  PyObject* type = PyExc_RuntimeError;
+  if (status == kShardErrorKey)
+    type = PyExc_KeyError;
+  else if (status == kShardErrorLayout)
+    type = PyExc_AttributeError;
+  else if (status == kShardErrorValue)
+    type = PyExc_TypeError;
+
+  PyErr_SetString(type, err.c_str());
+}
+
+
+//
+// ShardCall is a helper function to send a request to a shard without the
+// GIL, and raise an exception if it failed.
+//
+static bool ShardCall(Shard& shard,
+                      ShardOp op,
+                      uint32_t channel,
+                      const std::string& payload,
+                      std::string& reply)
+{
+  int32_t status;
+
+  Py_BEGIN_ALLOW_THREADS
+  status = shard.Call(op, channel, payload, reply);
+  Py_END_ALLOW_THREADS
+
+  if (status == kShardOk)
+    return true;
+
+  ShardError(status, reply);
+  return false;
+}
+
+
+//
+// ShardedGridRef keeps the grid while a channel calls its shard, so close()
+// can't release the shards meanwhile. The grid is released without the GIL,
+// because stopping the shards waits for their readers, which need the GIL.
+//
+struct ShardedGridRef
+{
+  ~ShardedGridRef()
+  {
+    if (grid == nullptr)
+      return;
+
+    Py_BEGIN_ALLOW_THREADS
+    grid.reset();
+    Py_END_ALLOW_THREADS
+  }
+
+  std::shared_ptr<ShardedGrid>      grid;
+};
+
+
+extern "C" {
+
+
+//
+// PyShardedChannelCreate is a helper function to create the object of a
+// channel of the sharded grid.
+//
+static PyObject* PyShardedChannelCreate(PyShardedGrid* grid,
+                                        const std::string& name)
+{
+  GridStreamerState* state = GridStreamerGetState(Py_TYPE(grid));
+  PyShardedChannel* pychannel =
+    (PyShardedChannel*) PyType_GenericAlloc(state->sharded_channel_type, 0);
+  if (pychannel == NULL)
+    return NULL;
+
+  Py_INCREF(grid);
+  pychannel->grid = grid;
+  pychannel->name = PyUnicode_FromString(name.c_str());
+  if (pychannel->name == NULL)
+  {
+    Py_DECREF(pychannel);
+    return NULL;
+  }
+  return (PyObject*) pychannel;
+}
+
+
+//
+// PyShardedChannelFind is a helper function to return the shard and id of the
+// channel, or NULL with an exception set if the channel doesn't exist. The
+// shard is valid while the reference to the grid is kept.
+//
+static Shard* PyShardedChannelFind(PyShardedChannel* self,
+                                   ShardedGridRef& ref,
+                                   uint32_t& id)
+{
+  ref.grid = self->grid->grid;
+  auto& grid = ref.grid;
+  if (grid == nullptr)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Sharded grid is closed");
+    return NULL;
+  }
+
+  const char* name = PyUnicode_AsUTF8(self->name);
+  if (name == NULL)
+    return NULL;
+
+  std::lock_guard<std::mutex> lock(grid->lock);
+  auto it = grid->channels.find(name);
+  if (it == grid->channels.end())
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", name);
+    return NULL;
+  }
+
+  id = it->second.id;
+  return grid->shards[it->second.shard].get();
+}
+
+
+//
+// PyShardedGridInit implements __init__ and starts the shards, by default one
+// for each CPU the process is allowed to run on.
+//
+static int PyShardedGridInit(PyShardedGrid* self, PyObject* args, PyObject* kwargs)
+{
+  PyObject* name = NULL;
+  Py_ssize_t count = 0;
+  Py_ssize_t ring_size = 1 << 20;
+
+  // note: name is a borrowed reference
+  static const char* kwlist[] = { "name", "shards", "ring_size", NULL };
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Onn", (char**) kwlist,
+                                   &name, &count, &ring_size))
+    return -1;
+
+  // note: the shards of the grid can only be released without the GIL
+  if (self->grid != nullptr)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Sharded grid is already initialized");
+    return -1;
+  }
+
+  if (count <= 0)
+  {
+    cpu_set_t set;
+    count = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+  }
+  if (ring_size < 4096 || ring_size % 64 != 0)
+  {
+    PyErr_SetString(PyExc_ValueError,
+                    "ring_size must be a multiple of 64 and at least 4096");
+    return -1;
+  }
+
+  PyObject* executable = PySys_GetObject("executable");
+  const char* executable_utf8 =
+    executable != NULL ? PyUnicode_AsUTF8(executable) : NULL;
+  if (executable_utf8 == NULL || *executable_utf8 == '\0')
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Python executable not found");
+    return -1;
+  }
+
+  PyObject* module = PyType_GetModule(Py_TYPE(self));
+  PyObject* path = module != NULL ? PyModule_GetFilenameObject(module) : NULL;
+  const char* path_utf8 = path != NULL ? PyUnicode_AsUTF8(path) : NULL;
+  if (path_utf8 == NULL)
+  {
+    Py_XDECREF(path);
+    return -1;
+  }
+  std::string module_path = path_utf8;
+  Py_DECREF(path);
+
+  auto grid = std::make_shared<ShardedGrid>();
+  PyInterpreterState* interp = PyInterpreterState_Get();
+  std::string err;
+  bool started = true;
+
+  Py_BEGIN_ALLOW_THREADS
+  for (Py_ssize_t i = 0; started && i < count; i++)
+  {
+    grid->shards.push_back(std::make_unique<Shard>(interp));
+    started = grid->shards.back()->Start(executable_utf8, module_path,
+                                         ring_size, err);
+  }
+  if (!started)
+    grid.reset();
+  Py_END_ALLOW_THREADS
+
+  if (!started)
+  {
+    PyErr_Format(PyExc_OSError, "Failed to start shard: %s", err.c_str());
+    return -1;
+  }
+
+  Py_XINCREF(name);
+  Py_XSETREF(self->name, name);
+  self->grid = std::move(grid);
+  return 0;
+}
+
+
+//
+// PyShardedGridClose stops the shards; their channels are released. Requests
+// to the shards that are in progress fail.
+//
+static PyObject* PyShardedGridClose(PyShardedGrid* self, PyObject*)
+{
+  auto grid = std::move(self->grid);
+  if (grid != nullptr)
+    for (auto& shard : grid->shards)
+      shard->Shutdown();
+
+  // note: stopping the shards waits for the readers, which need the GIL
+  Py_BEGIN_ALLOW_THREADS
+  grid.reset();
+  Py_END_ALLOW_THREADS
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyShardedGridDealloc is the deallocator
+//
+static void PyShardedGridDealloc(PyShardedGrid* self)
+{
+  PyTypeObject* type = Py_TYPE(self);
+
+  Py_XDECREF(PyShardedGridClose(self, NULL));
+  Py_XDECREF(self->name);
+  self->~PyShardedGrid();
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
+}
+
+
+//
+// PyShardedGridAllocateChannel allocates a new channel in the shard with the
+// fewest channels, or the given shard, with a required name and optional
+// layout.
+//
+static PyObject*
+PyShardedGridAllocateChannel(PyShardedGrid* self,
+                             PyObject* const* args,
+                             Py_ssize_t nargs,
+                             PyObject* kwnames)
+{
+  PyObject* values[3];
+
+  // note: name, layout, shard are borrowed references
+  static const char* kwlist[] = { "name", "layout", "shard", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 1, values))
+    return NULL;
+
+  ShardedGridRef ref = { self->grid };
+  auto& grid = ref.grid;
+  if (grid == nullptr)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Sharded grid is closed");
+    return NULL;
+  }
+
+  const char* name = PyUnicode_AsUTF8(values[0]);
+  if (name == NULL || strlen(name) == 0)
+  {
+    PyErr_SetString(PyExc_AttributeError, "Invalid name for the channel");
+    return NULL;
+  }
+
+  std::string text;
+  if (values[1] != NULL && values[1] != Py_None)
+  {
+    Py_ssize_t len;
+    const char* str = PyUnicode_AsUTF8AndSize(values[1], &len);
+    if (str == NULL)
+      return NULL;
+    text.assign(str, len);
+  }
+
+  Py_ssize_t index = -1;
+  if (values[2] != NULL && values[2] != Py_None)
+  {
+    index = PyLong_AsSsize_t(values[2]);
+    if (index == -1 && PyErr_Occurred())
+      return NULL;
+    if (index < 0 || (size_t) index >= grid->shards.size())
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid shard %zd", index);
+      return NULL;
+    }
+  }
+
+  // note: the channel is reserved, so the name can't be used meanwhile
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(grid->lock);
+    if (grid->channels.count(name) != 0)
+    {
+      PyErr_SetString(PyExc_AttributeError,
+                      "Channel with that name already exists");
+      return NULL;
+    }
+
+    if (index < 0)
+    {
+      index = 0;
+      for (size_t i = 1; i < grid->shards.size(); i++)
+        if (grid->shards[i]->channels < grid->shards[index]->channels)
+          index = i;
+    }
+
+    id = grid->next_id++;
+    grid->channels[name] = { (size_t) index, id, text, {} };
+    grid->shards[index]->channels++;
+  }
+
+  std::string payload, reply;
+  AppendString(payload, name);
+  AppendString(payload, text);
+
+  if (!ShardCall(*grid->shards[index], kShardAllocate, id, payload, reply))
+  {
+    std::lock_guard<std::mutex> lock(grid->lock);
+    grid->channels.erase(name);
+    grid->shards[index]->channels--;
+    return NULL;
+  }
+
+  return PyShardedChannelCreate(self, name);
+}
+
+
+//
+// PyShardedGridGetChannels returns all channels of the sharded grid.
+//
+static PyObject* PyShardedGridGetChannels(PyShardedGrid* self, PyObject*)
+{
+  std::vector<std::string> names;
+  if (self->grid != nullptr)
+  {
+    std::lock_guard<std::mutex> lock(self->grid->lock);
+    for (auto& channel : self->grid->channels)
+      names.push_back(channel.first);
+  }
+  std::sort(names.begin(), names.end());
+
+  PyObject* list = PyList_New(0);
+  if (list == NULL)
+    return NULL;
+
+  for (auto& name : names)
+  {
+    PyObject* pychannel = PyShardedChannelCreate(self, name);
+    if (pychannel == NULL || PyList_Append(list, pychannel) != 0)
+    {
+      Py_XDECREF(pychannel);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(pychannel);
+  }
+
+  return list;
+}
+
+
+//
+// PyShardedGridGetShards returns the process id, number of channels, and the
+// callback events sent and dropped of each shard.
+//
+static PyObject* PyShardedGridGetShards(PyShardedGrid* self, PyObject*)
+{
+  PyObject* list = PyList_New(0);
+  if (list == NULL || self->grid == nullptr)
+    return list;
+
+  std::lock_guard<std::mutex> lock(self->grid->lock);
+  for (auto& shard : self->grid->shards)
+  {
+    PyObject* dict = shard->ToDict();
+    if (dict == NULL || PyList_Append(list, dict) != 0)
+    {
+      Py_XDECREF(dict);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(dict);
+  }
+
+  return list;
+}
+
+
+//
+// PyShardedChannelSignature is a helper function to return the signature of
+// a parameter of the channel, which is requested once from the shard.
+//
+static bool PyShardedChannelSignature(PyShardedChannel* self,
+                                      ShardedGrid& grid,
+                                      Shard& shard,
+                                      uint32_t id,
+                                      const std::string& path,
+                                      ShardedGrid::Signature& signature)
+{
+  const char* name = PyUnicode_AsUTF8(self->name);
+  {
+    std::lock_guard<std::mutex> lock(grid.lock);
+    auto it = grid.channels.find(name);
+    if (it != grid.channels.end())
+    {
+      auto sig_it = it->second.signatures.find(path);
+      if (sig_it != it->second.signatures.end())
+      {
+        signature = sig_it->second;
+        return true;
+      }
+    }
+  }
+
+  std::string payload, reply;
+  AppendString(payload, path);
+  if (!ShardCall(shard, kShardSignature, id, payload, reply))
+    return false;
+
+  const char* ptr = reply.data();
+  const char* end = ptr + reply.size();
+  uint64_t size;
+  if (!ReadSignature(ptr, end, signature.traits) || !ReadValue(ptr, end, size))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Invalid reply");
+    return false;
+  }
+  signature.size = size;
+
+  std::lock_guard<std::mutex> lock(grid.lock);
+  auto it = grid.channels.find(name);
+  if (it != grid.channels.end())
+    it->second.signatures[path] = signature;
+  return true;
+}
+
+
+//
+// PyShardedChannelGet returns the value of a parameter of the channel
+// ("pipeline/cell.parameter") as a tuple.
+//
+static PyObject* PyShardedChannelGet(PyShardedChannel* self, PyObject* pypath)
+{
+  const char* path = PyUnicode_AsUTF8(pypath);
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = path != NULL ? PyShardedChannelFind(self, ref, id) : NULL;
+  if (shard == NULL)
+    return NULL;
+
+  std::string payload, reply;
+  AppendString(payload, path);
+  if (!ShardCall(*shard, kShardGet, id, payload, reply))
+    return NULL;
+
+  const char* ptr = reply.data();
+  const char* end = ptr + reply.size();
+  std::vector<unsigned long> traits;
+  uint64_t size;
+  if (!ReadSignature(ptr, end, traits) || !ReadValue(ptr, end, size))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Invalid reply");
+    return NULL;
+  }
+
+  std::vector<char> buf(size);
+  if (!GridStreamerDeserializeArguments(ptr, end, buf.data(), size,
+                                        traits.data()))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Invalid reply");
+    return NULL;
+  }
+
+  PyObject* value = PyGridStreamerReadArguments(buf.data(), size,
+                                                traits.data());
+  GridStreamerReleaseArguments(buf.data(), size, traits.data());
+  return value;
+}
+
+
+//
+// PyShardedChannelApply sets multiple parameters, keyed by
+// 'pipeline/cell.parameter', at once. All changes are reverted if any change
+// fails.
+//
+static PyObject* PyShardedChannelApply(PyShardedChannel* self, PyObject* values)
+{
+  if (!PyDict_Check(values))
+  {
+    PyErr_SetString(PyExc_TypeError, "Expected a dictionary of parameters");
+    return NULL;
+  }
+
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = PyShardedChannelFind(self, ref, id);
+  if (shard == NULL)
+    return NULL;
+
+  // note: fetching a signature releases the GIL, so take a snapshot of the
+  //       items, which can otherwise be changed or freed by other threads
+  PyObject* items = PyDict_Items(values);
+  if (items == NULL)
+    return NULL;
+
+  std::string payload;
+  AppendValue<uint32_t>(payload, PyList_GET_SIZE(items));
+
+  bool ret = true;
+  for (Py_ssize_t i = 0; ret && i < PyList_GET_SIZE(items); i++)
+  {
+    PyObject* key = PyTuple_GET_ITEM(PyList_GET_ITEM(items, i), 0);
+    PyObject* value = PyTuple_GET_ITEM(PyList_GET_ITEM(items, i), 1);
+
+    const char* path = PyUnicode_AsUTF8(key);
+    ShardedGrid::Signature signature;
+    ret = path != NULL &&
+          PyShardedChannelSignature(self, *ref.grid, *shard, id, path,
+                                    signature);
+    if (!ret)
+      break;
+
+    AppendString(payload, path);
+    const unsigned long* traits = signature.traits.data();
+    if (PyUnicode_Check(value) && traits[0] > 1)
+    {
+      const char* text = PyUnicode_AsUTF8(value);
+      ret = text != NULL;
+      if (ret)
+      {
+        AppendValue<uint8_t>(payload, 1);
+        AppendString(payload, text);
+      }
+      continue;
+    }
+
+    std::vector<char> buf(signature.size);
+    GridStreamerConstructArguments(buf.data(), buf.size(), traits);
+    ret = PyGridStreamerWriteArguments(value, buf.data(), buf.size(), traits);
+    if (ret)
+    {
+      AppendValue<uint8_t>(payload, 0);
+      GridStreamerSerializeArguments(payload, buf.data(), buf.size(), traits);
+    }
+    GridStreamerReleaseArguments(buf.data(), buf.size(), traits);
+  }
+  Py_DECREF(items);
+
+  std::string reply;
+  if (!ret || !ShardCall(*shard, kShardApply, id, payload, reply))
+    return NULL;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyShardedChannelCompile compiles a new layout to the channel in its shard.
+//
+static PyObject* PyShardedChannelCompile(PyShardedChannel* self,
+                                         PyObject* pylayout)
+{
+  Py_ssize_t len;
+  const char* text = PyUnicode_AsUTF8AndSize(pylayout, &len);
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = text != NULL ? PyShardedChannelFind(self, ref, id) : NULL;
+  if (shard == NULL)
+    return NULL;
+
+  std::string payload, reply;
+  AppendString(payload, std::string(text, len));
+  if (!ShardCall(*shard, kShardCompile, id, payload, reply))
+    return NULL;
+
+  // note: the parameters of the new layout can have other signatures
+  auto& grid = ref.grid;
+  std::lock_guard<std::mutex> lock(grid->lock);
+  auto it = grid->channels.find(PyUnicode_AsUTF8(self->name));
+  if (it != grid->channels.end())
+  {
+    it->second.text.assign(text, len);
+    it->second.signatures.clear();
+  }
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyShardedChannelSetState is a helper function to set the state of the
+// channel in its shard.
+//
+static PyObject* PyShardedChannelSetState(PyShardedChannel* self,
+                                          grid::State state)
+{
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = PyShardedChannelFind(self, ref, id);
+  if (shard == NULL)
+    return NULL;
+
+  std::string payload, reply;
+  AppendValue<int32_t>(payload, state);
+  if (!ShardCall(*shard, kShardSetState, id, payload, reply))
+    return NULL;
+
+  return PyBool_FromLong(!reply.empty() && reply[0] != 0);
+}
+
+
+static PyObject* PyShardedChannelOpen(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStateSet);
+}
+
+
+static PyObject* PyShardedChannelClose(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStateNull);
+}
+
+
+static PyObject* PyShardedChannelRun(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStateRunning);
+}
+
+
+static PyObject* PyShardedChannelPause(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStatePaused);
+}
+
+
+static PyObject* PyShardedChannelFlush(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStateFlushing);
+}
+
+
+static PyObject* PyShardedChannelStop(PyShardedChannel* self, PyObject*)
+{
+  return PyShardedChannelSetState(self, grid::kStateReady);
+}
+
+
+//
+// PyShardedChannelGetStateValue is a helper function to return the state of
+// the channel from its shard, or kStateInvalid with an exception set.
+//
+static grid::State PyShardedChannelGetStateValue(PyShardedChannel* self)
+{
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = PyShardedChannelFind(self, ref, id);
+  if (shard == NULL)
+    return grid::kStateInvalid;
+
+  std::string reply;
+  if (!ShardCall(*shard, kShardGetState, id, std::string(), reply))
+    return grid::kStateInvalid;
+
+  int32_t state;
+  const char* ptr = reply.data();
+  if (!ReadValue(ptr, ptr + reply.size(), state))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Invalid reply");
+    return grid::kStateInvalid;
+  }
+  return (grid::State) state;
+}
+
+
+//
+// PyShardedChannelGetState returns the state of the channel.
+//
+static PyObject* PyShardedChannelGetState(PyShardedChannel* self, void*)
+{
+  grid::State state = PyShardedChannelGetStateValue(self);
+  if (state == grid::kStateInvalid)
+    return NULL;
+  return PyUnicode_FromString(GridStreamerStateName(state));
+}
+
+
+//
+// PyShardedChannelWait waits until the channel is in the state ("end" by
+// default), and returns True, or False if the timeout expired. It raises an
+// exception if the channel is in the error state. The state is polled from
+// the shard.
+//
+static PyObject* PyShardedChannelWait(PyShardedChannel* self,
+                                      PyObject* const* args,
+                                      Py_ssize_t nargs,
+                                      PyObject* kwnames)
+{
+  using namespace std::chrono;
+
+  PyObject* values[2];
+
+  static const char* kwlist[] = { "state", "timeout", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, values))
+    return NULL;
+
+  grid::State state = grid::kStateEnd;
+  if (values[0] != NULL)
+  {
+    const char* name = PyUnicode_AsUTF8(values[0]);
+    if (name == NULL)
+      return NULL;
+    state = !strcmp(name, "end") ?
+      grid::kStateEnd : GridStreamerStateFromName(name);
+    if (state == grid::kStateInvalid)
+    {
+      PyErr_Format(PyExc_ValueError, "Invalid state '%s'", name);
+      return NULL;
+    }
+  }
+
+  double timeout = -1;
+  if (values[1] != NULL && values[1] != Py_None)
+  {
+    timeout = PyFloat_AsDouble(values[1]);
+    if (timeout == -1.0 && PyErr_Occurred())
+      return NULL;
+    if (timeout < 0)
+    {
+      PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+      return NULL;
+    }
+  }
+
+  const auto kMaxDelay = microseconds(10000);
+  auto end = steady_clock::now() + duration_cast<steady_clock::duration>(
+      duration<double>(std::max(timeout, 0.0)));
+  auto delay = microseconds(50);
+
+  grid::State curr;
+  while ((curr = PyShardedChannelGetStateValue(self)) != state &&
+         curr != grid::kStateError && curr != grid::kStateInvalid)
+  {
+    if (timeout >= 0 && steady_clock::now() >= end)
+      break;
+
+    Py_BEGIN_ALLOW_THREADS
+    std::this_thread::sleep_for(delay);
+    Py_END_ALLOW_THREADS
+    delay = std::min(delay * 2, kMaxDelay);
+
+    if (PyErr_CheckSignals() != 0)
+      return NULL;
+  }
+
+  if (curr == grid::kStateInvalid)
+    return NULL;
+
+  if (curr == grid::kStateError && state != grid::kStateError)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Channel is in the error state");
+    return NULL;
+  }
+
+  return PyBool_FromLong(curr == state);
+}
+
+
+//
+// PyShardedChannelConnect connects a function to a callback of the channel
+// by its path ("pipeline/cell.on_callback"). The events are dispatched from
+// a thread of the grid.
+//
+static PyObject* PyShardedChannelConnect(PyShardedChannel* self,
+                                         PyObject* const* args,
+                                         Py_ssize_t nargs,
+                                         PyObject* kwnames)
+{
+  PyObject* values[2];
+
+  static const char* kwlist[] = { "path", "function", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 2, values))
+    return NULL;
+
+  const char* path = PyUnicode_AsUTF8(values[0]);
+  if (path == NULL)
+    return NULL;
+  if (!PyCallable_Check(values[1]))
+  {
+    PyErr_SetString(PyExc_TypeError, "function must be callable");
+    return NULL;
+  }
+
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = PyShardedChannelFind(self, ref, id);
+  if (shard == NULL)
+    return NULL;
+
+  // note: a callback is connected once in the shard for all functions
+  uint32_t callback;
+  if (shard->FindCallback(id, path, callback))
+  {
+    shard->AddFunction(callback, id, path, {}, values[1]);
+    Py_RETURN_TRUE;
+  }
+
+  std::string payload, reply;
+  AppendString(payload, path);
+  if (!ShardCall(*shard, kShardConnect, id, payload, reply))
+    return NULL;
+
+  const char* ptr = reply.data();
+  const char* end = ptr + reply.size();
+  std::vector<unsigned long> traits;
+  if (!ReadValue(ptr, end, callback) || !ReadSignature(ptr, end, traits))
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Invalid reply");
+    return NULL;
+  }
+
+  shard->AddFunction(callback, id, path, traits, values[1]);
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyShardedChannelDisconnect disconnects a function from a callback of the
+// channel; the callback is disconnected in the shard with its last function.
+//
+static PyObject* PyShardedChannelDisconnect(PyShardedChannel* self,
+                                            PyObject* const* args,
+                                            Py_ssize_t nargs,
+                                            PyObject* kwnames)
+{
+  PyObject* values[2];
+
+  static const char* kwlist[] = { "path", "function", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 2, values))
+    return NULL;
+
+  const char* path = PyUnicode_AsUTF8(values[0]);
+  ShardedGridRef ref;
+  uint32_t id;
+  Shard* shard = path != NULL ? PyShardedChannelFind(self, ref, id) : NULL;
+  if (shard == NULL)
+    return NULL;
+
+  uint32_t callback;
+  bool empty;
+  if (!shard->RemoveFunction(id, path, values[1], callback, empty))
+  {
+    PyErr_SetString(PyExc_AttributeError, "function not registered");
+    return NULL;
+  }
+
+  if (empty)
+  {
+    std::string payload, reply;
+    AppendValue<uint32_t>(payload, callback);
+    if (!ShardCall(*shard, kShardDisconnect, id, payload, reply))
+      return NULL;
+  }
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// PyShardedChannelGetLayout returns the layout of the channel.
+//
+static PyObject* PyShardedChannelGetLayout(PyShardedChannel* self, void*)
+{
+  auto& grid = self->grid->grid;
+  const char* name = PyUnicode_AsUTF8(self->name);
+  if (grid == nullptr || name == NULL)
+  {
+    PyErr_SetString(PyExc_AttributeError, "Channel has no layout");
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(grid->lock);
+  auto it = grid->channels.find(name);
+  if (it == grid->channels.end() || it->second.text.empty())
+  {
+    PyErr_SetString(PyExc_AttributeError, "Channel has no layout");
+    return NULL;
+  }
+  return PyUnicode_FromStringAndSize(it->second.text.data(),
+                                     it->second.text.size());
+}
+
+
+//
+// PyShardedChannelGetShard returns the index of the shard of the channel.
+//
+static PyObject* PyShardedChannelGetShard(PyShardedChannel* self, void*)
+{
+  auto& grid = self->grid->grid;
+  if (grid == nullptr)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "Sharded grid is closed");
+    return NULL;
+  }
+
+  const char* name = PyUnicode_AsUTF8(self->name);
+  if (name == NULL)
+    return NULL;
+
+  std::lock_guard<std::mutex> lock(grid->lock);
+  auto it = grid->channels.find(name);
+  if (it == grid->channels.end())
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", name);
+    return NULL;
+  }
+  return PyLong_FromSize_t(it->second.shard);
+}
+
+
+//
+// PyShardedGridGetItem implements grid[path] and returns the channel
+// ("channel") or the value of a parameter ("channel/pipeline/cell.param").
+//
+static PyObject* PyShardedGridGetItem(PyShardedGrid* self, PyObject* pypath)
+{
+  const char* path = PyUnicode_AsUTF8(pypath);
+  if (path == NULL)
+    return NULL;
+
+  const char* sep = strchr(path, '/');
+  std::string name = sep != NULL ? std::string(path, sep - path) : path;
+
+  bool found = false;
+  if (self->grid != nullptr)
+  {
+    std::lock_guard<std::mutex> lock(self->grid->lock);
+    found = self->grid->channels.count(name) != 0;
+  }
+  if (!found)
+  {
+    PyErr_Format(PyExc_KeyError, "'%s'", path);
+    return NULL;
+  }
+
+  PyObject* pychannel = PyShardedChannelCreate(self, name);
+  if (pychannel == NULL || sep == NULL)
+    return pychannel;
+
+  PyObject* pyparam = PyUnicode_FromString(sep + 1);
+  PyObject* value = pyparam != NULL ?
+    PyShardedChannelGet((PyShardedChannel*) pychannel, pyparam) : NULL;
+  Py_XDECREF(pyparam);
+  Py_DECREF(pychannel);
+  return value;
+}
+
+
+//
+// PyShardedGridSetItem implements grid[path] = value for a parameter
+// ("channel/pipeline/cell.param").
+//
+static int PyShardedGridSetItem(PyShardedGrid* self,
+                                PyObject* pypath,
+                                PyObject* value)
+{
+  const char* path = PyUnicode_AsUTF8(pypath);
+  if (path == NULL)
+    return -1;
+
+  const char* sep = strchr(path, '/');
+  if (sep == NULL || value == NULL)
+  {
+    PyErr_SetString(PyExc_TypeError, "Only parameters can be set");
+    return -1;
+  }
+
+  PyObject* pychannel =
+    PyShardedChannelCreate(self, std::string(path, sep - path));
+  PyObject* values = pychannel != NULL ?
+    Py_BuildValue("{sO}", sep + 1, value) : NULL;
+  PyObject* ret = values != NULL ?
+    PyShardedChannelApply((PyShardedChannel*) pychannel, values) : NULL;
+
+  Py_XDECREF(ret);
+  Py_XDECREF(values);
+  Py_XDECREF(pychannel);
+  return ret != NULL ? 0 : -1;
+}
+
+
+//
+// PyShardedChannelStr implements __str__ and returns the name of the channel.
+//
+static PyObject* PyShardedChannelStr(PyShardedChannel* self)
+{
+  Py_INCREF(self->name);
+  return self->name;
+}
+
+
+static int PyShardedChannelInit(PyShardedChannel* self,
+                                PyObject* args,
+                                PyObject* kwargs)
+{
+  PyErr_SetString(PyExc_TypeError,
+                  "Channels can only be created using the ShardedGrid API.");
+  return -1;
+}
+
+
+static void PyShardedChannelDealloc(PyShardedChannel* self)
+{
+  PyTypeObject* type = Py_TYPE(self);
+
+  Py_XDECREF(self->name);
+  Py_XDECREF(self->grid);
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
+}
+
+
+//
+// GridStreamerShardWorker runs the loop of a shard in the worker process
+// until the grid closes the socket. It doesn't return to python while the
+// shard is running.
+//
+PyObject* GridStreamerShardWorker(PyObject* module,
+                                  PyObject* const* args,
+                                  Py_ssize_t nargs)
+{
+  if (nargs != 2)
+  {
+    PyErr_SetString(PyExc_TypeError, "Expected the socket and ring");
+    return NULL;
+  }
+
+  int fd = PyLong_AsLong(args[0]);
+  int ringfd = PyLong_AsLong(args[1]);
+  if (PyErr_Occurred())
+    return NULL;
+
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(ringfd, &st) == 0)
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ringfd, 0);
+  if (map == MAP_FAILED)
+    return PyErr_SetFromErrno(PyExc_OSError);
+  close(ringfd);
+
+  // note: the worker exits with the grid instead of on its signals
+  signal(SIGINT, SIG_IGN);
+
+  Py_BEGIN_ALLOW_THREADS
+  {
+    ShardWorker worker(fd, (ShardRing*) map);
+    worker.Run();
+  }
+  Py_END_ALLOW_THREADS
+
+  munmap(map, st.st_size);
+  close(fd);
+  Py_RETURN_TRUE;
+}
+
+
+static PyGetSetDef pyshardedchannel_getsets[] =
+{
+  {
+    "layout",
+    (getter) PyShardedChannelGetLayout,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    "state",
+    (getter) PyShardedChannelGetState,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    "shard",
+    (getter) PyShardedChannelGetShard,
+    (setter) NULL,
+    NULL,
+    NULL
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyMethodDef pyshardedchannel_methods[] =
+{
+  {
+    "compile",
+    (PyCFunction) PyShardedChannelCompile,
+    METH_O,
+    "Compile a new layout to the channel unless it is the current layout"
+  },
+  {
+    "apply",
+    (PyCFunction) PyShardedChannelApply,
+    METH_O,
+    "Set multiple parameters, keyed by 'pipeline/cell.parameter', at once"
+  },
+  {
+    "get",
+    (PyCFunction) PyShardedChannelGet,
+    METH_O,
+    "Return the value of a 'pipeline/cell.parameter' parameter"
+  },
+  {
+    "connect",
+    (PyCFunction)(void(*)(void)) PyShardedChannelConnect,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Connect a function to a 'pipeline/cell.on_callback' callback"
+  },
+  {
+    "disconnect",
+    (PyCFunction)(void(*)(void)) PyShardedChannelDisconnect,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Disconnect a function from a 'pipeline/cell.on_callback' callback"
+  },
+  {
+    "open",
+    (PyCFunction) PyShardedChannelOpen,
+    METH_NOARGS,
+    "Open the channel and set state to Set",
+  },
+  {
+    "close",
+    (PyCFunction) PyShardedChannelClose,
+    METH_NOARGS,
+    "Close the channel",
+  },
+  {
+    "run",
+    (PyCFunction) PyShardedChannelRun,
+    METH_NOARGS,
+    "Run the channel",
+  },
+  {
+    "pause",
+    (PyCFunction) PyShardedChannelPause,
+    METH_NOARGS,
+    "Pause the channel",
+  },
+  {
+    "flush",
+    (PyCFunction) PyShardedChannelFlush,
+    METH_NOARGS,
+    "Flush the channel",
+  },
+  {
+    "stop",
+    (PyCFunction) PyShardedChannelStop,
+    METH_NOARGS,
+    "Stop the channel and drop any outstanding transports",
+  },
+  {
+    "wait",
+    (PyCFunction)(void(*)(void)) PyShardedChannelWait,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Wait until the channel is in the state ('end'), or the timeout expired",
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyType_Slot pyshardedchannel_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyShardedChannelDealloc },
+  { Py_tp_str, (void*) PyShardedChannelStr },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "ShardedChannel is a channel running in a shard of a ShardedGrid") },
+  { Py_tp_methods, pyshardedchannel_methods },
+  { Py_tp_getset, pyshardedchannel_getsets },
+  { Py_tp_init, (void*) PyShardedChannelInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { 0, NULL }
+};
+
+
+PyType_Spec pyshardedchannel_spec =
+{
+  .name = "gridstreamer.ShardedChannel",
+  .basicsize = sizeof(PyShardedChannel),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pyshardedchannel_slots,
+};
+
+
+static PyMethodDef pyshardedgrid_methods[] =
+{
+  {
+    "allocate_channel",
+    (PyCFunction)(void(*)(void)) PyShardedGridAllocateChannel,
+    METH_FASTCALL | METH_KEYWORDS,
+    "Allocate a new channel in a shard of the grid"
+  },
+  {
+    "channels",
+    (PyCFunction) PyShardedGridGetChannels,
+    METH_NOARGS,
+    "Return all channels in the grid"
+  },
+  {
+    "shards",
+    (PyCFunction) PyShardedGridGetShards,
+    METH_NOARGS,
+    "Return the process id, channels, and callback events of each shard"
+  },
+  {
+    "close",
+    (PyCFunction) PyShardedGridClose,
+    METH_NOARGS,
+    "Stop the shards and release their channels"
+  },
+  {
+    NULL  /* Sentinel */
+  }
+};
+
+
+static PyMemberDef pyshardedgrid_members[] =
+{
+  {
+    "name",
+    T_OBJECT_EX, offsetof(PyShardedGrid, name),
+    0,
+    "name"
+  },
+  {
+    NULL
+  }
+};
+
+
+static PyType_Slot pyshardedgrid_slots[] =
+{
+  { Py_tp_dealloc, (void*) PyShardedGridDealloc },
+  { Py_tp_doc, (void*) PyDoc_STR(
+        "ShardedGrid runs the channels of a grid in worker processes") },
+  { Py_tp_methods, pyshardedgrid_methods },
+  { Py_tp_members, pyshardedgrid_members },
+  { Py_tp_init, (void*) PyShardedGridInit },
+  { Py_tp_new, (void*) PyType_GenericNew },
+  { Py_mp_subscript, (void*) PyShardedGridGetItem },
+  { Py_mp_ass_subscript, (void*) PyShardedGridSetItem },
+  { 0, NULL }
+};
+
+
+PyType_Spec pyshardedgrid_spec =
+{
+  .name = "gridstreamer.ShardedGrid",
+  .basicsize = sizeof(PyShardedGrid),
+  .itemsize = 0,
+  .flags = Py_TPFLAGS_DEFAULT,
+  .slots = pyshardedgrid_slots,
+};
+
+
+} // end of extern "C"
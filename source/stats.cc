@@ -0,0 +1,272 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <Python.h>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+
+
+void StatsHistogram::Add(uint64_t ns)
+{
+  int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+  if (bucket >= kBuckets)
+    bucket = kBuckets - 1;
+
+  count.fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(ns, std::memory_order_relaxed);
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t curr = max.load(std::memory_order_relaxed);
+  while (ns > curr &&
+         !max.compare_exchange_weak(curr, ns, std::memory_order_relaxed))
+    ;
+}
+
+
+void StatsHistogram::Merge(const StatsHistogram& other)
+{
+  count.fetch_add(other.count.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+  total.fetch_add(other.total.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+  for (int i = 0; i < kBuckets; i++)
+    buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+
+  uint64_t other_max = other.max.load(std::memory_order_relaxed);
+  if (other_max > max.load(std::memory_order_relaxed))
+    max.store(other_max, std::memory_order_relaxed);
+}
+
+
+void StatsHistogram::Reset()
+{
+  count = 0;
+  total = 0;
+  max = 0;
+  for (int i = 0; i < kBuckets; i++)
+    buckets[i] = 0;
+}
+
+
+//
+// The statistics are kept in a shard per thread, which only the thread
+// updates, so the counters don't need atomic read-modify-write operations.
+// The shards are registered in a list for reading the statistics, and merged
+// into the retired statistics when the thread exits. Counters are reset by
+// moving their base, which is protected by the lock.
+//
+struct StatsCounters
+{
+  std::atomic<uint64_t>             counters[kStatsCounterCount] = {};
+  uint64_t                          base[kStatsCounterCount] = {};
+  StatsHistogram                    timers[kStatsTimerCount];
+};
+
+struct StatsShard : StatsCounters
+{
+  StatsShard();
+  ~StatsShard();
+
+  uint32_t                          samples = 0;
+};
+
+static std::mutex stats_lock;
+static std::list<StatsCounters*> stats_shards;
+static StatsCounters stats_retired;
+
+
+StatsShard::StatsShard()
+{
+  std::lock_guard<std::mutex> lock(stats_lock);
+  stats_shards.push_back(this);
+}
+
+
+StatsShard::~StatsShard()
+{
+  std::lock_guard<std::mutex> lock(stats_lock);
+  stats_shards.remove(this);
+
+  for (int i = 0; i < kStatsCounterCount; i++)
+    stats_retired.counters[i] += counters[i] - base[i];
+  for (int i = 0; i < kStatsTimerCount; i++)
+    stats_retired.timers[i].Merge(timers[i]);
+}
+
+
+static const char* stats_counter_names[kStatsCounterCount] =
+{
+  "callback_received",
+  "callback_dispatched",
+  "callback_dropped",
+  "parameter_get",
+  "parameter_set",
+};
+
+static const char* stats_timer_names[kStatsTimerCount] =
+{
+  "gil_wait",
+  "handler",
+  "parameter_get_time",
+  "parameter_set_time",
+  "compile",
+  "set_state",
+};
+
+
+static StatsShard& GetStatsShard()
+{
+  thread_local StatsShard shard;
+  return shard;
+}
+
+
+void StatsCount(StatsCounter counter)
+{
+  auto& value = GetStatsShard().counters[counter];
+  value.store(value.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+}
+
+
+void StatsRecord(StatsTimer timer, uint64_t ns)
+{
+  GetStatsShard().timers[timer].Add(ns);
+}
+
+
+uint64_t StatsCountSampled(StatsCounter counter)
+{
+  auto& shard = GetStatsShard();
+  auto& value = shard.counters[counter];
+  value.store(value.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+  return (shard.samples++ % kStatsSampleRate) == 0 ? StatsNow() : 0;
+}
+
+
+PyObject* StatsHistogramToDict(const StatsHistogram& histogram)
+{
+  unsigned long long count = histogram.count;
+  unsigned long long total = histogram.total;
+  unsigned long long max = histogram.max;
+
+  PyObject* buckets = PyList_New(0);
+  if (buckets == NULL)
+    return NULL;
+
+  // note: buckets are reported by their upper bound
+  for (int i = 0; i < StatsHistogram::kBuckets; i++)
+  {
+    uint64_t value = histogram.buckets[i];
+    if (value == 0)
+      continue;
+
+    PyObject* bucket = Py_BuildValue("(KK)", 2ULL << i,
+                                     (unsigned long long) value);
+    if (bucket == NULL || PyList_Append(buckets, bucket) != 0)
+    {
+      Py_XDECREF(bucket);
+      Py_DECREF(buckets);
+      return NULL;
+    }
+    Py_DECREF(bucket);
+  }
+
+  return Py_BuildValue("{sKsKsdsKsN}",
+                       "count", count,
+                       "total_ns", total,
+                       "mean_ns", count != 0 ? (double) total / count : 0.0,
+                       "max_ns", max,
+                       "buckets", buckets);
+}
+
+
+//
+// GridStreamerStats returns a dictionary of the counters and histograms of
+// the binding, and optionally resets them.
+//
+PyObject* GridStreamerStats(PyObject* module,
+                            PyObject* const* args,
+                            Py_ssize_t nargs,
+                            PyObject* kwnames)
+{
+  PyObject* pyreset;
+
+  static const char* kwlist[] = { "reset", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pyreset))
+    return NULL;
+
+  int reset = pyreset != NULL ? PyObject_IsTrue(pyreset) : 0;
+  if (reset < 0)
+    return NULL;
+
+  uint64_t counters[kStatsCounterCount] = {};
+  StatsHistogram timers[kStatsTimerCount];
+
+  {
+    std::lock_guard<std::mutex> lock(stats_lock);
+
+    auto shards = stats_shards;
+    shards.push_back(&stats_retired);
+
+    for (auto shard : shards)
+    {
+      for (int i = 0; i < kStatsCounterCount; i++)
+      {
+        uint64_t value = shard->counters[i].load();
+        counters[i] += value - shard->base[i];
+        if (reset)
+          shard->base[i] = value;
+      }
+      for (int i = 0; i < kStatsTimerCount; i++)
+      {
+        timers[i].Merge(shard->timers[i]);
+        if (reset)
+          shard->timers[i].Reset();
+      }
+    }
+  }
+
+  PyObject* dict = PyDict_New();
+  if (dict == NULL)
+    return NULL;
+
+  for (int i = 0; i < kStatsCounterCount; i++)
+  {
+    PyObject* value = PyLong_FromUnsignedLongLong(counters[i]);
+    if (value == NULL ||
+        PyDict_SetItemString(dict, stats_counter_names[i], value) != 0)
+    {
+      Py_XDECREF(value);
+      Py_DECREF(dict);
+      return NULL;
+    }
+    Py_DECREF(value);
+  }
+
+  for (int i = 0; i < kStatsTimerCount; i++)
+  {
+    PyObject* value = StatsHistogramToDict(timers[i]);
+    if (value == NULL ||
+        PyDict_SetItemString(dict, stats_timer_names[i], value) != 0)
+    {
+      Py_XDECREF(value);
+      Py_DECREF(dict);
+      return NULL;
+    }
+    Py_DECREF(value);
+  }
+
+  return dict;
+}
@@ -0,0 +1,334 @@
+//
+// Copyright (C) Chris Zankel. All rights reserved.
+// This code is subject to U.S. and other copyright laws and
+// intellectual property protections.
+//
+// The contents of this file are confidential and proprietary to Chris Zankel.
+//
+
+#include "gridmodule.h"
+
+#include <Python.h>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+std::atomic<bool> trace_enabled{false};
+
+
+//
+// The events are recorded in a ring buffer per thread, which only the thread
+// writes. The thread publishes an event by incrementing the count, so the
+// events can be read from another thread without a lock: an event is valid
+// if it wasn't overwritten while it was copied. The buffers are registered
+// in a list, and kept until the next trace_start() for threads that exit.
+//
+struct TraceEvent
+{
+  const char*                       name;
+  uint64_t                          start;
+  uint64_t                          duration;
+  char                              phase;
+  bool                              gil;
+  char                              detail[54];
+};
+
+struct TraceBuffer
+{
+  TraceBuffer(size_t capacity, uint64_t generation)
+    : events(new TraceEvent[capacity]()),
+      capacity(capacity),
+      generation(generation),
+      tid(syscall(SYS_gettid)) {}
+
+  std::unique_ptr<TraceEvent[]>     events;
+  size_t                            capacity;
+  uint64_t                          generation;
+  long                              tid;
+  std::atomic<uint64_t>             count{0};
+};
+
+static std::mutex trace_lock;
+static std::list<std::shared_ptr<TraceBuffer>> trace_buffers;
+static std::atomic<uint64_t> trace_generation{0};
+static size_t trace_capacity = 0;
+
+static const size_t kTraceDefaultCapacity = 65536;
+
+
+//
+// GetTraceBuffer returns the buffer of the thread for the current trace, and
+// allocates a new buffer for the first event of the thread in a trace.
+//
+static TraceBuffer* GetTraceBuffer()
+{
+  thread_local std::shared_ptr<TraceBuffer> buffer;
+
+  uint64_t generation = trace_generation.load(std::memory_order_acquire);
+  if (buffer == nullptr || buffer->generation != generation)
+  {
+    std::lock_guard<std::mutex> lock(trace_lock);
+    if (!trace_enabled)
+      return NULL;
+
+    // note: the buffer keeps a spare slot for the event being written
+    buffer = std::make_shared<TraceBuffer>(trace_capacity + 1,
+                                           trace_generation);
+    trace_buffers.push_back(buffer);
+  }
+
+  return buffer.get();
+}
+
+
+void TraceRecord(char phase,
+                 const char* name,
+                 uint64_t start,
+                 uint64_t duration,
+                 const char* detail)
+{
+  TraceBuffer* buffer = GetTraceBuffer();
+  if (buffer == NULL)
+    return;
+
+  uint64_t index = buffer->count.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[index % buffer->capacity];
+
+  event.name = name;
+  event.start = start;
+  event.duration = duration;
+  event.phase = phase;
+  event.gil = PyGILState_Check();
+  event.detail[0] = '\0';
+  if (detail != NULL)
+    strncat(event.detail, detail, sizeof(event.detail) - 1);
+
+  buffer->count.store(index + 1, std::memory_order_release);
+}
+
+
+std::string TraceStateDetail(const char* name,
+                             const grid::Channel& channel,
+                             grid::State state)
+{
+  if (!TraceEnabled())
+    return std::string();
+
+  return std::string(name) + ": " +
+    GridStreamerStateName(channel.GetState()) + " -> " +
+    GridStreamerStateName(state);
+}
+
+
+//
+// CopyTraceEvents is a helper function to copy the valid events of a buffer.
+//
+static void CopyTraceEvents(TraceBuffer& buffer, std::vector<TraceEvent>& events)
+{
+  uint64_t end = buffer.count.load(std::memory_order_acquire);
+  uint64_t begin = end > buffer.capacity ? end - buffer.capacity : 0;
+
+  std::vector<TraceEvent> copy;
+  copy.reserve(end - begin);
+  for (uint64_t i = begin; i < end; i++)
+    copy.push_back(buffer.events[i % buffer.capacity]);
+
+  // note: events that were overwritten while copying are dropped, including
+  // the slot of the event the thread may be writing
+  uint64_t curr = buffer.count.load(std::memory_order_acquire) + 1;
+  uint64_t valid = curr > buffer.capacity ? curr - buffer.capacity : 0;
+  for (uint64_t i = std::max(begin, valid); i < end; i++)
+    events.push_back(copy[i - begin]);
+}
+
+
+//
+// FormatTraceEvent is a helper function to append an event in the Chrome
+// trace event format to a string. Timestamps are in microseconds.
+//
+static void FormatTraceEvent(std::string& json,
+                             const TraceEvent& event,
+                             long pid,
+                             long tid)
+{
+  char buf[160];
+
+  json += "{\"name\":";
+  GridStreamerAppendJSONString(json, event.name, strlen(event.name));
+
+  snprintf(buf, sizeof(buf),
+           ",\"cat\":\"grid\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld",
+           event.phase, event.start / 1000.0, pid, tid);
+  json += buf;
+
+  if (event.phase == 'X')
+  {
+    snprintf(buf, sizeof(buf), ",\"dur\":%.3f", event.duration / 1000.0);
+    json += buf;
+  }
+  else if (event.phase == 'i')
+    json += ",\"s\":\"t\"";
+
+  json += ",\"args\":{\"gil\":";
+  json += event.gil ? "true" : "false";
+  if (event.detail[0] != '\0')
+  {
+    json += ",\"detail\":";
+    GridStreamerAppendJSONString(json, event.detail, strlen(event.detail));
+  }
+  json += "}}";
+}
+
+
+//
+// GridStreamerTraceStart starts recording events, discarding any earlier
+// events. The size is the number of events that are kept per thread.
+//
+PyObject* GridStreamerTraceStart(PyObject* module,
+                                 PyObject* const* args,
+                                 Py_ssize_t nargs,
+                                 PyObject* kwnames)
+{
+  PyObject* pysize;
+
+  static const char* kwlist[] = { "size", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pysize))
+    return NULL;
+
+  size_t size = kTraceDefaultCapacity;
+  if (pysize != NULL)
+  {
+    size = PyLong_AsSize_t(pysize);
+    if (size == (size_t) -1 && PyErr_Occurred())
+      return NULL;
+    if (size == 0)
+    {
+      PyErr_SetString(PyExc_ValueError, "size must be positive");
+      return NULL;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(trace_lock);
+  trace_buffers.clear();
+  trace_capacity = size;
+  trace_generation.fetch_add(1, std::memory_order_release);
+  trace_enabled = true;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// GridStreamerTraceStop stops recording events; the recorded events are kept
+// until the trace is started again.
+//
+PyObject* GridStreamerTraceStop(PyObject* module, PyObject*)
+{
+  std::lock_guard<std::mutex> lock(trace_lock);
+  trace_enabled = false;
+
+  Py_RETURN_TRUE;
+}
+
+
+//
+// GridStreamerTraceMark records an instant event from Python, for example to
+// mark the activity of the application in the trace.
+//
+PyObject* GridStreamerTraceMark(PyObject* module, PyObject* pyname)
+{
+  const char* name = PyUnicode_AsUTF8(pyname);
+  if (name == NULL)
+    return NULL;
+
+  TraceInstant("mark", name);
+  Py_RETURN_TRUE;
+}
+
+
+//
+// GridStreamerTraceDump returns the recorded events in the Chrome trace event
+// format as bytes, or writes them to a file.
+//
+PyObject* GridStreamerTraceDump(PyObject* module,
+                                PyObject* const* args,
+                                Py_ssize_t nargs,
+                                PyObject* kwnames)
+{
+  PyObject* pypath;
+
+  static const char* kwlist[] = { "path", NULL };
+  if (!GridStreamerParseArguments(args, nargs, kwnames, kwlist, 0, &pypath))
+    return NULL;
+
+  PyObject* pybytes = NULL;
+  if (pypath != NULL && pypath != Py_None &&
+      !PyUnicode_FSConverter(pypath, &pybytes))
+    return NULL;
+
+  std::string json;
+  bool written = false;
+
+  Py_BEGIN_ALLOW_THREADS
+  {
+    std::list<std::shared_ptr<TraceBuffer>> buffers;
+    {
+      std::lock_guard<std::mutex> lock(trace_lock);
+      buffers = trace_buffers;
+    }
+
+    long pid = getpid();
+    std::vector<TraceEvent> events;
+    bool first = true;
+
+    json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (auto& buffer : buffers)
+    {
+      events.clear();
+      CopyTraceEvents(*buffer, events);
+      for (auto& event : events)
+      {
+        if (!first)
+          json += ",\n";
+        FormatTraceEvent(json, event, pid, buffer->tid);
+        first = false;
+      }
+    }
+    json += "]}\n";
+
+    if (pybytes != NULL)
+    {
+      FILE* file = fopen(PyBytes_AS_STRING(pybytes), "w");
+      if (file != NULL)
+      {
+        written = fwrite(json.data(), 1, json.size(), file) == json.size();
+        written = fclose(file) == 0 && written;
+      }
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  if (pybytes == NULL)
+    return PyBytes_FromStringAndSize(json.data(), json.size());
+
+  if (!written)
+  {
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, pypath);
+    Py_DECREF(pybytes);
+    return NULL;
+  }
+
+  Py_DECREF(pybytes);
+  Py_RETURN_TRUE;
+}